@@ -34,8 +34,8 @@ static void check( GtkWidget *widget,
     printf("%d",ca_context_play (ca_gtk_context_get (), 0,
 			 CA_PROP_EVENT_ID, "button-pressed",
 			 CA_PROP_EVENT_DESCRIPTION, "Hi seaslug",
-             CA_PROP_VISUAL_EFFECT, "IMAGE_ALERT",
-             CA_PROP_MEDIA_IMAGE_PATH, "/home/rfoeckin/apps/images/checkmark.png",
+             CA_PROP_EVENT_VISUAL_EFFECT, "IMAGE_ALERT",
+             CA_PROP_MEDIA_IMAGE_FILENAME, "/home/rfoeckin/apps/images/checkmark.png",
             NULL));
 }
 
@@ -51,8 +51,9 @@ static void error(GtkWidget *widget, gpointer window){
   printf("%d",ca_context_play (ca_gtk_context_get (), 0,
 			 CA_PROP_EVENT_ID, "button-pressed",
 			 CA_PROP_EVENT_DESCRIPTION, "colorcolorcolor",
-             CA_PROP_VISUAL_EFFECT, "COLOR_ALERT",
-             CA_PROP_COLOR, "red",
+             CA_PROP_EVENT_VISUAL_EFFECT, "COLOR_ALERT",
+             CA_PROP_EVENT_VISUAL_COLOR, "red",
+             CA_PROP_EVENT_VISUAL_DURATION, "600",
             NULL));
   /* Set up and display an error dialog */
   GtkWidget *dialog;
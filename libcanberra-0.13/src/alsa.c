@@ -36,6 +36,7 @@
 #include "read-sound-file.h"
 #include "sound-theme-spec.h"
 #include "malloc.h"
+#include "probes.h"
 
 struct private;
 
@@ -125,8 +126,10 @@ int driver_destroy(ca_context *c) {
 
             out->dead = TRUE;
 
-            if (out->callback)
+            if (out->callback) {
+                CA_PROBE4(callback, "alsa", c, out->id, CA_ERROR_DESTROYED);
                 out->callback(c, out->id, CA_ERROR_DESTROYED, out->userdata);
+            }
 
             /* This will cause the thread to wakeup and terminate */
             if (out->pipe_fd[1] >= 0) {
@@ -186,6 +189,14 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
     return CA_ERROR_NOTSUPPORTED;
 }
 
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+
+    return CA_ERROR_NOTSUPPORTED;
+}
+
 static int translate_error(int error) {
 
     switch (error) {
@@ -221,11 +232,11 @@ static const snd_pcm_format_t sample_type_table[] = {
     [CA_SAMPLE_U8] = SND_PCM_FORMAT_U8
 };
 
-static int open_alsa(ca_context *c, struct outstanding *out) {
+static int open_alsa(ca_context *c, struct outstanding *out, ca_latency_t latency) {
     struct private *p;
     int ret;
     snd_pcm_hw_params_t *hwparams;
-    unsigned rate;
+    unsigned rate, buffer_time;
 
     snd_pcm_hw_params_alloca(&hwparams);
 
@@ -259,6 +270,17 @@ static int open_alsa(ca_context *c, struct outstanding *out) {
     if ((ret = snd_pcm_hw_params_set_channels(out->pcm, hwparams, ca_sound_file_get_nchannels(out->file))) < 0)
         goto finish;
 
+    if ((buffer_time = ca_latency_usec(latency)) > 0) {
+        unsigned period_time;
+
+        if ((ret = snd_pcm_hw_params_set_buffer_time_near(out->pcm, hwparams, &buffer_time, NULL)) < 0)
+            goto finish;
+
+        period_time = buffer_time / CA_LATENCY_PERIODS;
+        if ((ret = snd_pcm_hw_params_set_period_time_near(out->pcm, hwparams, &period_time, NULL)) < 0)
+            goto finish;
+    }
+
     if ((ret = snd_pcm_hw_params(out->pcm, hwparams)) < 0)
         goto finish;
 
@@ -343,6 +365,8 @@ static void* thread_func(void *userdata) {
 
                 case SND_PCM_STATE_XRUN:
 
+                    CA_PROBE4(driver_recover, "alsa", out->context, out->id, -EPIPE);
+
                     if ((ret = snd_pcm_recover(out->pcm, -EPIPE, 1)) != 0) {
                         ret = translate_error(ret);
                         goto finish;
@@ -351,6 +375,8 @@ static void* thread_func(void *userdata) {
 
                 case SND_PCM_STATE_SUSPENDED:
 
+                    CA_PROBE4(driver_recover, "alsa", out->context, out->id, -ESTRPIPE);
+
                     if ((ret = snd_pcm_recover(out->pcm, -ESTRPIPE, 1)) != 0) {
                         ret = translate_error(ret);
                         goto finish;
@@ -388,6 +414,8 @@ static void* thread_func(void *userdata) {
 
         if ((sframes = snd_pcm_writei(out->pcm, d, nbytes/fs)) < 0) {
 
+            CA_PROBE4(driver_recover, "alsa", out->context, out->id, (int) sframes);
+
             if ((ret = snd_pcm_recover(out->pcm, (int) sframes, 1)) < 0) {
                 ret = translate_error(ret);
                 goto finish;
@@ -396,6 +424,8 @@ static void* thread_func(void *userdata) {
             continue;
         }
 
+        CA_PROBE4(driver_write, "alsa", out->context, out->id, (size_t) sframes*fs);
+
         nbytes -= (size_t) sframes*fs;
         d = (uint8_t*) d + (size_t) sframes*fs;
     }
@@ -408,8 +438,10 @@ finish:
     ca_free(pfd);
 
     if (!out->dead)
-        if (out->callback)
+        if (out->callback) {
+            CA_PROBE4(callback, "alsa", out->context, out->id, ret);
             out->callback(out->context, out->id, ret, out->userdata);
+        }
 
     ca_mutex_lock(p->outstanding_mutex);
 
@@ -428,6 +460,7 @@ finish:
 int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
     struct private *p;
     struct outstanding *out = NULL;
+    ca_latency_t latency;
     int ret;
     pthread_t thread;
 
@@ -454,10 +487,13 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
         goto finish;
     }
 
+    if ((ret = ca_get_latency(&latency, c->props, proplist)) < 0)
+        goto finish;
+
     if ((ret = ca_lookup_sound(&out->file, NULL, &p->theme, c->props, proplist)) < 0)
         goto finish;
 
-    if ((ret = open_alsa(c, out)) < 0)
+    if ((ret = open_alsa(c, out, latency)) < 0)
         goto finish;
 
     /* OK, we're ready to go, so let's add this to our list */
@@ -507,8 +543,10 @@ int driver_cancel(ca_context *c, uint32_t id) {
 
         out->dead = TRUE;
 
-        if (out->callback)
+        if (out->callback) {
+            CA_PROBE4(callback, "alsa", c, out->id, CA_ERROR_CANCELED);
             out->callback(c, out->id, CA_ERROR_CANCELED, out->userdata);
+        }
 
         /* This will cause the thread to wakeup and terminate */
         if (out->pipe_fd[1] >= 0) {
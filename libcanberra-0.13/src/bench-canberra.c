@@ -0,0 +1,952 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include "canberra.h"
+#include "proplist.h"
+#include "read-sound-file.h"
+#include "sound-theme-spec.h"
+#include "bench-theme.h"
+#include "malloc.h"
+#include "macro.h"
+
+#ifdef HAVE_CACHE
+#include "cache.h"
+#endif
+
+/* Microbenchmarks for the hot paths of libcanberra, run with "make
+ * bench". Each benchmark is calibrated to run for at least
+ * MIN_RUN_NS, then repeated N_RUNS times. We print the median
+ * ns/op, plus allocations/op and syscalls/op of the calling thread,
+ * as a JSON document on stdout, so that results can be tracked over
+ * time.
+ *
+ * Everything runs against a synthetic sound theme in a temporary
+ * directory, so neither the installed themes nor a sound device
+ * matter. With --scaling ("make bench-scaling") we instead sweep the
+ * shape of generated themes and report how the lookup cost grows
+ * along each dimension. */
+
+#define MIN_RUN_NS 50000000ULL
+#define MAX_ITERATIONS (1UL << 24)
+#define N_RUNS 5
+
+#define THEME_NAME "bench"
+#define WAV_SECONDS 1
+#define WAV_RATE 44100
+#define WAV_CHANNELS 2
+
+typedef void (*bench_func_t)(void *userdata);
+
+static char *tmpdir = NULL;
+static ca_bool_t first_result = TRUE;
+
+/* Allocation counting. glibc allows replacing malloc(), and its own
+ * internal allocations go through the replacement, too. We only count
+ * the calling thread, just like the syscall counter does. */
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static __thread unsigned long n_allocs = 0;
+static const ca_bool_t have_alloc_counter = TRUE;
+
+void *malloc(size_t size) {
+    n_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    n_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *p, size_t size) {
+    n_allocs++;
+    return __libc_realloc(p, size);
+}
+
+#else
+
+static unsigned long n_allocs = 0;
+static const ca_bool_t have_alloc_counter = FALSE;
+
+#endif
+
+/* Syscall counting. Preferably through the raw_syscalls:sys_enter
+ * tracepoint, which counts every syscall of this thread. If perf
+ * isn't available to us, fall back to the read/write syscall counters
+ * of /proc/self/io, which miss open(), stat() and friends and count
+ * the whole process. */
+
+static int perf_fd = -1;
+static const char *syscall_counter = "none";
+static uint64_t syscall_overhead = 0;
+
+static int read_u64_file(const char *fn, uint64_t *v) {
+    FILE *f;
+    unsigned long long k;
+    int r;
+
+    if (!(f = fopen(fn, "r")))
+        return -1;
+
+    r = fscanf(f, "%llu", &k);
+    fclose(f);
+
+    if (r != 1)
+        return -1;
+
+    *v = (uint64_t) k;
+    return 0;
+}
+
+static uint64_t proc_io_syscalls(void) {
+    FILE *f;
+    char ln[128];
+    unsigned long long k;
+    uint64_t n = 0;
+
+    if (!(f = fopen("/proc/self/io", "r")))
+        return 0;
+
+    while (fgets(ln, sizeof(ln), f))
+        if (sscanf(ln, "syscr: %llu", &k) == 1 || sscanf(ln, "syscw: %llu", &k) == 1)
+            n += (uint64_t) k;
+
+    fclose(f);
+    return n;
+}
+
+static uint64_t count_syscalls(void) {
+    uint64_t n = 0;
+
+    if (perf_fd >= 0) {
+        if (read(perf_fd, &n, sizeof(n)) != sizeof(n))
+            return 0;
+        return n;
+    }
+
+    if (ca_streq(syscall_counter, "proc-io"))
+        return proc_io_syscalls();
+
+    return 0;
+}
+
+static void syscall_counter_init(void) {
+#if defined(__linux__) && defined(__NR_perf_event_open)
+    static const char * const id_files[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+    };
+    struct perf_event_attr attr;
+    uint64_t id;
+    unsigned i;
+
+    for (i = 0; i < CA_ELEMENTSOF(id_files); i++) {
+
+        if (read_u64_file(id_files[i], &id) < 0)
+            continue;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+
+        if ((perf_fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0)) >= 0) {
+            syscall_counter = "perf";
+            break;
+        }
+    }
+#endif
+
+    if (perf_fd < 0 && access("/proc/self/io", R_OK) == 0)
+        syscall_counter = "proc-io";
+
+    /* Reading the counter costs syscalls itself */
+    if (!ca_streq(syscall_counter, "none")) {
+        uint64_t a, b;
+
+        a = count_syscalls();
+        b = count_syscalls();
+        syscall_overhead = b - a;
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t *x = a, *y = b;
+
+    return *x < *y ? -1 : (*x > *y ? 1 : 0);
+}
+
+/* params is an optional JSON fragment describing the benchmark
+ * parameters, such as the theme shape of the scaling runs */
+static void print_result_start(const char *name, const char *params) {
+    printf("%s\n    { \"name\": \"%s\"", first_result ? "" : ",", name);
+
+    if (params)
+        printf(", %s", params);
+
+    first_result = FALSE;
+}
+
+static void bench_skip_params(const char *name, const char *params, const char *reason) {
+    print_result_start(name, params);
+    printf(", \"skipped\": \"%s\" }", reason);
+}
+
+static void bench_skip(const char *name, const char *reason) {
+    bench_skip_params(name, NULL, reason);
+}
+
+/* bytes_per_op is only known for the decoders, pass 0 otherwise */
+static void bench_run_params(const char *name, const char *params, bench_func_t func, void *userdata, uint64_t bytes_per_op) {
+    unsigned long n = 1, i;
+    unsigned r;
+    uint64_t t, samples[N_RUNS], allocs = 0, syscalls = 0;
+
+    /* Warm up, and find out how many iterations we need */
+    for (;;) {
+        t = now_ns();
+        for (i = 0; i < n; i++)
+            func(userdata);
+        t = now_ns() - t;
+
+        if (t >= MIN_RUN_NS || n >= MAX_ITERATIONS)
+            break;
+
+        n *= 2;
+    }
+
+    for (r = 0; r < N_RUNS; r++) {
+        unsigned long a;
+        uint64_t s;
+
+        a = n_allocs;
+        s = count_syscalls();
+        t = now_ns();
+
+        for (i = 0; i < n; i++)
+            func(userdata);
+
+        samples[r] = now_ns() - t;
+        syscalls = count_syscalls() - s;
+        allocs = n_allocs - a;
+    }
+
+    qsort(samples, N_RUNS, sizeof(uint64_t), compare_u64);
+
+    print_result_start(name, params);
+    printf(", \"iterations\": %lu, \"runs\": %u, \"ns_per_op\": %.1f, \"ns_per_op_min\": %.1f",
+           n, N_RUNS,
+           (double) samples[N_RUNS/2] / (double) n,
+           (double) samples[0] / (double) n);
+
+    if (have_alloc_counter)
+        printf(", \"allocs_per_op\": %.2f", (double) allocs / (double) n);
+    else
+        printf(", \"allocs_per_op\": null");
+
+    if (!ca_streq(syscall_counter, "none"))
+        printf(", \"syscalls_per_op\": %.2f",
+               (double) (syscalls > syscall_overhead ? syscalls - syscall_overhead : 0) / (double) n);
+    else
+        printf(", \"syscalls_per_op\": null");
+
+    if (bytes_per_op > 0)
+        printf(", \"bytes_per_op\": %llu, \"mb_per_s\": %.1f",
+               (unsigned long long) bytes_per_op,
+               (double) bytes_per_op * (double) n * 1000.0 / (double) samples[N_RUNS/2]);
+
+    printf(" }");
+    fflush(stdout);
+}
+
+static void bench_run(const char *name, bench_func_t func, void *userdata, uint64_t bytes_per_op) {
+    bench_run_params(name, NULL, func, userdata, bytes_per_op);
+}
+
+/* Fixtures */
+
+static char *tmp_path(const char *fmt, const char *arg) {
+    char *p, *r;
+
+    if (!(p = ca_sprintf_malloc(fmt, arg ? arg : "")))
+        abort();
+
+    if (!(r = ca_sprintf_malloc("%s/%s", tmpdir, p)))
+        abort();
+
+    ca_free(p);
+    return r;
+}
+
+static void write_file(const char *fn, const void *data, size_t l) {
+    FILE *f;
+
+    if (!(f = fopen(fn, "w")) || fwrite(data, 1, l, f) != l || fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", fn, strerror(errno));
+        exit(1);
+    }
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+/* A 16 bit PCM WAV file with a little noise, so nothing can take
+ * shortcuts on silence */
+static void write_wav(const char *fn, unsigned seconds) {
+    uint32_t data_size = seconds * WAV_RATE * WAV_CHANNELS * 2, i;
+    uint8_t *b;
+
+    if (!(b = ca_malloc(44 + data_size)))
+        abort();
+
+    memcpy(b, "RIFF", 4);
+    put_le32(b + 4, 36 + data_size);
+    memcpy(b + 8, "WAVEfmt ", 8);
+    put_le32(b + 16, 16);
+    put_le16(b + 20, 1);
+    put_le16(b + 22, WAV_CHANNELS);
+    put_le32(b + 24, WAV_RATE);
+    put_le32(b + 28, WAV_RATE * WAV_CHANNELS * 2);
+    put_le16(b + 32, WAV_CHANNELS * 2);
+    put_le16(b + 34, 16);
+    memcpy(b + 36, "data", 4);
+    put_le32(b + 40, data_size);
+
+    for (i = 0; i < data_size; i++)
+        b[44 + i] = (uint8_t) (i * 2654435761U >> 24);
+
+    write_file(fn, b, 44 + data_size);
+    ca_free(b);
+}
+
+static void make_dir(const char *fmt, const char *arg) {
+    char *p = tmp_path(fmt, arg);
+
+    if (mkdir(p, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", p, strerror(errno));
+        exit(1);
+    }
+
+    ca_free(p);
+}
+
+static void setup_theme(void) {
+    static const char index_theme[] =
+        "[Sound Theme]\n"
+        "Name=Bench\n"
+        "Directories=stereo\n"
+        "\n"
+        "[stereo]\n"
+        "OutputProfile=stereo\n";
+    char *p;
+
+    make_dir("share", NULL);
+    make_dir("share/sounds", NULL);
+    make_dir("share/sounds/%s", THEME_NAME);
+    make_dir("share/sounds/%s/stereo", THEME_NAME);
+    make_dir("share/sounds/%s/stereo/de", THEME_NAME);
+    make_dir("cache", NULL);
+    make_dir("config", NULL);
+
+    p = tmp_path("share/sounds/%s/index.theme", THEME_NAME);
+    write_file(p, index_theme, sizeof(index_theme) - 1);
+    ca_free(p);
+
+    p = tmp_path("share/sounds/%s/stereo/bench-hit.wav", THEME_NAME);
+    write_wav(p, 0);
+    ca_free(p);
+
+    p = tmp_path("share/sounds/%s/stereo/de/bench-localized.wav", THEME_NAME);
+    write_wav(p, 0);
+    ca_free(p);
+
+    p = tmp_path("decode.wav", NULL);
+    write_wav(p, WAV_SECONDS);
+    ca_free(p);
+
+    p = tmp_path("share", NULL);
+    setenv("XDG_DATA_DIRS", p, 1);
+    ca_free(p);
+
+    p = tmp_path("no-data-home", NULL);
+    setenv("XDG_DATA_HOME", p, 1);
+    ca_free(p);
+
+    p = tmp_path("config", NULL);
+    setenv("XDG_CONFIG_HOME", p, 1);
+    ca_free(p);
+
+    /* The theme lookups run first with no cache to go to, so that they
+     * measure the actual theme walk. See main(). */
+    unsetenv("XDG_CACHE_HOME");
+    unsetenv("HOME");
+}
+
+static void remove_tree(const char *p) {
+    char *cmd;
+
+    if ((cmd = ca_sprintf_malloc("rm -rf '%s'", p))) {
+        if (system(cmd) != 0)
+            fprintf(stderr, "Failed to remove %s\n", p);
+        ca_free(cmd);
+    }
+}
+
+/* Property lists */
+
+static void bench_proplist_sets(void *userdata) {
+    static const char * const keys[] = {
+        CA_PROP_EVENT_ID,
+        CA_PROP_EVENT_DESCRIPTION,
+        CA_PROP_MEDIA_ROLE,
+        CA_PROP_APPLICATION_NAME
+    };
+    static unsigned i = 0;
+
+    ca_proplist_sets(userdata, keys[i++ % CA_ELEMENTSOF(keys)], "bench-value");
+}
+
+struct merge_data {
+    ca_proplist *a, *b;
+};
+
+static void bench_proplist_merge(void *userdata) {
+    struct merge_data *m = userdata;
+    ca_proplist *p;
+
+    if (ca_proplist_merge(&p, m->a, m->b) == CA_SUCCESS)
+        ca_proplist_destroy(p);
+}
+
+static void from_ap(int dummy, ...) {
+    ca_proplist *p;
+    va_list ap;
+
+    va_start(ap, dummy);
+
+    if (ca_proplist_from_ap(&p, ap) == CA_SUCCESS)
+        ca_proplist_destroy(p);
+
+    va_end(ap);
+}
+
+static void bench_proplist_from_ap(void *userdata) {
+    from_ap(0,
+            CA_PROP_EVENT_ID, "message-new-instant",
+            CA_PROP_EVENT_DESCRIPTION, "New message",
+            CA_PROP_MEDIA_ROLE, "event",
+            CA_PROP_APPLICATION_NAME, "bench",
+            CA_PROP_WINDOW_X11_SCREEN, "0",
+            CA_PROP_CANBERRA_CACHE_CONTROL, "permanent",
+            NULL);
+}
+
+/* Sound lookups. The open callback only checks that the file is
+ * there, we don't want to measure the decoders here. */
+
+static int bench_sound_file = 0;
+
+static int fake_open(ca_sound_file **f, const char *fn) {
+
+    if (access(fn, R_OK) < 0)
+        return errno == ENOENT ? CA_ERROR_NOTFOUND : CA_ERROR_SYSTEM;
+
+    *f = (ca_sound_file*) &bench_sound_file;
+    return CA_SUCCESS;
+}
+
+struct lookup_data {
+    ca_proplist *cp, *sp;
+    ca_theme_data *t;
+};
+
+static void bench_theme_lookup(void *userdata) {
+    struct lookup_data *l = userdata;
+    ca_sound_file *f;
+
+    ca_lookup_sound_with_callback(&f, fake_open, NULL, &l->t, l->cp, l->sp);
+}
+
+static void run_theme_lookup(const char *name, const char *event_id, const char *language) {
+    struct lookup_data l;
+
+    memset(&l, 0, sizeof(l));
+
+    if (ca_proplist_create(&l.cp) < 0 || ca_proplist_create(&l.sp) < 0)
+        abort();
+
+    ca_proplist_sets(l.cp, CA_PROP_CANBERRA_XDG_THEME_NAME, THEME_NAME);
+    ca_proplist_sets(l.cp, CA_PROP_APPLICATION_LANGUAGE, language);
+    ca_proplist_sets(l.sp, CA_PROP_EVENT_ID, event_id);
+
+    bench_run(name, bench_theme_lookup, &l, 0);
+
+    if (l.t)
+        ca_theme_data_free(l.t);
+
+    ca_proplist_destroy(l.cp);
+    ca_proplist_destroy(l.sp);
+}
+
+#ifdef HAVE_CACHE
+
+static void bench_cache_lookup_hit(void *userdata) {
+    ca_sound_file *f;
+
+    ca_cache_lookup_sound(&f, fake_open, NULL, THEME_NAME, "bench-hit", "C", "stereo");
+}
+
+static void bench_cache_lookup_miss(void *userdata) {
+    ca_sound_file *f;
+
+    ca_cache_lookup_sound(&f, fake_open, NULL, THEME_NAME, "bench-not-in-cache", "C", "stereo");
+}
+
+#endif
+
+/* Decoding */
+
+static void bench_decode(void *userdata) {
+    ca_sound_file *f;
+    char buf[4096];
+    size_t n;
+
+    if (ca_sound_file_open(&f, userdata) < 0)
+        return;
+
+    for (;;) {
+        n = sizeof(buf);
+
+        if (ca_sound_file_read_arbitrary(f, buf, &n) < 0 || n == 0)
+            break;
+    }
+
+    ca_sound_file_close(f);
+}
+
+static void run_decode(const char *name, const char *fn) {
+    ca_sound_file *f;
+    uint64_t size;
+
+    if (ca_sound_file_open(&f, fn) < 0) {
+        bench_skip(name, "cannot open test file");
+        return;
+    }
+
+    size = (uint64_t) ca_sound_file_get_size(f);
+    ca_sound_file_close(f);
+
+    bench_run(name, bench_decode, (void*) fn, size);
+}
+
+/* There is no Vorbis encoder among our dependencies, so we need an
+ * existing file for this one */
+static const char *find_vorbis_file(void) {
+    static const char * const candidates[] = {
+        "/usr/share/sounds/freedesktop/stereo/complete.oga",
+        "/usr/share/sounds/freedesktop/stereo/bell.oga",
+        "/usr/share/sounds/freedesktop/stereo/message.oga"
+    };
+    const char *e;
+    unsigned i;
+
+    if ((e = getenv("CANBERRA_BENCH_VORBIS")) && *e)
+        return e;
+
+    for (i = 0; i < CA_ELEMENTSOF(candidates); i++)
+        if (access(candidates[i], R_OK) == 0)
+            return candidates[i];
+
+    return NULL;
+}
+
+/* Playing */
+
+struct play_data {
+    ca_context *c;
+    ca_proplist *p;
+};
+
+static void bench_play_full(void *userdata) {
+    struct play_data *d = userdata;
+
+    ca_context_play_full(d->c, 1, d->p, NULL, NULL);
+}
+
+static void run_play_full(const char *name) {
+    struct play_data d;
+
+    if (ca_context_create(&d.c) < 0)
+        abort();
+
+    if (ca_context_set_driver(d.c, "null") < 0 || ca_context_open(d.c) < 0) {
+        bench_skip(name, "null driver not available");
+        ca_context_destroy(d.c);
+        return;
+    }
+
+    if (ca_proplist_create(&d.p) < 0)
+        abort();
+
+    ca_proplist_sets(d.p, CA_PROP_EVENT_ID, "bench-hit");
+    ca_proplist_sets(d.p, CA_PROP_CANBERRA_XDG_THEME_NAME, THEME_NAME);
+
+    bench_run(name, bench_play_full, &d, 0);
+
+    ca_proplist_destroy(d.p);
+    ca_context_destroy(d.c);
+}
+
+/* Lookup scaling. Each dimension of the theme shape is swept on its
+ * own with all the others at their baseline, so that the results can
+ * be plotted as one curve per dimension. "theme_scaling_lookup" keeps
+ * the parsed theme data around like a context does, while
+ * "theme_scaling_load" also parses all index.theme files again each
+ * time. See bench-theme.h for what the dimensions mean. */
+
+static const ca_bench_theme_shape scaling_baseline = {
+    .depth = 0,
+    .data_dirs = 1,
+    .locales = 1,
+    .sounds = 100,
+    .profiles = 1,
+    .components = 1
+};
+
+static const unsigned depth_values[] = { 0, 1, 2, 4, 7, 10 };
+static const unsigned data_dirs_values[] = { 1, 2, 5, 10, 20 };
+static const unsigned locales_values[] = { 0, 1, 5, 10, 20 };
+static const unsigned sounds_values[] = { 1, 100, 1000, 5000 };
+static const unsigned profiles_values[] = { 1, 2, 5, 10 };
+static const unsigned components_values[] = { 1, 2, 4, 8 };
+
+static const struct {
+    const char *dimension;
+    size_t offset;
+    const unsigned *values;
+    unsigned n_values;
+} sweeps[] = {
+    { "depth", offsetof(ca_bench_theme_shape, depth), depth_values, CA_ELEMENTSOF(depth_values) },
+    { "data_dirs", offsetof(ca_bench_theme_shape, data_dirs), data_dirs_values, CA_ELEMENTSOF(data_dirs_values) },
+    { "locales", offsetof(ca_bench_theme_shape, locales), locales_values, CA_ELEMENTSOF(locales_values) },
+    { "sounds", offsetof(ca_bench_theme_shape, sounds), sounds_values, CA_ELEMENTSOF(sounds_values) },
+    { "profiles", offsetof(ca_bench_theme_shape, profiles), profiles_values, CA_ELEMENTSOF(profiles_values) },
+    { "components", offsetof(ca_bench_theme_shape, components), components_values, CA_ELEMENTSOF(components_values) }
+};
+
+static unsigned *shape_field(ca_bench_theme_shape *s, size_t offset) {
+    return (unsigned*) ((uint8_t*) s + offset);
+}
+
+static void bench_theme_load(void *userdata) {
+    struct lookup_data *l = userdata;
+    ca_sound_file *f;
+
+    if (l->t) {
+        ca_theme_data_free(l->t);
+        l->t = NULL;
+    }
+
+    ca_lookup_sound_with_callback(&f, fake_open, NULL, &l->t, l->cp, l->sp);
+}
+
+static void skip_scaling_point(const char *params, const char *reason) {
+    bench_skip_params("theme_scaling_lookup", params, reason);
+    bench_skip_params("theme_scaling_load", params, reason);
+}
+
+static void run_scaling_point(const char *dimension, unsigned value, const ca_bench_theme_shape *s, unsigned n) {
+    struct lookup_data l;
+    ca_bench_theme *bt;
+    ca_sound_file *f;
+    char *root, *params, *path = NULL, *reason;
+    int ret;
+
+    if (!(root = ca_sprintf_malloc("%s/scaling-%u", tmpdir, n)) ||
+        !(params = ca_sprintf_malloc("\"dimension\": \"%s\", \"value\": %u", dimension, value)))
+        abort();
+
+    if ((ret = ca_bench_theme_generate(&bt, root, s)) < 0) {
+        if (!(reason = ca_sprintf_malloc("failed to generate theme: %s", ca_strerror(ret))))
+            abort();
+
+        skip_scaling_point(params, reason);
+        ca_free(reason);
+        goto finish;
+    }
+
+    setenv("XDG_DATA_DIRS", bt->data_dirs, 1);
+
+    memset(&l, 0, sizeof(l));
+
+    if (ca_proplist_create(&l.cp) < 0 || ca_proplist_create(&l.sp) < 0)
+        abort();
+
+    ca_proplist_sets(l.cp, CA_PROP_CANBERRA_XDG_THEME_NAME, bt->theme_name);
+    ca_proplist_sets(l.cp, CA_PROP_APPLICATION_LANGUAGE, bt->locale);
+    ca_proplist_sets(l.cp, CA_PROP_CANBERRA_XDG_THEME_OUTPUT_PROFILE, bt->profile);
+    ca_proplist_sets(l.sp, CA_PROP_EVENT_ID, bt->event_id);
+
+    /* Make sure the walk ends where the generator says it does,
+     * otherwise we would be timing something else. Theme stacks
+     * deeper than the lookup code supports fail here. */
+    if ((ret = ca_lookup_sound_with_callback(&f, fake_open, &path, &l.t, l.cp, l.sp)) < 0) {
+        if (!(reason = ca_sprintf_malloc("lookup failed: %s", ca_strerror(ret))))
+            abort();
+
+        skip_scaling_point(params, reason);
+        ca_free(reason);
+
+    } else if (!path || !ca_streq(path, bt->sound_path))
+        skip_scaling_point(params, "lookup resolved to an unexpected file");
+    else {
+        bench_run_params("theme_scaling_lookup", params, bench_theme_lookup, &l, 0);
+        bench_run_params("theme_scaling_load", params, bench_theme_load, &l, 0);
+    }
+
+    ca_free(path);
+
+    if (l.t)
+        ca_theme_data_free(l.t);
+
+    ca_proplist_destroy(l.cp);
+    ca_proplist_destroy(l.sp);
+    ca_bench_theme_free(bt);
+
+finish:
+
+    remove_tree(root);
+    ca_free(root);
+    ca_free(params);
+}
+
+static void run_scaling(void) {
+    unsigned i, j, n = 0;
+
+    for (i = 0; i < CA_ELEMENTSOF(sweeps); i++)
+        for (j = 0; j < sweeps[i].n_values; j++) {
+            ca_bench_theme_shape s = scaling_baseline;
+
+            *shape_field(&s, sweeps[i].offset) = sweeps[i].values[j];
+            run_scaling_point(sweeps[i].dimension, sweeps[i].values[j], &s, n++);
+        }
+}
+
+/* "--generate-theme DIR [dimension=N ...]" leaves a theme behind for
+ * poking at by hand, and prints how to look up its sound */
+static int generate_theme(const char *root, int n, char *args[]) {
+    ca_bench_theme_shape s = scaling_baseline;
+    ca_bench_theme *bt;
+    int i, ret;
+
+    for (i = 0; i < n; i++) {
+        const char *e;
+        char *end = NULL;
+        unsigned long v;
+        unsigned j;
+
+        if (!(e = strchr(args[i], '=')))
+            goto invalid;
+
+        for (j = 0; j < CA_ELEMENTSOF(sweeps); j++)
+            if (strlen(sweeps[j].dimension) == (size_t) (e - args[i]) &&
+                !strncmp(sweeps[j].dimension, args[i], (size_t) (e - args[i])))
+                break;
+
+        errno = 0;
+        v = strtoul(e + 1, &end, 10);
+
+        if (j >= CA_ELEMENTSOF(sweeps) || errno != 0 || !end || *end || end == e + 1 || v > 1000000)
+            goto invalid;
+
+        *shape_field(&s, sweeps[j].offset) = (unsigned) v;
+    }
+
+    if ((ret = ca_bench_theme_generate(&bt, root, &s)) < 0) {
+        fprintf(stderr, "Failed to generate theme in %s: %s\n", root, ca_strerror(ret));
+        return ret;
+    }
+
+    printf("XDG_DATA_DIRS=%s\n"
+           CA_PROP_CANBERRA_XDG_THEME_NAME "=%s\n"
+           CA_PROP_EVENT_ID "=%s\n"
+           CA_PROP_APPLICATION_LANGUAGE "=%s\n"
+           CA_PROP_CANBERRA_XDG_THEME_OUTPUT_PROFILE "=%s\n"
+           "# resolves to %s\n",
+           bt->data_dirs, bt->theme_name, bt->event_id, bt->locale, bt->profile, bt->sound_path);
+
+    ca_bench_theme_free(bt);
+    return CA_SUCCESS;
+
+invalid:
+    fprintf(stderr, "Invalid shape parameter: %s\n", args[i]);
+    return CA_ERROR_INVALID;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--scaling]\n"
+            "       %s --generate-theme DIR [depth=N] [data_dirs=N] [locales=N]\n"
+            "                [sounds=N] [profiles=N] [components=N]\n",
+            argv0, argv0);
+}
+
+static void run_microbenchmarks(void) {
+    ca_proplist *p;
+    struct merge_data m;
+    const char *vorbis;
+    char *fn;
+
+    /* Property lists */
+    if (ca_proplist_create(&p) < 0)
+        abort();
+
+    bench_run("proplist_sets", bench_proplist_sets, p, 0);
+    ca_proplist_destroy(p);
+
+    if (ca_proplist_create(&m.a) < 0 || ca_proplist_create(&m.b) < 0)
+        abort();
+
+    ca_proplist_sets(m.a, CA_PROP_APPLICATION_NAME, "bench");
+    ca_proplist_sets(m.a, CA_PROP_APPLICATION_ID, "org.freedesktop.libcanberra.Bench");
+    ca_proplist_sets(m.a, CA_PROP_WINDOW_X11_SCREEN, "0");
+    ca_proplist_sets(m.a, CA_PROP_CANBERRA_XDG_THEME_NAME, THEME_NAME);
+    ca_proplist_sets(m.b, CA_PROP_EVENT_ID, "message-new-instant");
+    ca_proplist_sets(m.b, CA_PROP_EVENT_DESCRIPTION, "New message");
+    ca_proplist_sets(m.b, CA_PROP_APPLICATION_NAME, "override");
+
+    bench_run("proplist_merge", bench_proplist_merge, &m, 0);
+    bench_run("proplist_from_ap", bench_proplist_from_ap, NULL, 0);
+
+    /* The full sound theme walk. There's no cache directory yet, so
+     * even with the lookup cache built in this walks the theme every
+     * time. */
+    run_theme_lookup("theme_lookup_hit", "bench-hit", "C");
+    run_theme_lookup("theme_lookup_miss", "bench-no-such-sound", "C");
+    run_theme_lookup("theme_lookup_locale_fallback", "bench-localized", "de_DE");
+
+    /* From now on there is a cache */
+    fn = tmp_path("cache", NULL);
+    setenv("XDG_CACHE_HOME", fn, 1);
+    ca_free(fn);
+
+#ifdef HAVE_CACHE
+    fn = tmp_path("share/sounds/%s/stereo/bench-hit.wav", THEME_NAME);
+    ca_cache_store_sound(THEME_NAME, "bench-hit", "C", "stereo", fn);
+    ca_free(fn);
+
+    bench_run("cache_lookup_hit", bench_cache_lookup_hit, NULL, 0);
+    bench_run("cache_lookup_miss", bench_cache_lookup_miss, NULL, 0);
+#else
+    bench_skip("cache_lookup_hit", "built without the lookup cache");
+    bench_skip("cache_lookup_miss", "built without the lookup cache");
+#endif
+
+    /* Decoders */
+    fn = tmp_path("decode.wav", NULL);
+    run_decode("decode_wav", fn);
+    ca_free(fn);
+
+    if ((vorbis = find_vorbis_file()))
+        run_decode("decode_vorbis", vorbis);
+    else
+        bench_skip("decode_vorbis", "no Vorbis file found, set $CANBERRA_BENCH_VORBIS");
+
+    run_play_full("context_play_full_null");
+
+    ca_proplist_destroy(m.a);
+    ca_proplist_destroy(m.b);
+}
+
+int main(int argc, char *argv[]) {
+    char template[] = "/tmp/canberra-bench-XXXXXX";
+    ca_bool_t scaling = FALSE;
+
+    if (argc >= 3 && ca_streq(argv[1], "--generate-theme"))
+        return generate_theme(argv[2], argc - 3, argv + 3) < 0 ? 1 : 0;
+
+    if (argc == 2 && ca_streq(argv[1], "--scaling"))
+        scaling = TRUE;
+    else if (argc != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!(tmpdir = mkdtemp(template))) {
+        fprintf(stderr, "Failed to create temporary directory: %s\n", strerror(errno));
+        return 1;
+    }
+
+    setup_theme();
+    syscall_counter_init();
+
+    printf("{\n  \"syscall_counter\": \"%s\",\n  \"results\": [", syscall_counter);
+
+    if (scaling)
+        run_scaling();
+    else
+        run_microbenchmarks();
+
+    printf("\n  ]\n}\n");
+
+    remove_tree(tmpdir);
+
+    return 0;
+}
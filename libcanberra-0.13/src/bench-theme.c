@@ -0,0 +1,305 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bench-theme.h"
+#include "malloc.h"
+#include "macro.h"
+
+/* index.theme lines are read into a 1K buffer, keep the Directories=
+ * line well below that */
+#define PROFILES_MAX 64U
+
+static int make_dir(const char *p) {
+
+    if (mkdir(p, 0755) < 0 && errno != EEXIST)
+        return CA_ERROR_SYSTEM;
+
+    return CA_SUCCESS;
+}
+
+static int touch(const char *p) {
+    int fd;
+
+    if ((fd = open(p, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0)
+        return CA_ERROR_SYSTEM;
+
+    close(fd);
+    return CA_SUCCESS;
+}
+
+static int write_index(const char *fn, const ca_bench_theme_shape *s, unsigned level) {
+    FILE *f;
+    unsigned j;
+
+    if (!(f = fopen(fn, "w")))
+        return CA_ERROR_SYSTEM;
+
+    fprintf(f, "[Sound Theme]\nName=Scale %u\n", level);
+
+    if (level < s->depth)
+        fprintf(f, "Inherits=scale-%u\n", level + 1);
+
+    fprintf(f, "Directories=stereo");
+    for (j = 1; j < s->profiles; j++)
+        fprintf(f, ",profile-%u", j);
+
+    fprintf(f, "\n\n[stereo]\nOutputProfile=stereo\n");
+    for (j = 1; j < s->profiles; j++)
+        fprintf(f, "\n[profile-%u]\nOutputProfile=profile-%u\n", j, j);
+
+    if (fclose(f) != 0)
+        return CA_ERROR_SYSTEM;
+
+    return CA_SUCCESS;
+}
+
+/* Only the most deeply inherited theme actually has sounds, in its
+ * stereo directory and in each of its locale subdirectories */
+static int fill_sounds(const char *dir, const ca_bench_theme_shape *s) {
+    unsigned j, i;
+    int ret = CA_SUCCESS;
+
+    for (j = 0; j <= s->locales && ret == CA_SUCCESS; j++) {
+        char *d;
+
+        if (j == 0)
+            d = ca_strdup(dir);
+        else
+            d = ca_sprintf_malloc("%s/l%u", dir, j - 1);
+
+        if (!d)
+            return CA_ERROR_OOM;
+
+        if (j > 0)
+            ret = make_dir(d);
+
+        for (i = 0; i < s->sounds && ret == CA_SUCCESS; i++) {
+            char *fn;
+
+            if (!(fn = ca_sprintf_malloc("%s/snd%u.wav", d, i))) {
+                ret = CA_ERROR_OOM;
+                break;
+            }
+
+            ret = touch(fn);
+            ca_free(fn);
+        }
+
+        ca_free(d);
+    }
+
+    return ret;
+}
+
+static int make_theme(const char *sounds, const ca_bench_theme_shape *s, unsigned level) {
+    char *p;
+    unsigned j;
+    int ret;
+
+    if (!(p = ca_sprintf_malloc("%s/scale-%u", sounds, level)))
+        return CA_ERROR_OOM;
+
+    ret = make_dir(p);
+    ca_free(p);
+
+    if (ret < 0)
+        return ret;
+
+    if (!(p = ca_sprintf_malloc("%s/scale-%u/index.theme", sounds, level)))
+        return CA_ERROR_OOM;
+
+    ret = write_index(p, s, level);
+    ca_free(p);
+
+    if (ret < 0)
+        return ret;
+
+    for (j = 0; j < s->profiles; j++) {
+
+        if (j == 0)
+            p = ca_sprintf_malloc("%s/scale-%u/stereo", sounds, level);
+        else
+            p = ca_sprintf_malloc("%s/scale-%u/profile-%u", sounds, level, j);
+
+        if (!p)
+            return CA_ERROR_OOM;
+
+        if ((ret = make_dir(p)) == CA_SUCCESS && j == 0 && level == s->depth)
+            ret = fill_sounds(p, s);
+
+        ca_free(p);
+
+        if (ret < 0)
+            return ret;
+    }
+
+    return CA_SUCCESS;
+}
+
+static char *make_event_id(const ca_bench_theme_shape *s) {
+    char *e, *n;
+    unsigned i;
+
+    if (!(e = ca_sprintf_malloc("snd%u", s->sounds - 1)))
+        return NULL;
+
+    for (i = 1; i < s->components; i++) {
+        n = ca_sprintf_malloc("%s-c%u", e, i);
+        ca_free(e);
+
+        if (!(e = n))
+            return NULL;
+    }
+
+    return e;
+}
+
+static char *make_data_dirs(const char *root, const ca_bench_theme_shape *s) {
+    char *d, *n;
+    unsigned i;
+
+    if (!(d = ca_sprintf_malloc("%s/data-0", root)))
+        return NULL;
+
+    for (i = 1; i < s->data_dirs; i++) {
+        n = ca_sprintf_malloc("%s:%s/data-%u", d, root, i);
+        ca_free(d);
+
+        if (!(d = n))
+            return NULL;
+    }
+
+    return d;
+}
+
+int ca_bench_theme_generate(ca_bench_theme **_t, const char *root, const ca_bench_theme_shape *s) {
+    ca_bench_theme *t;
+    char *sounds = NULL, *p;
+    unsigned i;
+    int ret;
+
+    ca_return_val_if_fail(_t, CA_ERROR_INVALID);
+    ca_return_val_if_fail(root && *root == '/', CA_ERROR_INVALID);
+    ca_return_val_if_fail(s, CA_ERROR_INVALID);
+    ca_return_val_if_fail(s->data_dirs > 0, CA_ERROR_INVALID);
+    ca_return_val_if_fail(s->sounds > 0, CA_ERROR_INVALID);
+    ca_return_val_if_fail(s->profiles > 0 && s->profiles <= PROFILES_MAX, CA_ERROR_INVALID);
+    ca_return_val_if_fail(s->components > 0, CA_ERROR_INVALID);
+
+    if (!(t = ca_new0(ca_bench_theme, 1)))
+        return CA_ERROR_OOM;
+
+    if ((ret = make_dir(root)) < 0)
+        goto fail;
+
+    for (i = 0; i < s->data_dirs; i++) {
+
+        if (!(p = ca_sprintf_malloc("%s/data-%u", root, i))) {
+            ret = CA_ERROR_OOM;
+            goto fail;
+        }
+
+        ret = make_dir(p);
+        ca_free(p);
+
+        if (ret < 0)
+            goto fail;
+
+        ca_free(sounds);
+
+        if (!(sounds = ca_sprintf_malloc("%s/data-%u/sounds", root, i))) {
+            ret = CA_ERROR_OOM;
+            goto fail;
+        }
+
+        if ((ret = make_dir(sounds)) < 0)
+            goto fail;
+    }
+
+    /* All themes go into the last data dir, so that every one of them
+     * is only found after all the others have been tried */
+    for (i = 0; i <= s->depth; i++)
+        if ((ret = make_theme(sounds, s, i)) < 0)
+            goto fail;
+
+    if (!(t->data_dirs = make_data_dirs(root, s)) ||
+        !(t->theme_name = ca_strdup("scale-0")) ||
+        !(t->event_id = make_event_id(s))) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    /* Make the locale match only after stripping both the modifier and
+     * the territory, or not at all */
+    if (s->locales > 0)
+        t->locale = ca_sprintf_malloc("l%u_XX@bench", s->locales - 1);
+    else
+        t->locale = ca_strdup("xx_XX@bench");
+
+    if (s->profiles > 1)
+        t->profile = ca_sprintf_malloc("profile-%u", s->profiles - 1);
+    else
+        t->profile = ca_strdup("stereo");
+
+    if (s->locales > 0)
+        t->sound_path = ca_sprintf_malloc("%s/scale-%u/stereo/l%u/snd%u.wav", sounds, s->depth, s->locales - 1, s->sounds - 1);
+    else
+        t->sound_path = ca_sprintf_malloc("%s/scale-%u/stereo/snd%u.wav", sounds, s->depth, s->sounds - 1);
+
+    if (!t->locale || !t->profile || !t->sound_path) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    ca_free(sounds);
+    *_t = t;
+
+    return CA_SUCCESS;
+
+fail:
+
+    ca_free(sounds);
+    ca_bench_theme_free(t);
+
+    return ret;
+}
+
+void ca_bench_theme_free(ca_bench_theme *t) {
+    ca_return_if_fail(t);
+
+    ca_free(t->data_dirs);
+    ca_free(t->theme_name);
+    ca_free(t->event_id);
+    ca_free(t->locale);
+    ca_free(t->profile);
+    ca_free(t->sound_path);
+    ca_free(t);
+}
@@ -0,0 +1,69 @@
+#ifndef foocanberrabenchthemehfoo
+#define foocanberrabenchthemehfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include "canberra.h"
+
+/* Generates synthetic sound themes for the lookup scaling benchmarks
+ * in bench-canberra. Every dimension that the sound theme spec walk
+ * depends on can be set independently:
+ *
+ *   depth       inherited themes below the requested one
+ *   data_dirs   entries in $XDG_DATA_DIRS, the themes live in the last
+ *   locales     locale subdirectories per theme directory
+ *   sounds      sound files per theme directory
+ *   profiles    output profile directories per theme
+ *   components  dash separated components of the event id
+ *
+ * The shape also determines the lookup that is run against it, which
+ * is always one that succeeds only after the longest walk: the sound
+ * sits in the stereo directory of the most deeply inherited theme, the
+ * requested output profile and locale only match after falling back,
+ * and the event id only matches once all extra components have been
+ * stripped. The sound files are empty, only their presence matters to
+ * the lookups. */
+
+typedef struct ca_bench_theme_shape {
+    unsigned depth;
+    unsigned data_dirs;
+    unsigned locales;
+    unsigned sounds;
+    unsigned profiles;
+    unsigned components;
+} ca_bench_theme_shape;
+
+typedef struct ca_bench_theme {
+    /* Use these for $XDG_DATA_DIRS and the lookup properties */
+    char *data_dirs;
+    char *theme_name;
+    char *event_id;
+    char *locale;
+    char *profile;
+
+    /* The file the lookup is expected to resolve to */
+    char *sound_path;
+} ca_bench_theme;
+
+int ca_bench_theme_generate(ca_bench_theme **t, const char *root, const ca_bench_theme_shape *s);
+void ca_bench_theme_free(ca_bench_theme *t);
+
+#endif
@@ -38,16 +38,62 @@
 #include "canberra.h"
 #include "sound-theme-spec.h"
 #include "cache.h"
+#include "probes.h"
 
-#define FILENAME "event-sound-cache.tdb"
+#define FILENAME "event-sound-cache-2.tdb"
 #define UPDATE_INTERVAL 10
 
+/* Files written by earlier versions, which lack the access stamps */
+#define OLD_FILENAME "event-sound-cache.tdb"
+
+/* Each record is [timestamp][atime][path], with a negative cache
+ * entry lacking the path */
+#define HEADER_SIZE (2*sizeof(uint32_t))
+
+/* The access stamp is only updated if it is older than this, so that
+ * cache hits don't turn into writes */
+#define ATIME_INTERVAL (60*60)
+
+/* Entries not accessed for this long are dropped */
+#define MAX_AGE (60*60*24*30)
+
+/* If the live data grows beyond this we evict the least recently
+ * used entries until we are back at CACHE_SIZE_LOW */
+#define CACHE_SIZE_MAX (256*1024)
+#define CACHE_SIZE_LOW (CACHE_SIZE_MAX/4*3)
+
+/* The database file is rewritten when it is this much larger than
+ * twice the data that is still in it */
+#define COMPACT_SLACK (64*1024)
+
+/* How often a process checks whether a collection is due, and how
+ * often one is actually done unless the database is too large */
+#define GC_CHECK_INTERVAL (10*60)
+#define GC_INTERVAL (60*60*24)
+
+/* Stores the time of the last collection. All real keys end in a
+ * NUL byte, so this one can't clash */
+#define GC_KEY "gc"
+
+/* The collector drops the mutex after this many records, so that
+ * lookups don't have to wait for a whole pass over the database */
+#define GC_CHUNK 64
+
 /* This part is not portable due to pthread_once usage, should be abstracted
  * when we port this to platforms that do not have POSIX threading */
 
 static ca_mutex *mutex = NULL;
 static struct tdb_context *database = NULL;
 
+/* All protected by mutex */
+static char *database_path = NULL;
+static dev_t database_dev = 0;
+static ino_t database_ino = 0;
+static unsigned database_generation = 0;
+static time_t database_checked = 0;
+static ca_bool_t gc_running = FALSE;
+static time_t gc_checked = 0;
+
 static void allocate_mutex_once(void) {
     mutex = ca_mutex_new();
 }
@@ -64,30 +110,6 @@ static int allocate_mutex(void) {
     return 0;
 }
 
-static int get_cache_home(char **e) {
-    const char *env, *subdir;
-    char *r;
-
-    ca_return_val_if_fail(e, CA_ERROR_INVALID);
-
-    if ((env = getenv("XDG_CACHE_HOME")) && *env == '/')
-        subdir = "";
-    else if ((env = getenv("HOME")) && *env == '/')
-        subdir = "/.cache";
-    else {
-        *e = NULL;
-        return CA_SUCCESS;
-    }
-
-    if (!(r = ca_new(char, strlen(env) + strlen(subdir) + 1)))
-        return CA_ERROR_OOM;
-
-    sprintf(r, "%s%s", env, subdir);
-    *e = r;
-
-    return CA_SUCCESS;
-}
-
 static int sensible_gethostbyname(char *n, size_t l) {
 
     if (gethostname(n, l) < 0)
@@ -157,22 +179,38 @@ static int get_machine_id(char **id) {
     return CA_SUCCESS;
 }
 
-static int db_open(void) {
-    int ret;
-    char *c, *id, *pn;
+static struct tdb_context *db_open_file(const char *fn, int flags) {
 
-    if ((ret = allocate_mutex()) < 0)
-        return ret;
+    /* We pass TDB_NOMMAP here as long as rhbz 460851 is not fixed in
+     * tdb. */
+    return tdb_open(fn, 0, TDB_NOMMAP, O_RDWR|O_NOCTTY|flags
+#ifdef O_CLOEXEC
+                    | O_CLOEXEC
+#endif
+                    , 0644);
+}
 
-    ca_mutex_lock(mutex);
+static void db_remember_inode(void) {
+    struct stat st;
 
-    if (database) {
-        ret = CA_SUCCESS;
-        goto finish;
+    if (fstat(tdb_fd(database), &st) >= 0) {
+        database_dev = st.st_dev;
+        database_ino = st.st_ino;
     }
+}
 
-    if ((ret = get_cache_home(&c)) < 0)
-        goto finish;
+static int get_database_path(void) {
+    int ret;
+    char *c, *id, *old;
+
+    if (database_path)
+        return CA_SUCCESS;
+
+    if ((ret = ca_get_cache_home(&c)) < 0)
+        return ret;
+
+    if (!c)
+        return CA_ERROR_NOTFOUND;
 
     /* Try to create, just in case it doesn't exist yet. We don't do
      * this recursively however. */
@@ -180,7 +218,7 @@ static int db_open(void) {
 
     if ((ret = get_machine_id(&id)) < 0) {
         ca_free(c);
-        goto finish;
+        return ret;
     }
 
     /* This data is machine specific, hence we include some kind of
@@ -188,32 +226,81 @@ static int db_open(void) {
      * abouth endianess/packing issues, hence we include the compiler
      * target in the name, too. */
 
-    pn = ca_sprintf_malloc("%s/" FILENAME ".%s." CANONICAL_HOST, c, id);
+    database_path = ca_sprintf_malloc("%s/" FILENAME ".%s." CANONICAL_HOST, c, id);
+
+    /* The old format would only be misread, and nobody else is going
+     * to clean it up */
+    if ((old = ca_sprintf_malloc("%s/" OLD_FILENAME ".%s." CANONICAL_HOST, c, id))) {
+        unlink(old);
+        ca_free(old);
+    }
+
     ca_free(c);
     ca_free(id);
 
-    if (!pn) {
-        ret = CA_ERROR_OOM;
-        goto finish;
-    }
+    if (!database_path)
+        return CA_ERROR_OOM;
 
-    /* We pass TDB_NOMMAP here as long as rhbz 460851 is not fixed in
-     * tdb. */
-    database = tdb_open(pn, 0, TDB_NOMMAP, O_RDWR|O_CREAT|O_NOCTTY
-#ifdef O_CLOEXEC
-                        | O_CLOEXEC
-#endif
-                        , 0644);
-    ca_free(pn);
+    return CA_SUCCESS;
+}
 
-    if (!database) {
-        ret = CA_ERROR_CORRUPT;
-        goto finish;
+static void gc_start_unlocked(time_t now);
+
+static int db_open_unlocked(void) {
+    int ret;
+    time_t now;
+    struct stat st;
+    struct tdb_context *n;
+
+    ca_assert_se(time(&now) != (time_t) -1);
+
+    if (database) {
+
+        if (now >= database_checked && now < database_checked + UPDATE_INTERVAL)
+            return CA_SUCCESS;
+
+        database_checked = now;
+
+        /* Another process might have compacted the database into a
+         * new file in the meantime. If so, follow it. If we cannot
+         * we continue to use the old one, which is still valid. */
+        if ((stat(database_path, &st) < 0 ||
+             st.st_dev != database_dev ||
+             st.st_ino != database_ino) &&
+            (n = db_open_file(database_path, O_CREAT))) {
+
+            tdb_close(database);
+            database = n;
+            database_generation++;
+            db_remember_inode();
+        }
+
+        gc_start_unlocked(now);
+        return CA_SUCCESS;
     }
 
-    ret = CA_SUCCESS;
+    if ((ret = get_database_path()) < 0)
+        return ret;
 
-finish:
+    if (!(database = db_open_file(database_path, O_CREAT)))
+        return CA_ERROR_CORRUPT;
+
+    db_remember_inode();
+    database_checked = now;
+
+    gc_start_unlocked(now);
+
+    return CA_SUCCESS;
+}
+
+static int db_open(void) {
+    int ret;
+
+    if ((ret = allocate_mutex()) < 0)
+        return ret;
+
+    ca_mutex_lock(mutex);
+    ret = db_open_unlocked();
     ca_mutex_unlock(mutex);
 
     return ret;
@@ -225,6 +312,12 @@ static void db_close(void) CA_GCC_DESTRUCTOR;
 
 static void db_close(void) {
     /* Only here to make this valgrind clean */
+
+    /* A collection still running in the background might need
+     * everything, so let's just leak in that case */
+    if (gc_running)
+        return;
+
     if (mutex) {
         ca_mutex_free(mutex);
         mutex = NULL;
@@ -234,6 +327,9 @@ static void db_close(void) {
         tdb_close(database);
         database = NULL;
     }
+
+    ca_free(database_path);
+    database_path = NULL;
 }
 
 #endif
@@ -446,6 +542,356 @@ finish:
     return ret;
 }
 
+static ca_bool_t parse_entry(const void *data, size_t dlen, uint32_t *timestamp, uint32_t *atime) {
+
+    if (dlen < HEADER_SIZE ||
+        (dlen > HEADER_SIZE && ((const char*) data)[dlen-1] != 0))
+        return FALSE;
+
+    memcpy(timestamp, data, sizeof(uint32_t));
+    memcpy(atime, (const char*) data + sizeof(uint32_t), sizeof(uint32_t));
+
+    return TRUE;
+}
+
+static ca_bool_t is_gc_key(TDB_DATA k) {
+    return k.dsize == sizeof(GC_KEY)-1 && memcmp(k.dptr, GC_KEY, sizeof(GC_KEY)-1) == 0;
+}
+
+struct gc_entry {
+    void *key;
+    size_t klen;
+    size_t size;
+    uint32_t atime;
+};
+
+struct gc_state {
+    time_t now;
+    time_t last_change;
+
+    struct gc_entry *entries;
+    unsigned n_entries, n_allocated;
+    size_t total;
+
+    ca_bool_t oom;
+};
+
+/* Returns TRUE if the record should be dropped, records it for LRU
+ * eviction otherwise */
+static ca_bool_t gc_collect(struct gc_state *s, TDB_DATA k, TDB_DATA d) {
+    uint32_t timestamp, atime;
+    struct gc_entry *e;
+
+    if (is_gc_key(k))
+        return FALSE;
+
+    /* Drop what is corrupt, what a lookup would consider outdated
+     * anyway and what hasn't been used for a long time. */
+    if (!parse_entry(d.dptr, d.dsize, &timestamp, &atime) ||
+        (time_t) timestamp < s->last_change ||
+        (time_t) timestamp > s->now ||
+        (time_t) atime + MAX_AGE < s->now)
+        return TRUE;
+
+    if (s->n_entries >= s->n_allocated) {
+        unsigned n;
+
+        n = s->n_allocated > 0 ? s->n_allocated * 2 : 64;
+
+        if (!(e = ca_new(struct gc_entry, n))) {
+            s->oom = TRUE;
+            return FALSE;
+        }
+
+        if (s->entries)
+            memcpy(e, s->entries, sizeof(struct gc_entry) * s->n_entries);
+
+        ca_free(s->entries);
+        s->entries = e;
+        s->n_allocated = n;
+    }
+
+    e = &s->entries[s->n_entries];
+
+    if (!(e->key = ca_memdup(k.dptr, k.dsize))) {
+        s->oom = TRUE;
+        return FALSE;
+    }
+
+    e->klen = k.dsize;
+    e->size = k.dsize + d.dsize;
+    e->atime = atime;
+
+    s->n_entries++;
+    s->total += e->size;
+
+    return FALSE;
+}
+
+static int gc_entry_compare(const void *a, const void *b) {
+    const struct gc_entry *x = a, *y = b;
+
+    if (x->atime != y->atime)
+        return x->atime < y->atime ? -1 : 1;
+
+    return 0;
+}
+
+/* Takes the mutex, unless the database has been reopened since the
+ * collection started, in which case we give up */
+static ca_bool_t gc_lock(unsigned generation) {
+
+    ca_mutex_lock(mutex);
+
+    if (database && generation == database_generation)
+        return TRUE;
+
+    ca_mutex_unlock(mutex);
+    return FALSE;
+}
+
+static void db_compact(unsigned generation) {
+    char *tmp;
+    struct tdb_context *n;
+    TDB_DATA k, d, next;
+    unsigned j;
+
+    /* database_path never changes once the database is open */
+    if (!(tmp = ca_sprintf_malloc("%s.tmp.%lu", database_path, (unsigned long) getpid())))
+        return;
+
+    unlink(tmp);
+
+    if (!(n = db_open_file(tmp, O_CREAT|O_EXCL)))
+        goto finish;
+
+    /* tdb never shrinks its file, hence we copy what is left into a
+     * fresh one and atomically replace the old file with it. Other
+     * processes will notice the new inode and reopen. The copy is
+     * done GC_CHUNK records at a time, so whatever is stored
+     * meanwhile behind the copy position is lost, which for a cache
+     * just means another lookup. */
+    if (!gc_lock(generation))
+        goto fail;
+
+    k = tdb_firstkey(database);
+
+    for (;;) {
+
+        for (j = 0; j < GC_CHUNK && k.dptr; j++) {
+            next = tdb_nextkey(database, k);
+
+            if ((d = tdb_fetch(database, k)).dptr) {
+                int r;
+
+                r = tdb_store(n, k, d, TDB_REPLACE);
+                ca_free(d.dptr);
+
+                if (r < 0) {
+                    ca_mutex_unlock(mutex);
+                    ca_free(k.dptr);
+                    ca_free(next.dptr);
+                    goto fail;
+                }
+            }
+
+            ca_free(k.dptr);
+            k = next;
+        }
+
+        if (!k.dptr)
+            break;
+
+        ca_mutex_unlock(mutex);
+
+        if (!gc_lock(generation)) {
+            ca_free(k.dptr);
+            goto fail;
+        }
+    }
+
+    /* We still hold the mutex from the last chunk here */
+    if (rename(tmp, database_path) < 0) {
+        ca_mutex_unlock(mutex);
+        goto fail;
+    }
+
+    tdb_close(database);
+    database = n;
+    database_generation++;
+    db_remember_inode();
+
+    ca_mutex_unlock(mutex);
+    goto finish;
+
+fail:
+    tdb_close(n);
+    unlink(tmp);
+
+finish:
+    ca_free(tmp);
+}
+
+static void db_gc(time_t last_change) {
+    struct gc_state s;
+    struct stat st;
+    TDB_DATA k, d, next;
+    uint32_t stamp = 0;
+    unsigned i, j, generation;
+    ca_bool_t compact;
+
+    memset(&s, 0, sizeof(s));
+    ca_assert_se(time(&s.now) != (time_t) -1);
+    s.last_change = last_change;
+
+    ca_mutex_lock(mutex);
+
+    ca_assert(database);
+    generation = database_generation;
+
+    k.dptr = (void*) GC_KEY;
+    k.dsize = sizeof(GC_KEY)-1;
+
+    d = tdb_fetch(database, k);
+    if (d.dptr && d.dsize == sizeof(uint32_t))
+        memcpy(&stamp, d.dptr, sizeof(uint32_t));
+    ca_free(d.dptr);
+
+    /* Some other process (or we ourselves) did this recently enough,
+     * unless the file grew too large since */
+    if (fstat(tdb_fd(database), &st) < 0 ||
+        ((time_t) stamp <= s.now &&
+         s.now < (time_t) stamp + GC_INTERVAL &&
+         st.st_size <= CACHE_SIZE_MAX)) {
+
+        ca_mutex_unlock(mutex);
+        return;
+    }
+
+    /* We never hold the mutex for more than GC_CHUNK records, so that
+     * lookups are only ever delayed by a little. We step to the next
+     * key before handling the current one, since we might drop
+     * it. Should another thread remove the key we stopped at, the
+     * walk ends early, and the rest is left to the next collection. */
+    k = tdb_firstkey(database);
+
+    for (;;) {
+
+        for (j = 0; j < GC_CHUNK && k.dptr && !s.oom; j++) {
+            next = tdb_nextkey(database, k);
+
+            if ((d = tdb_fetch(database, k)).dptr) {
+
+                if (gc_collect(&s, k, d))
+                    tdb_delete(database, k);
+
+                ca_free(d.dptr);
+            }
+
+            ca_free(k.dptr);
+            k = next;
+        }
+
+        ca_mutex_unlock(mutex);
+
+        if (s.oom) {
+            ca_free(k.dptr);
+            goto finish;
+        }
+
+        if (!k.dptr)
+            break;
+
+        if (!gc_lock(generation)) {
+            ca_free(k.dptr);
+            goto finish;
+        }
+    }
+
+    if (s.total > CACHE_SIZE_MAX) {
+
+        qsort(s.entries, s.n_entries, sizeof(struct gc_entry), gc_entry_compare);
+
+        for (i = 0; i < s.n_entries && s.total > CACHE_SIZE_LOW; i += GC_CHUNK) {
+
+            if (!gc_lock(generation))
+                goto finish;
+
+            for (j = i; j < i + GC_CHUNK && j < s.n_entries && s.total > CACHE_SIZE_LOW; j++) {
+                TDB_DATA ek;
+
+                ek.dptr = s.entries[j].key;
+                ek.dsize = s.entries[j].klen;
+
+                if (tdb_delete(database, ek) >= 0)
+                    s.total -= s.entries[j].size;
+            }
+
+            ca_mutex_unlock(mutex);
+        }
+    }
+
+    if (!gc_lock(generation))
+        goto finish;
+
+    k.dptr = (void*) GC_KEY;
+    k.dsize = sizeof(GC_KEY)-1;
+
+    stamp = (uint32_t) s.now;
+    d.dptr = (void*) &stamp;
+    d.dsize = sizeof(stamp);
+    tdb_store(database, k, d, TDB_REPLACE);
+
+    compact =
+        fstat(tdb_fd(database), &st) >= 0 &&
+        (size_t) st.st_size > s.total*2 + COMPACT_SLACK;
+
+    ca_mutex_unlock(mutex);
+
+    if (compact)
+        db_compact(generation);
+
+finish:
+
+    for (i = 0; i < s.n_entries; i++)
+        ca_free(s.entries[i].key);
+
+    ca_free(s.entries);
+}
+
+static void* gc_thread(void *userdata) {
+    time_t last_change;
+
+    pthread_detach(pthread_self());
+
+    /* Both take the mutex themselves, db_gc() only in short stretches */
+    if (get_last_change(&last_change) >= 0)
+        db_gc(last_change);
+
+    ca_mutex_lock(mutex);
+    gc_running = FALSE;
+    ca_mutex_unlock(mutex);
+
+    return NULL;
+}
+
+static void gc_start_unlocked(time_t now) {
+    pthread_t thread;
+
+    if (gc_running)
+        return;
+
+    if (gc_checked > 0 && now >= gc_checked && now < gc_checked + GC_CHECK_INTERVAL)
+        return;
+
+    gc_checked = now;
+
+    /* Collecting is done in the background so that it never delays
+     * the lookup that triggered it */
+    if (pthread_create(&thread, NULL, gc_thread, NULL) == 0)
+        gc_running = TRUE;
+}
+
 int ca_cache_lookup_sound(
         ca_sound_file **f,
         ca_sound_file_open_callback_t sfopen,
@@ -459,7 +905,7 @@ int ca_cache_lookup_sound(
     void *data = NULL;
     size_t klen, dlen;
     int ret;
-    uint32_t timestamp;
+    uint32_t timestamp, atime;
     time_t last_change, now;
     ca_bool_t remove_entry = FALSE;
 
@@ -483,8 +929,7 @@ int ca_cache_lookup_sound(
 
     ca_assert(data);
 
-    if (dlen < sizeof(uint32_t) ||
-        (dlen > sizeof(uint32_t) && ((char*) data)[dlen-1] != 0)) {
+    if (!parse_entry(data, dlen, &timestamp, &atime)) {
 
         /* Corrupt entry */
         ret = CA_ERROR_NOTFOUND;
@@ -492,8 +937,6 @@ int ca_cache_lookup_sound(
         goto finish;
     }
 
-    memcpy(&timestamp, data, sizeof(timestamp));
-
     if ((ret = get_last_change(&last_change)) < 0)
         goto finish;
 
@@ -507,7 +950,15 @@ int ca_cache_lookup_sound(
         goto finish;
     }
 
-    if (dlen <= sizeof(uint32_t)) {
+    /* Keep the access stamp roughly up to date for the collector,
+     * failing to do so is not fatal */
+    if ((time_t) atime > now || now >= (time_t) atime + ATIME_INTERVAL) {
+        atime = (uint32_t) now;
+        memcpy((char*) data + sizeof(uint32_t), &atime, sizeof(atime));
+        db_store(key, klen, data, dlen);
+    }
+
+    if (dlen <= HEADER_SIZE) {
         /* Negative caching entry. */
         *f = NULL;
         ret = CA_SUCCESS;
@@ -515,17 +966,24 @@ int ca_cache_lookup_sound(
     }
 
     if (sound_path) {
-        if (!(*sound_path = ca_strdup((const char*) data + sizeof(uint32_t)))) {
+        if (!(*sound_path = ca_strdup((const char*) data + HEADER_SIZE))) {
             ret = CA_ERROR_OOM;
             goto finish;
         }
     }
 
-    if ((ret = sfopen(f, (const char*) data + sizeof(uint32_t))) < 0)
+    if ((ret = sfopen(f, (const char*) data + HEADER_SIZE)) < 0)
         remove_entry = TRUE;
 
 finish:
 
+    /* Errors count as misses too, the caller walks the theme then */
+    if (ret >= 0)
+        CA_PROBE5(cache_lookup_hit, theme, name, locale, profile,
+                  dlen > HEADER_SIZE ? (const char*) data + HEADER_SIZE : NULL);
+    else
+        CA_PROBE4(cache_lookup_miss, theme, name, locale, profile);
+
     if (remove_entry)
         db_remove(key, klen);
 
@@ -559,7 +1017,7 @@ int ca_cache_store_sound(
     if (!(key = build_key(theme, name, locale, profile, &klen)))
         return CA_ERROR_OOM;
 
-    dlen = sizeof(uint32_t) + (fname ? strlen(fname) + 1 : 0);
+    dlen = HEADER_SIZE + (fname ? strlen(fname) + 1 : 0);
 
     if (!(data = ca_malloc(dlen))) {
         ca_free(key);
@@ -567,10 +1025,11 @@ int ca_cache_store_sound(
     }
 
     ca_assert_se(time(&now) != (time_t) -1);
-    *(uint32_t*) data = (uint32_t) now;
+    ((uint32_t*) data)[0] = (uint32_t) now;
+    ((uint32_t*) data)[1] = (uint32_t) now;
 
     if (fname)
-        strcpy((char*) data + sizeof(uint32_t), fname);
+        strcpy((char*) data + HEADER_SIZE, fname);
 
     ret = db_store(key, klen, data, dlen);
 
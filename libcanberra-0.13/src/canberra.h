@@ -191,6 +191,24 @@ extern "C" {
  */
 #define CA_PROP_EVENT_VISUAL_EFFECT					"event.visual.effect"
 
+/**
+ * CA_PROP_EVENT_VISUAL_COLOR:
+ *
+ * The color of a COLOR_ALERT visual effect, in any format
+ * gdk_color_parse() understands, e.g. "red" or "#ff0000". Overrides
+ * the color the user configured for this class of event.
+ */
+#define CA_PROP_EVENT_VISUAL_COLOR                 "event.visual.color"
+
+/**
+ * CA_PROP_EVENT_VISUAL_DURATION:
+ *
+ * How long the visual effect should be shown, in milliseconds,
+ * formatted as string. Overrides the duration the user configured for
+ * this class of event.
+ */
+#define CA_PROP_EVENT_VISUAL_DURATION              "event.visual.duration"
+
 /**
  * CA_PROP_WINDOW_NAME:
  *
@@ -400,7 +418,8 @@ extern "C" {
  * A special property that can be used to control whether any sounds
  * are played at all. If this property is "1" or unset sounds are
  * played as normal. However, if it is "0" all calls to
- * ca_context_play() will fail with CA_ERROR_DISABLED.
+ * ca_context_play() will fail with CA_ERROR_DISABLED. The visual
+ * effect of the event is still shown, however.
  *
  * If the list of properties is handed on to the sound server this
  * property is stripped from it.
@@ -424,6 +443,43 @@ extern "C" {
  */
 #define CA_PROP_CANBERRA_FORCE_CHANNEL             "canberra.force_channel"
 
+/**
+ * CA_PROP_CANBERRA_LATENCY:
+ *
+ * A special property that can be used to control how much audio is
+ * buffered in the backend before and while a sound is played. One of
+ * "input-feedback", "alert", "media". "input-feedback" asks for the
+ * smallest buffers possible, so that sounds triggered by user input
+ * are heard right away. "alert" is suitable for most other event
+ * sounds, while "media" trades latency for robustness against
+ * dropouts, e.g. for long sounds such as desktop login sounds. This
+ * property is only honoured by some backends, other backends may
+ * choose to ignore it completely.
+ *
+ * If this property is not set the backend's default buffer metrics
+ * are used.
+ *
+ * If the list of properties is handed on to the sound server this
+ * property is stripped from it.
+ */
+#define CA_PROP_CANBERRA_LATENCY                   "canberra.latency"
+
+/**
+ * CA_PROP_CANBERRA_VISUAL_ONLY:
+ *
+ * A special property that can be used to show only the visual
+ * effect of an event, without playing any sound. If this property is
+ * "1" ca_context_play() will neither open the backend nor look up or
+ * decode the sound file, and the callback passed to
+ * ca_context_play_full() is called with CA_SUCCESS right away. If
+ * this property is unset the environment variable
+ * $CANBERRA_VISUAL_ONLY is consulted the same way.
+ *
+ * If the list of properties is handed on to the sound server this
+ * property is stripped from it.
+ */
+#define CA_PROP_CANBERRA_VISUAL_ONLY               "canberra.visual_only"
+
 /**
  * ca_context:
  *
@@ -484,11 +540,35 @@ enum {
  */
 typedef struct ca_proplist ca_proplist;
 
+/**
+ * ca_play_observer_t:
+ * @c: The libcanberra context the event was played on
+ * @id: The numerical id passed to ca_context_play_full()
+ * @p: The properties of the event as passed to ca_context_play_full(). Only valid during the call, use ca_proplist_gets() to read it.
+ * @error_code: The return value of ca_context_play_full() for this event
+ * @userdata: Some arbitrary user data passed to ca_context_add_play_observer()
+ *
+ * Play observer callback, see ca_context_add_play_observer(). The
+ * same restrictions as for ca_finish_callback_t apply: the code
+ * implementing this function may not call any libcanberra API call
+ * except ca_proplist_gets() on @p.
+ */
+typedef void (*ca_play_observer_t)(ca_context *c, uint32_t id, ca_proplist *p, int error_code, void *userdata);
+
+/**
+ * CA_PLAY_OBSERVER_ASYNC:
+ *
+ * Flag for ca_context_add_play_observer(): call the observer from a
+ * background thread instead of the thread that played the event.
+ */
+#define CA_PLAY_OBSERVER_ASYNC 1
+
 int ca_proplist_create(ca_proplist **p);
 int ca_proplist_destroy(ca_proplist *p);
 int ca_proplist_sets(ca_proplist *p, const char *key, const char *value);
 int ca_proplist_setf(ca_proplist *p, const char *key, const char *format, ...) __attribute__((format(printf, 3, 4)));
 int ca_proplist_set(ca_proplist *p, const char *key, const void *data, size_t nbytes);
+const char* ca_proplist_gets(ca_proplist *p, const char *key);
 
 int ca_context_create(ca_context **c);
 int ca_context_set_driver(ca_context *c, const char *driver);
@@ -501,7 +581,10 @@ int ca_context_play_full(ca_context *c, uint32_t id, ca_proplist *p, ca_finish_c
 int ca_context_play(ca_context *c, uint32_t id, ...) __attribute__((sentinel));
 int ca_context_cache_full(ca_context *c, ca_proplist *p);
 int ca_context_cache(ca_context *c, ...) __attribute__((sentinel));
+int ca_context_cache_many(ca_context *c, ca_proplist **p, unsigned n, ca_finish_callback_t cb, void *userdata);
 int ca_context_cancel(ca_context *c, uint32_t id);
+int ca_context_add_play_observer(ca_context *c, ca_play_observer_t cb, void *userdata, int flags);
+int ca_context_remove_play_observer(ca_context *c, ca_play_observer_t cb, void *userdata);
 
 const char *ca_strerror(int code);
 
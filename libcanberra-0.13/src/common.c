@@ -31,7 +31,10 @@
 #include "proplist.h"
 #include "macro.h"
 #include "fork-detect.h"
-#include "vizaudio.h"
+#include "prefetch.h"
+#include "observer.h"
+#include "vizaudio_hook.h"
+#include "probes.h"
 
 /**
  * SECTION:canberra
@@ -97,7 +100,7 @@
  *
  * It is highly recommended that the application sets the
  * %CA_PROP_APPLICATION_NAME, %CA_PROP_APPLICATION_ID,
- * %CA_PROP_APPLICATION_ICON_NAME/%CA_PRvizaudio_display(p);OP_APPLICATION_ICON properties
+ * %CA_PROP_APPLICATION_ICON_NAME/%CA_PROP_APPLICATION_ICON properties
  * immediately after creating the ca_context, before calling
  * ca_context_open() or ca_context_play().
  *
@@ -181,9 +184,43 @@ int ca_context_destroy(ca_context *c) {
      * broken anyway if it destructs this object in one thread and
      * still is calling a method of it in another. */
 
+    /* Make sure no cache_many job starts another upload from now on */
+    if (c->mutex) {
+        ca_mutex_lock(c->mutex);
+        c->cache_canceled = TRUE;
+        ca_mutex_unlock(c->mutex);
+    }
+
+    /* This also fails all uploads that are still in progress */
     if (c->opened)
         ret = driver_destroy(c);
 
+    if (c->mutex) {
+        ca_mutex_lock(c->mutex);
+
+        /* Now wait until all cache_many jobs are finished */
+        c->signal_cache_semaphore = TRUE;
+        while (c->n_cache_jobs > 0) {
+            ca_mutex_unlock(c->mutex);
+            sem_wait(&c->cache_semaphore);
+            ca_mutex_lock(c->mutex);
+        }
+
+        ca_mutex_unlock(c->mutex);
+    }
+
+    if (c->cache_semaphore_allocated)
+        sem_destroy(&c->cache_semaphore);
+
+    if (c->hotset) {
+        ca_hotset_save(c->hotset);
+        ca_hotset_free(c->hotset);
+    }
+
+    /* This delivers whatever is still queued for asynchronous
+     * observers */
+    ca_observers_free(c);
+
     if (c->props)
         ca_assert_se(ca_proplist_destroy(c->props) == CA_SUCCESS);
 
@@ -289,10 +326,17 @@ static int context_open_unlocked(ca_context *c) {
     if (c->opened)
         return CA_SUCCESS;
 
-    if ((ret = driver_open(c)) == CA_SUCCESS)
-        c->opened = TRUE;
+    if ((ret = driver_open(c)) < 0)
+        return ret;
 
-    return ret;
+    c->opened = TRUE;
+
+    /* Warm up the caches with what this application played last
+     * time. Failing to do so is not fatal. */
+    if (!c->hotset && ca_hotset_load(&c->hotset, c->props) == CA_SUCCESS)
+        ca_hotset_prefetch(c->hotset, c->props);
+
+    return CA_SUCCESS;
 }
 
 /**
@@ -373,9 +417,31 @@ int ca_context_change_props(ca_context *c, ...)  {
  * Returns: 0 on success, negative error code on error.
  */
 
+static ca_bool_t theme_switched(ca_proplist *old, ca_proplist *new) {
+    const char *a, *b, *e;
+    ca_bool_t r;
+
+    ca_mutex_lock(old->mutex);
+    ca_mutex_lock(new->mutex);
+
+    /* The initial binding of the theme name is not a switch, the hot
+     * set takes care of warming up on startup. */
+    a = ca_proplist_gets_unlocked(old, CA_PROP_CANBERRA_XDG_THEME_NAME);
+    b = ca_proplist_gets_unlocked(new, CA_PROP_CANBERRA_XDG_THEME_NAME);
+    e = ca_proplist_gets_unlocked(new, CA_PROP_CANBERRA_ENABLE);
+
+    r = a && b && !ca_streq(a, b) && !(e && ca_streq(e, "0"));
+
+    ca_mutex_unlock(new->mutex);
+    ca_mutex_unlock(old->mutex);
+
+    return r;
+}
+
 int ca_context_change_props_full(ca_context *c, ca_proplist *p) {
     int ret;
     ca_proplist *merged;
+    ca_bool_t switched;
 
     ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
@@ -389,8 +455,20 @@ int ca_context_change_props_full(ca_context *c, ca_proplist *p) {
     ret = c->opened ? driver_change_props(c, p, merged) : CA_SUCCESS;
 
     if (ret == CA_SUCCESS) {
+        switched = theme_switched(c->props, merged);
+
         ca_assert_se(ca_proplist_destroy(c->props) == CA_SUCCESS);
         c->props = merged;
+
+        /* Resolve and decode the common sounds of the new theme in
+         * the background, so that the first ones the user hears after
+         * the switch don't have to. */
+        if (switched) {
+            ca_prefetch_theme(c->props);
+
+            if (c->hotset)
+                ca_hotset_prefetch(c->hotset, c->props);
+        }
     } else
         ca_assert_se(ca_proplist_destroy(merged) == CA_SUCCESS);
 
@@ -485,10 +563,27 @@ int ca_context_play(ca_context *c, uint32_t id, ...) {
  * Returns: 0 on success, negative error code on error.
  */
 
+static void dispatch_visual(ca_proplist *p) {
+#ifdef HAVE_VIZAUDIO
+    ca_proplist *copy;
+
+    /* The effects block until they are over, hence we don't keep p
+     * locked for that long but hand over a private copy */
+    if (ca_proplist_copy(&copy, p) < 0)
+        return;
+
+    vizaudio_display(copy);
+
+    ca_assert_se(ca_proplist_destroy(copy) == CA_SUCCESS);
+#endif
+}
+
 int ca_context_play_full(ca_context *c, uint32_t id, ca_proplist *p, ca_finish_callback_t cb, void *userdata) {
     int ret;
     const char *t;
-    ca_bool_t enabled = TRUE;
+    ca_bool_t enabled = TRUE, visual_only = FALSE;
+    ca_observer_set *observers = NULL;
+    ca_hotset_snapshot *snapshot = NULL;
 
     ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
@@ -502,30 +597,84 @@ int ca_context_play_full(ca_context *c, uint32_t id, ca_proplist *p, ca_finish_c
                                  ca_proplist_contains(p, CA_PROP_MEDIA_FILENAME) ||
                                  ca_proplist_contains(c->props, CA_PROP_MEDIA_FILENAME), CA_ERROR_INVALID, c->mutex);
 
+    /* Only calls that got past validation are traced, so that every
+     * start is matched by an end */
+    CA_PROBE3(play_full_start, c, id, p);
+
+    if ((t = getenv("CANBERRA_VISUAL_ONLY")))
+        visual_only = ca_streq(t, "1");
+
     ca_mutex_lock(c->props->mutex);
     if ((t = ca_proplist_gets_unlocked(c->props, CA_PROP_CANBERRA_ENABLE)))
         enabled = !ca_streq(t, "0");
+    if ((t = ca_proplist_gets_unlocked(c->props, CA_PROP_CANBERRA_VISUAL_ONLY)))
+        visual_only = ca_streq(t, "1");
     ca_mutex_unlock(c->props->mutex);
 
     ca_mutex_lock(p->mutex);
     if ((t = ca_proplist_gets_unlocked(p, CA_PROP_CANBERRA_ENABLE)))
         enabled = !ca_streq(t, "0");
+    if ((t = ca_proplist_gets_unlocked(p, CA_PROP_CANBERRA_VISUAL_ONLY)))
+        visual_only = ca_streq(t, "1");
     ca_mutex_unlock(p->mutex);
 
-    ca_return_val_if_fail_unlock(enabled, CA_ERROR_DISABLED, c->mutex);
+    /* Nobody is going to hear this, so don't even open the backend
+     * or touch the sound file. The visual effect is all some users
+     * get, hence we show it even if sounds are disabled. */
+    if (!enabled) {
+        ret = CA_ERROR_DISABLED;
+        goto finish;
+    }
+
+    if (visual_only) {
+        ret = CA_SUCCESS;
+        goto finish;
+    }
 
     if ((ret = context_open_unlocked(c)) < 0)
         goto finish;
 
     ca_assert(c->opened);
 
+    CA_PROBE2(driver_play_start, c, id);
     ret = driver_play(c, id, p, cb, userdata);
-	
-	vizaudio_display(p);
+    CA_PROBE3(driver_play_end, c, id, ret);
+
+    if (ret == CA_SUCCESS && c->hotset) {
+        ca_mutex_lock(p->mutex);
+        if ((t = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_ID)))
+            ca_hotset_record(c->hotset, t);
+        ca_mutex_unlock(p->mutex);
+
+        snapshot = ca_hotset_snapshot_take(c->hotset);
+    }
+
 finish:
 
+    if (c->observers)
+        observers = ca_observer_set_ref(c->observers);
+
     ca_mutex_unlock(c->mutex);
 
+    /* The file is written on a worker, the play path only pays for
+     * starting it, once in a while */
+    if (snapshot)
+        ca_hotset_snapshot_save_async(snapshot, c->props);
+
+    /* Also if the sound couldn't be played, e.g. because there is no
+     * audio device at all */
+    dispatch_visual(p);
+
+    if (visual_only && enabled && cb) {
+        CA_PROBE4(callback, "visual-only", c, id, CA_SUCCESS);
+        cb(c, id, CA_SUCCESS, userdata);
+    }
+
+    if (observers)
+        ca_observers_notify(c, observers, id, p, ret);
+
+    CA_PROBE3(play_full_end, c, id, ret);
+
     return ret;
 }
 
@@ -558,6 +707,75 @@ int ca_context_cancel(ca_context *c, uint32_t id)  {
     return ret;
 }
 
+/**
+ * ca_context_add_play_observer:
+ * @c: the context to observe
+ * @cb: the function to call for every event played on @c
+ * @userdata: arbitrary data passed to @cb
+ * @flags: 0 or %CA_PLAY_OBSERVER_ASYNC
+ *
+ * Register a function that is notified about every event passed to
+ * ca_context_play() or ca_context_play_full(), including events that
+ * failed to play or were only shown visually, together with the
+ * result. This is useful for logging, haptic feedback or bridging to
+ * screen readers.
+ *
+ * Observers are called after the context has been unlocked again, so
+ * they never delay other threads playing sounds. By default they are
+ * called from the thread that played the event before
+ * ca_context_play() returns. With %CA_PLAY_OBSERVER_ASYNC they are
+ * called from a background thread instead, so that they do not delay
+ * the caller either.
+ *
+ * Returns: 0 on success, negative error code on error.
+ */
+int ca_context_add_play_observer(ca_context *c, ca_play_observer_t cb, void *userdata, int flags) {
+    int ret;
+
+    ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cb, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!(flags & ~CA_PLAY_OBSERVER_ASYNC), CA_ERROR_INVALID);
+
+    ca_mutex_lock(c->mutex);
+    ret = ca_observers_add(c, cb, userdata, flags);
+    ca_mutex_unlock(c->mutex);
+
+    return ret;
+}
+
+/**
+ * ca_context_remove_play_observer:
+ * @c: the context the observer was registered on
+ * @cb: the function passed to ca_context_add_play_observer()
+ * @userdata: the data passed to ca_context_add_play_observer()
+ *
+ * Unregister an observer previously registered with
+ * ca_context_add_play_observer(). When this function returns the
+ * observer is not running and will not be called again, hence
+ * @userdata may be freed right away. This must not be called from an
+ * observer.
+ *
+ * Returns: 0 on success, negative error code on error.
+ */
+int ca_context_remove_play_observer(ca_context *c, ca_play_observer_t cb, void *userdata) {
+    int ret;
+    unsigned long generation;
+
+    ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cb, CA_ERROR_INVALID);
+
+    ca_mutex_lock(c->mutex);
+    ret = ca_observers_remove(c, cb, userdata, &generation);
+    ca_mutex_unlock(c->mutex);
+
+    if (ret == CA_SUCCESS)
+        ca_observers_synchronize(c, generation);
+
+    return ret;
+}
+
 /**
  * ca_context_cache:
  * @c: The context to use for uploading.
@@ -638,6 +856,217 @@ finish:
     return ret;
 }
 
+/* Like ca_context_cache_many() for a single sound, but without
+ * falling back to the local cache: the backend's CA_ERROR_NOTSUPPORTED
+ * is passed on. Used by the multi driver, which cannot call the
+ * driver of its backends directly. */
+int ca_context_driver_cache_async(ca_context *c, ca_proplist *p, ca_finish_callback_t cb, void *userdata) {
+    int ret;
+
+    ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(p, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+
+    ca_mutex_lock(c->mutex);
+
+    ca_return_val_if_fail_unlock(ca_proplist_contains(p, CA_PROP_EVENT_ID) ||
+                                 ca_proplist_contains(c->props, CA_PROP_EVENT_ID), CA_ERROR_INVALID, c->mutex);
+
+    if ((ret = context_open_unlocked(c)) < 0)
+        goto finish;
+
+    ca_assert(c->opened);
+
+    if (c->cache_canceled)
+        ret = CA_ERROR_DESTROYED;
+    else
+        ret = driver_cache_async(c, p, cb, userdata);
+
+finish:
+
+    ca_mutex_unlock(c->mutex);
+
+    return ret;
+}
+
+struct cache_many {
+    ca_context *context;
+    ca_finish_callback_t callback;
+    void *userdata;
+};
+
+struct cache_wait {
+    sem_t semaphore;
+    int error;
+};
+
+static void cache_wait_cb(ca_context *c, uint32_t id, int error_code, void *userdata) {
+    struct cache_wait *w = userdata;
+
+    w->error = error_code;
+    sem_post(&w->semaphore);
+}
+
+static int cache_many_item(unsigned idx, ca_theme_data **t, ca_proplist *cp, ca_proplist *sp, void *userdata) {
+    struct cache_many *m = userdata;
+    ca_context *c = m->context;
+    struct cache_wait w;
+    ca_bool_t canceled;
+    int ret;
+
+    ca_mutex_lock(c->mutex);
+    canceled = c->cache_canceled;
+    ca_mutex_unlock(c->mutex);
+
+    if (canceled)
+        return CA_ERROR_DESTROYED;
+
+    /* Resolving and decoding is what we can do in parallel, without
+     * holding the context lock. Sounds too large for the PCM cache
+     * may still be uploaded. */
+    if ((ret = ca_prefetch_sound(t, cp, sp)) < 0 && ret != CA_ERROR_TOOBIG)
+        return ret;
+
+    if (sem_init(&w.semaphore, 0, 0) < 0)
+        return CA_ERROR_OOM;
+
+    w.error = CA_SUCCESS;
+
+    ca_mutex_lock(c->mutex);
+
+    if (c->cache_canceled)
+        ret = CA_ERROR_DESTROYED;
+    else if ((ret = driver_cache_async(c, sp, cache_wait_cb, &w)) == CA_SUCCESS) {
+        ca_mutex_unlock(c->mutex);
+
+        /* Each worker keeps one upload in flight */
+        sem_wait(&w.semaphore);
+        sem_destroy(&w.semaphore);
+
+        return w.error;
+    } else if (ret == CA_ERROR_NOTSUPPORTED)
+        /* Without a sample cache in the sound server the decoded
+         * data in our PCM cache is all we can offer */
+        ret = CA_SUCCESS;
+
+    ca_mutex_unlock(c->mutex);
+
+    sem_destroy(&w.semaphore);
+
+    return ret;
+}
+
+static void cache_many_done(unsigned idx, int error, void *userdata) {
+    struct cache_many *m = userdata;
+
+    if (m->callback)
+        m->callback(m->context, idx, error, m->userdata);
+}
+
+static void cache_many_finish(void *userdata) {
+    struct cache_many *m = userdata;
+    ca_context *c = m->context;
+
+    ca_free(m);
+
+    ca_mutex_lock(c->mutex);
+
+    ca_assert(c->n_cache_jobs > 0);
+    c->n_cache_jobs--;
+
+    if (c->n_cache_jobs <= 0 && c->signal_cache_semaphore)
+        sem_post(&c->cache_semaphore);
+
+    ca_mutex_unlock(c->mutex);
+}
+
+/**
+ * ca_context_cache_many:
+ * @c: The context to use for uploading.
+ * @p: An array of property lists, one for each event sound.
+ * @n: The number of entries in @p.
+ * @cb: A callback to call for each sound when it has been cached or when an error occured.
+ * @userdata: Some arbitrary user data the caller of the library may point to.
+ *
+ * Upload a number of samples into the sound server, similar to
+ * ca_context_cache_full(). Unlike that function this one does not
+ * wait for the uploads to finish but returns right away. The sounds
+ * are resolved and decoded in parallel in background threads, and
+ * several uploads are in flight at the same time.
+ *
+ * If the backend doesn't support caching sound samples in the sound
+ * server the sounds are decoded into a local cache in memory instead,
+ * which speeds up playback as well.
+ *
+ * If this function returns %CA_SUCCESS the callback is called exactly
+ * once for each entry, with the index of the entry in @p as id. See
+ * ca_finish_callback_t for the context the callback is called
+ * in. Destroying the context fails all entries still pending with
+ * %CA_ERROR_DESTROYED. The property lists are copied, so the caller may
+ * free them right after this call.
+ *
+ * Returns: 0 on success, negative error code on error.
+ */
+int ca_context_cache_many(ca_context *c, ca_proplist **p, unsigned n, ca_finish_callback_t cb, void *userdata) {
+    struct cache_many *m;
+    unsigned i;
+    int ret;
+
+    ca_return_val_if_fail(!ca_detect_fork(), CA_ERROR_FORKED);
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(p || n <= 0, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+
+    if (n <= 0)
+        return CA_SUCCESS;
+
+    ca_mutex_lock(c->mutex);
+
+    for (i = 0; i < n; i++)
+        ca_return_val_if_fail_unlock(p[i] &&
+                                     (ca_proplist_contains(p[i], CA_PROP_EVENT_ID) ||
+                                      ca_proplist_contains(c->props, CA_PROP_EVENT_ID)), CA_ERROR_INVALID, c->mutex);
+
+    if ((ret = context_open_unlocked(c)) < 0)
+        goto finish;
+
+    ca_assert(c->opened);
+
+    if (!c->cache_semaphore_allocated) {
+        if (sem_init(&c->cache_semaphore, 0, 0) < 0) {
+            ret = CA_ERROR_OOM;
+            goto finish;
+        }
+
+        c->cache_semaphore_allocated = TRUE;
+    }
+
+    if (!(m = ca_new(struct cache_many, 1))) {
+        ret = CA_ERROR_OOM;
+        goto finish;
+    }
+
+    m->context = c;
+    m->callback = cb;
+    m->userdata = userdata;
+
+    /* The workers need the context lock, so they won't get far
+     * before we return */
+    if ((ret = ca_prefetch(c->props, p, n, 0, cache_many_item, cache_many_done, cache_many_finish, m)) < 0) {
+        ca_free(m);
+        goto finish;
+    }
+
+    c->n_cache_jobs++;
+
+finish:
+
+    ca_mutex_unlock(c->mutex);
+
+    return ret;
+}
+
 /**
  * ca_strerror:
  * @code: Numerical error code as returned by a libcanberra API function
@@ -692,3 +1121,71 @@ int ca_parse_cache_control(ca_cache_control_t *control, const char *c) {
 
     return CA_SUCCESS;
 }
+
+/* Not exported */
+int ca_parse_latency(ca_latency_t *latency, const char *c) {
+    ca_return_val_if_fail(latency, CA_ERROR_INVALID);
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+
+    if (ca_streq(c, "input-feedback"))
+        *latency = CA_LATENCY_INPUT_FEEDBACK;
+    else if (ca_streq(c, "alert"))
+        *latency = CA_LATENCY_ALERT;
+    else if (ca_streq(c, "media"))
+        *latency = CA_LATENCY_MEDIA;
+    else
+        return CA_ERROR_INVALID;
+
+    return CA_SUCCESS;
+}
+
+/* Not exported */
+int ca_get_latency(ca_latency_t *latency, ca_proplist *cp, ca_proplist *p) {
+    const char *t;
+    int ret = CA_SUCCESS;
+
+    ca_return_val_if_fail(latency, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+    ca_return_val_if_fail(p, CA_ERROR_INVALID);
+
+    *latency = CA_LATENCY_DEFAULT;
+
+    /* The event properties take precedence over the context
+     * properties */
+
+    ca_mutex_lock(p->mutex);
+    if ((t = ca_proplist_gets_unlocked(p, CA_PROP_CANBERRA_LATENCY)))
+        ret = ca_parse_latency(latency, t);
+    ca_mutex_unlock(p->mutex);
+
+    if (t)
+        return ret;
+
+    ca_mutex_lock(cp->mutex);
+    if ((t = ca_proplist_gets_unlocked(cp, CA_PROP_CANBERRA_LATENCY)))
+        ret = ca_parse_latency(latency, t);
+    ca_mutex_unlock(cp->mutex);
+
+    return ret;
+}
+
+/* Not exported */
+unsigned ca_latency_usec(ca_latency_t latency) {
+
+    /* The total buffer time we ask the backend for. Input feedback
+     * needs to be audible within a single frame at 60 Hz. 0 means
+     * that the backend's defaults shall be used. */
+
+    switch (latency) {
+        case CA_LATENCY_INPUT_FEEDBACK:
+            return 10000;
+        case CA_LATENCY_ALERT:
+            return 50000;
+        case CA_LATENCY_MEDIA:
+            return 250000;
+        case CA_LATENCY_DEFAULT:
+            break;
+    }
+
+    return 0;
+}
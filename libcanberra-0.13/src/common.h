@@ -21,9 +21,12 @@
   <http://www.gnu.org/licenses/>.
 ***/
 
+#include <semaphore.h>
+
 #include "canberra.h"
 #include "macro.h"
 #include "mutex.h"
+#include "hotset.h"
 
 struct ca_context {
     ca_bool_t opened;
@@ -38,6 +41,22 @@ struct ca_context {
 #ifdef HAVE_DSO
     void *private_dso;
 #endif
+
+    /* Background jobs started by ca_context_cache_many(), protected
+     * by mutex */
+    unsigned n_cache_jobs;
+    ca_bool_t cache_canceled;
+    ca_bool_t cache_semaphore_allocated;
+    ca_bool_t signal_cache_semaphore;
+    sem_t cache_semaphore;
+
+    /* Event sounds this application plays most, protected by mutex */
+    ca_hotset *hotset;
+
+    /* Play observers, replaced as a whole under mutex, see observer.h */
+    struct ca_observer_set *observers;
+    struct ca_observer_queue *observer_queue;
+    struct ca_observer_sync *observer_sync;
 };
 
 typedef enum ca_cache_control {
@@ -48,4 +67,20 @@ typedef enum ca_cache_control {
 
 int ca_parse_cache_control(ca_cache_control_t *control, const char *c);
 
+int ca_context_driver_cache_async(ca_context *c, ca_proplist *p, ca_finish_callback_t cb, void *userdata);
+
+typedef enum ca_latency {
+    CA_LATENCY_DEFAULT,
+    CA_LATENCY_INPUT_FEEDBACK,
+    CA_LATENCY_ALERT,
+    CA_LATENCY_MEDIA
+} ca_latency_t;
+
+/* Backends split the buffer into this many periods/fragments */
+#define CA_LATENCY_PERIODS 4U
+
+int ca_parse_latency(ca_latency_t *latency, const char *c);
+int ca_get_latency(ca_latency_t *latency, ca_proplist *cp, ca_proplist *p);
+unsigned ca_latency_usec(ca_latency_t latency);
+
 #endif
@@ -33,4 +33,9 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *p, ca_finish_callback_t
 int driver_cancel(ca_context *c, uint32_t id);
 int driver_cache(ca_context *c, ca_proplist *p);
 
+/* Like driver_cache() but returns as soon as the upload has been
+ * started, cb is called when it finished. Backends without a sample
+ * cache in the sound server return CA_ERROR_NOTSUPPORTED. */
+int driver_cache_async(ca_context *c, ca_proplist *p, ca_finish_callback_t cb, void *userdata);
+
 #endif
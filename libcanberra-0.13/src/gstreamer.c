@@ -24,13 +24,9 @@
 #include <config.h>
 #endif
 
-#include <errno.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <semaphore.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 
 #include <gst/gst.h>
 
@@ -41,6 +37,47 @@
 #include "read-sound-file.h"
 #include "sound-theme-spec.h"
 #include "malloc.h"
+#include "probes.h"
+
+/* How many idle pipelines we keep around for reuse */
+#define N_POOL 2
+
+#define BUFSIZE (16*1024)
+
+/* A pre-constructed appsrc ! audioconvert ! audioresample !
+ * autoaudiosink pipeline. While idle it is kept in NULL state, so
+ * that the elements are already instantiated and linked, but the
+ * sink doesn't keep the audio device open between sounds. */
+struct slot {
+    CA_LLIST_FIELDS(struct slot);
+    struct private *private;
+
+    GstElement *pipeline;
+    GstElement *appsrc;
+
+    /* The actual sink autoaudiosink created for us, and its default
+     * buffer metrics. autoaudiosink creates a new one each time it is
+     * brought up from NULL and frees it again when it goes back, so
+     * this is only valid in between. */
+    GstElement *audio_sink;
+    gint64 default_buffer_time, default_latency_time;
+
+    /* What the sound being played asked for, 0 for the defaults */
+    gint64 buffer_time, latency_time;
+
+    /* Only touched from the streaming thread while playing */
+    ca_sound_file *file;
+    size_t frame_size;
+    unsigned rate;
+    guint64 offset;
+
+    /* Copies of the outstanding's, for the probes */
+    ca_context *context;
+    uint32_t id;
+
+    /* Protected by the outstanding_mutex */
+    struct outstanding *outstanding;
+};
 
 struct outstanding {
     CA_LLIST_FIELDS(struct outstanding);
@@ -49,7 +86,7 @@ struct outstanding {
     int err;
     ca_finish_callback_t callback;
     void *userdata;
-    GstElement *pipeline;
+    struct slot *slot;
     struct ca_context *context;
 };
 
@@ -65,6 +102,9 @@ struct private {
     ca_bool_t mgr_thread_running;
     ca_bool_t semaphore_allocated;
     CA_LLIST_HEAD(struct outstanding, outstanding);
+
+    CA_LLIST_HEAD(struct slot, pool);
+    unsigned n_pool;
 };
 
 #define PRIVATE(c) ((struct private *) ((c)->private))
@@ -72,29 +112,208 @@ struct private {
 static void* thread_func(void *userdata);
 static void send_eos_msg(struct outstanding *out, int err);
 static void send_mgr_exit_msg (struct private *p);
+static GstBusSyncReply bus_cb(GstBus *bus, GstMessage *message, gpointer data);
 
 static void outstanding_free(struct outstanding *o) {
+    ca_assert(o);
+    ca_assert(!o->slot);
+
+    ca_free(o);
+}
+
+static void slot_free(struct slot *s) {
     GstBus *bus;
 
-    ca_assert(o);
+    ca_assert(s);
+
+    if (s->pipeline) {
+        gst_element_set_state(s->pipeline, GST_STATE_NULL);
 
-    if (o->pipeline) {
-        bus = gst_pipeline_get_bus(GST_PIPELINE (o->pipeline));
+        bus = gst_pipeline_get_bus(GST_PIPELINE (s->pipeline));
         if (bus != NULL) {
            gst_bus_set_sync_handler(bus, NULL, NULL);
            gst_object_unref(bus);
         }
 
-        gst_object_unref(GST_OBJECT(o->pipeline));
+        gst_object_unref(GST_OBJECT(s->pipeline));
     }
 
-    ca_free(o);
+    if (s->file)
+        ca_sound_file_close(s->file);
+
+    ca_free(s);
+}
+
+static void slot_apply_latency(struct slot *s) {
+    ca_assert(s);
+
+    if (!s->audio_sink)
+        return;
+
+    g_object_set(s->audio_sink,
+                 "buffer-time", s->buffer_time > 0 ? s->buffer_time : s->default_buffer_time,
+                 "latency-time", s->latency_time > 0 ? s->latency_time : s->default_latency_time,
+                 NULL);
+}
+
+static void on_sink_element_added(GstBin *bin, GstElement *element, gpointer data) {
+    struct slot *s = data;
+    GObjectClass *klass;
+
+    /* autoaudiosink creates the actual sink only when it is brought
+     * up, so this is the first point where we can get hold of it. It
+     * is not configured yet at this point, so the latency still
+     * applies to the stream that is about to start. */
+    klass = G_OBJECT_GET_CLASS(element);
+
+    if (!g_object_class_find_property(klass, "buffer-time") ||
+        !g_object_class_find_property(klass, "latency-time"))
+        return;
+
+    s->audio_sink = element;
+    g_object_get(element,
+                 "buffer-time", &s->default_buffer_time,
+                 "latency-time", &s->default_latency_time,
+                 NULL);
+
+    slot_apply_latency(s);
+}
+
+static void on_sink_element_removed(GstBin *bin, GstElement *element, gpointer data) {
+    struct slot *s = data;
+
+    /* autoaudiosink drops its child when going back to NULL */
+    if (element == s->audio_sink)
+        s->audio_sink = NULL;
+}
+
+static void on_need_data(GstElement *appsrc, guint length, gpointer data) {
+    struct slot *s = data;
+    GstBuffer *buf;
+    GstFlowReturn flow;
+    size_t nbytes;
+
+    nbytes = (BUFSIZE/s->frame_size)*s->frame_size;
+
+    if (!(buf = gst_buffer_new_and_alloc((guint) nbytes))) {
+        g_signal_emit_by_name(appsrc, "end-of-stream", &flow);
+        return;
+    }
+
+    if (ca_sound_file_read_arbitrary(s->file, GST_BUFFER_DATA(buf), &nbytes) < 0 || nbytes <= 0) {
+        gst_buffer_unref(buf);
+        g_signal_emit_by_name(appsrc, "end-of-stream", &flow);
+        return;
+    }
+
+    GST_BUFFER_SIZE(buf) = (guint) nbytes;
+    GST_BUFFER_TIMESTAMP(buf) = gst_util_uint64_scale_int(s->offset, GST_SECOND, (gint) s->rate);
+    s->offset += nbytes / s->frame_size;
+    GST_BUFFER_DURATION(buf) = gst_util_uint64_scale_int(s->offset, GST_SECOND, (gint) s->rate) - GST_BUFFER_TIMESTAMP(buf);
+
+    CA_PROBE4(driver_write, "gstreamer", s->context, s->id, nbytes);
+
+    g_signal_emit_by_name(appsrc, "push-buffer", buf, &flow);
+    gst_buffer_unref(buf);
+}
+
+static int slot_new(struct slot **_s, struct private *p) {
+    struct slot *s;
+    GstElement *audioconvert, *audioresample, *sink;
+    GstBus *bus;
+
+    ca_assert(_s);
+    ca_assert(p);
+
+    if (!(s = ca_new0(struct slot, 1)))
+        return CA_ERROR_OOM;
+
+    s->private = p;
+    audioconvert = audioresample = sink = NULL;
+
+    if (!(s->pipeline = gst_pipeline_new(NULL))
+        || !(s->appsrc = gst_element_factory_make("appsrc", NULL))
+        || !(audioconvert = gst_element_factory_make("audioconvert", NULL))
+        || !(audioresample = gst_element_factory_make("audioresample", NULL))
+        || !(sink = gst_element_factory_make("autoaudiosink", NULL))) {
+
+        /* At this point, if there is a failure, free each plugin separately. */
+        if (s->appsrc != NULL)
+           g_object_unref(s->appsrc);
+        if (audioconvert != NULL)
+           g_object_unref(audioconvert);
+        if (audioresample != NULL)
+           g_object_unref(audioresample);
+        if (sink != NULL)
+           g_object_unref(sink);
+
+        s->appsrc = NULL;
+        slot_free(s);
+
+        return CA_ERROR_OOM;
+    }
+
+    g_object_set(s->appsrc,
+                 "format", GST_FORMAT_TIME,
+                 NULL);
+    g_signal_connect(s->appsrc, "need-data",
+                     G_CALLBACK (on_need_data), s);
+
+    if (GST_IS_BIN(sink)) {
+        g_signal_connect(sink, "element-added",
+                         G_CALLBACK (on_sink_element_added), s);
+        g_signal_connect(sink, "element-removed",
+                         G_CALLBACK (on_sink_element_removed), s);
+    }
+
+    bus = gst_pipeline_get_bus(GST_PIPELINE (s->pipeline));
+    gst_bus_set_sync_handler(bus, bus_cb, s);
+    gst_object_unref(bus);
+
+    /* Bin now owns the elements... */
+    gst_bin_add_many(GST_BIN (s->pipeline),
+                     s->appsrc, audioconvert, audioresample, sink, NULL);
+
+    if (!gst_element_link_many(s->appsrc, audioconvert, audioresample, sink, NULL)) {
+        slot_free(s);
+        return CA_ERROR_NOTSUPPORTED;
+    }
+
+    *_s = s;
+
+    return CA_SUCCESS;
+}
+
+/* Called with the outstanding_mutex held. Returns FALSE if the slot
+ * was not put back into the pool, in which case the caller needs to
+ * free it, after dropping the lock. */
+static ca_bool_t slot_release(struct private *p, struct slot *s, ca_bool_t reuse) {
+    ca_assert(p);
+    ca_assert(s);
+
+    s->outstanding = NULL;
+
+    if (s->file) {
+        ca_sound_file_close(s->file);
+        s->file = NULL;
+    }
+
+    if (!reuse || p->n_pool >= N_POOL)
+        return FALSE;
+
+    CA_LLIST_PREPEND(struct slot, p->pool, s);
+    p->n_pool++;
+
+    return TRUE;
 }
 
 int driver_open(ca_context *c) {
     GError *error = NULL;
     struct private *p;
+    struct slot *s;
     pthread_t thread;
+    unsigned i;
+    int ret;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(!PRIVATE(c), CA_ERROR_INVALID);
@@ -129,6 +348,18 @@ int driver_open(ca_context *c) {
     }
     gst_bus_set_flushing(p->mgr_bus, FALSE);
 
+    /* Fill the pipeline pool. This also tells us early if the
+     * needed plugins are not available */
+    for (i = 0; i < N_POOL; i++) {
+        if ((ret = slot_new(&s, p)) < 0) {
+            driver_destroy(c);
+            return ret;
+        }
+
+        CA_LLIST_PREPEND(struct slot, p->pool, s);
+        p->n_pool++;
+    }
+
     /* Give a reference to the bus to the mgr thread */
     if (pthread_create(&thread, NULL, thread_func, p) < 0) {
         driver_destroy(c);
@@ -142,6 +373,7 @@ int driver_open(ca_context *c) {
 int driver_destroy(ca_context *c) {
     struct private *p;
     struct outstanding *out;
+    struct slot *s;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(PRIVATE(c), CA_ERROR_STATE);
@@ -176,6 +408,11 @@ int driver_destroy(ca_context *c) {
         ca_mutex_free(p->outstanding_mutex);
     }
 
+    while ((s = p->pool)) {
+        CA_LLIST_REMOVE(struct slot, p->pool, s);
+        slot_free(s);
+    }
+
     if (p->mgr_bus)
         g_object_unref(p->mgr_bus);
 
@@ -219,7 +456,7 @@ send_eos_msg(struct outstanding *out, int err) {
 
     p = PRIVATE(out->context);
     s = gst_structure_new("application/eos", "info", G_TYPE_POINTER, out, NULL);
-    m = gst_message_new_application (GST_OBJECT (out->pipeline), s);
+    m = gst_message_new_application (GST_OBJECT (out->slot->pipeline), s);
 
     gst_bus_post (p->mgr_bus, m);
 }
@@ -227,15 +464,19 @@ send_eos_msg(struct outstanding *out, int err) {
 static GstBusSyncReply
 bus_cb(GstBus *bus, GstMessage *message, gpointer data) {
     int err;
-    struct outstanding *out;
+    struct slot *s;
     struct private *p;
 
     ca_return_val_if_fail(bus, GST_BUS_DROP);
     ca_return_val_if_fail(message, GST_BUS_DROP);
     ca_return_val_if_fail(data, GST_BUS_DROP);
 
-    out = data;
-    p = PRIVATE(out->context);
+    s = data;
+    p = s->private;
+
+    /* Nobody pops messages off the pipeline bus, so we drop them
+     * all here, otherwise they would pile up as the pipeline is
+     * reused */
 
     switch (GST_MESSAGE_TYPE(message)) {
         /* for all elements */
@@ -244,77 +485,23 @@ bus_cb(GstBus *bus, GstMessage *message, gpointer data) {
             break;
         case GST_MESSAGE_EOS:
             /* only respect EOS from the toplevel pipeline */
-            if (GST_OBJECT(out->pipeline) != GST_MESSAGE_SRC(message))
-              return GST_BUS_PASS;
+            if (GST_OBJECT(s->pipeline) != GST_MESSAGE_SRC(message))
+              return GST_BUS_DROP;
 
             err = CA_SUCCESS;
             break;
         default:
-            return GST_BUS_PASS;
+            return GST_BUS_DROP;
     }
 
-    /* Bin finished playback: ask the manager thread to shut it
-     * down, since we can't from the sync message handler */
+    /* Bin finished playback: ask the manager thread to put it back
+     * into the pool, since we can't from the sync message handler */
     ca_mutex_lock(p->outstanding_mutex);
-    if (!out->dead)
-        send_eos_msg(out, err);
+    if (s->outstanding && !s->outstanding->dead)
+        send_eos_msg(s->outstanding, err);
     ca_mutex_unlock(p->outstanding_mutex);
 
-    return GST_BUS_PASS;
-}
-
-struct ca_sound_file {
-    GstElement *fdsrc;
-};
-
-static int ca_gst_sound_file_open(ca_sound_file **_f, const char *fn) {
-    int fd;
-    ca_sound_file *f;
-
-    ca_return_val_if_fail(_f, CA_ERROR_INVALID);
-    ca_return_val_if_fail(fn, CA_ERROR_INVALID);
-
-    if ((fd = open(fn, O_RDONLY)) == -1)
-        return errno == ENOENT ? CA_ERROR_NOTFOUND : CA_ERROR_SYSTEM;
-
-    if (!(f = ca_new0(ca_sound_file, 1)))
-        return CA_ERROR_OOM;
-
-    if (!(f->fdsrc = gst_element_factory_make("fdsrc", NULL))) {
-        ca_free(f);
-        return CA_ERROR_OOM;
-    }
-
-    g_object_set(GST_OBJECT(f->fdsrc), "fd", fd, NULL);
-    *_f = f;
-
-    return CA_SUCCESS;
-}
-
-static void on_pad_added(GstElement *element, GstPad *pad, gboolean arg1, gpointer data)
-{
-    GstStructure *structure;
-    GstElement *sinkelement;
-    GstCaps *caps;
-    GstPad *vpad;
-    const char *type;
-
-    sinkelement = GST_ELEMENT(data);
-
-    caps = gst_pad_get_caps(pad);
-    if (gst_caps_is_empty(caps) || gst_caps_is_any(caps)) {
-        gst_caps_unref(caps);
-        return;
-    }
-
-    structure = gst_caps_get_structure(caps, 0);
-    type = gst_structure_get_name(structure);
-    if (g_str_has_prefix(type, "audio/x-raw") == TRUE) {
-        vpad = gst_element_get_pad(sinkelement, "sink");
-        gst_pad_link(pad, vpad);
-        gst_object_unref(vpad);
-    }
-    gst_caps_unref(caps);
+    return GST_BUS_DROP;
 }
 
 static void
@@ -328,7 +515,7 @@ send_mgr_exit_msg (struct private *p) {
     gst_bus_post (p->mgr_bus, m);
 }
 
-/* Global manager thread that shuts down GStreamer pipelines when ordered */
+/* Global manager thread that stops GStreamer pipelines when ordered */
 static void* thread_func(void *userdata) {
     struct private *p = userdata;
     GstBus *bus = g_object_ref(p->mgr_bus);
@@ -341,6 +528,8 @@ static void* thread_func(void *userdata) {
         const GstStructure *s;
         const GValue *v;
         struct outstanding *out;
+        struct slot *slot;
+        ca_bool_t reuse;
 
         if (m == NULL)
             break;
@@ -361,22 +550,31 @@ static void* thread_func(void *userdata) {
         ca_assert(v);
         out = g_value_get_pointer(v);
         ca_assert(out);
-
-        /* Set pipeline back to NULL to close things. By the time this
-         * completes, we can be sure bus_cb won't be called */
-        if (gst_element_set_state(out->pipeline, GST_STATE_NULL) ==
-                GST_STATE_CHANGE_FAILURE) {
-            gst_message_unref (m);
-            break;
-        }
-        if (out->callback)
+        slot = out->slot;
+        ca_assert(slot);
+
+        /* Set the pipeline back to NULL to stop it and close the
+         * device. By the time this completes, we can be sure the
+         * streaming thread is gone, so nobody is reading from the
+         * file anymore. If that fails we don't put the pipeline back
+         * into the pool. */
+        reuse = gst_element_set_state(slot->pipeline, GST_STATE_NULL) != GST_STATE_CHANGE_FAILURE;
+
+        if (out->callback) {
+            CA_PROBE4(callback, "gstreamer", out->context, out->id, out->err);
             out->callback(out->context, out->id, out->err, out->userdata);
+        }
 
         ca_mutex_lock(p->outstanding_mutex);
         CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+        out->slot = NULL;
         outstanding_free(out);
+        reuse = slot_release(p, slot, reuse);
         ca_mutex_unlock(p->outstanding_mutex);
 
+        if (!reuse)
+            slot_free(slot);
+
         gst_message_unref(m);
     } while (TRUE);
 
@@ -392,121 +590,148 @@ static void* thread_func(void *userdata) {
     return NULL;
 }
 
+static GstCaps *make_caps(ca_sound_file *f) {
+    ca_assert(f);
+
+    switch (ca_sound_file_get_sample_type(f)) {
+        case CA_SAMPLE_U8:
+            return gst_caps_new_simple("audio/x-raw-int",
+                                       "width", G_TYPE_INT, 8,
+                                       "depth", G_TYPE_INT, 8,
+                                       "signed", G_TYPE_BOOLEAN, FALSE,
+                                       "rate", G_TYPE_INT, (gint) ca_sound_file_get_rate(f),
+                                       "channels", G_TYPE_INT, (gint) ca_sound_file_get_nchannels(f),
+                                       NULL);
+
+        case CA_SAMPLE_S16NE:
+        case CA_SAMPLE_S16RE:
+            return gst_caps_new_simple("audio/x-raw-int",
+                                       "width", G_TYPE_INT, 16,
+                                       "depth", G_TYPE_INT, 16,
+                                       "signed", G_TYPE_BOOLEAN, TRUE,
+                                       "endianness", G_TYPE_INT,
+                                       ca_sound_file_get_sample_type(f) == CA_SAMPLE_S16NE ? G_BYTE_ORDER :
+                                       (G_BYTE_ORDER == G_LITTLE_ENDIAN ? G_BIG_ENDIAN : G_LITTLE_ENDIAN),
+                                       "rate", G_TYPE_INT, (gint) ca_sound_file_get_rate(f),
+                                       "channels", G_TYPE_INT, (gint) ca_sound_file_get_nchannels(f),
+                                       NULL);
+    }
+
+    return NULL;
+}
 
 int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
     struct private *p;
     struct outstanding *out;
+    struct slot *s;
     ca_sound_file *f;
-    GstElement *decodebin, *sink, *audioconvert, *audioresample, *abin;
-    GstBus *bus;
-    GstPad *audiopad;
+    GstCaps *caps;
+    ca_latency_t latency;
+    unsigned usec;
     int ret;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
     ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+    ca_return_val_if_fail(PRIVATE(c), CA_ERROR_STATE);
 
     out = NULL;
+    s = NULL;
     f = NULL;
-    sink = NULL;
-    decodebin = NULL;
-    audioconvert = NULL;
-    audioresample = NULL;
-    abin = NULL;
     p = PRIVATE(c);
 
-    if ((ret = ca_lookup_sound_with_callback(&f, ca_gst_sound_file_open, NULL, &p->theme, c->props, proplist)) < 0)
+    if ((ret = ca_get_latency(&latency, c->props, proplist)) < 0)
         goto fail;
 
-    if (!(out = ca_new0(struct outstanding, 1)))
-        return CA_ERROR_OOM;
-
-    out->id = id;
-    out->callback = cb;
-    out->userdata = userdata;
-    out->context = c;
-
-    if (!(out->pipeline = gst_pipeline_new(NULL))
-        || !(decodebin = gst_element_factory_make("decodebin2", NULL))
-        || !(audioconvert = gst_element_factory_make("audioconvert", NULL))
-        || !(audioresample = gst_element_factory_make("audioresample", NULL))
-        || !(sink = gst_element_factory_make("autoaudiosink", NULL))
-        || !(abin = gst_bin_new ("audiobin"))) {
-
-        /* At this point, if there is a failure, free each plugin separately. */
-        if (out->pipeline != NULL)
-           g_object_unref (out->pipeline);
-        if (decodebin != NULL)
-           g_object_unref(decodebin);
-        if (audioconvert != NULL)
-           g_object_unref(audioconvert);
-        if (audioresample != NULL)
-           g_object_unref(audioresample);
-        if (sink != NULL)
-           g_object_unref(sink);
-        if (abin != NULL)
-           g_object_unref(abin);
+    /* We decode ourselves and feed the pipeline through appsrc, so
+     * that no typefinding and autoplugging needs to happen here */
+    if ((ret = ca_lookup_sound(&f, NULL, &p->theme, c->props, proplist)) < 0)
+        goto fail;
 
-        ca_free(out);
+    if (!(caps = make_caps(f))) {
+        ret = CA_ERROR_NOTSUPPORTED;
+        goto fail;
+    }
 
+    if (!(out = ca_new0(struct outstanding, 1))) {
+        gst_caps_unref(caps);
         ret = CA_ERROR_OOM;
         goto fail;
     }
 
-    bus = gst_pipeline_get_bus(GST_PIPELINE (out->pipeline));
-    gst_bus_set_sync_handler(bus, bus_cb, out);
-    gst_object_unref(bus);
-
-    g_signal_connect(decodebin, "new-decoded-pad",
-                     G_CALLBACK (on_pad_added), abin);
-    gst_bin_add_many(GST_BIN (abin), audioconvert, audioresample, sink, NULL);
-    gst_element_link_many(audioconvert, audioresample, sink, NULL);
+    out->id = id;
+    out->callback = cb;
+    out->userdata = userdata;
+    out->context = c;
 
-    audiopad = gst_element_get_pad(audioconvert, "sink");
-    gst_element_add_pad(abin, gst_ghost_pad_new("sink", audiopad));
-    gst_object_unref(audiopad);
+    ca_mutex_lock(p->outstanding_mutex);
+    if ((s = p->pool)) {
+        CA_LLIST_REMOVE(struct slot, p->pool, s);
+        p->n_pool--;
+    }
+    ca_mutex_unlock(p->outstanding_mutex);
 
-    gst_bin_add_many(GST_BIN (out->pipeline),
-                     f->fdsrc, decodebin, abin, NULL);
-    if (!gst_element_link(f->fdsrc, decodebin)) {
-        /* Bin now owns the fdsrc... */
-        f->fdsrc = NULL;
+    /* All pipelines are busy, so let's create a new one, which we
+     * will keep if the pool is not full when it is done */
+    if (!s)
+        if ((ret = slot_new(&s, p)) < 0) {
+            gst_caps_unref(caps);
+            goto fail;
+        }
 
-        outstanding_free(out);
-        ret = CA_ERROR_OOM;
-        goto fail;
-    }
-    /* Bin now owns the fdsrc... */
-    f->fdsrc = NULL;
+    g_object_set(s->appsrc, "caps", caps, NULL);
+    gst_caps_unref(caps);
 
-    ca_free(f);
+    /* The sink is usually only created when the pipeline is brought
+     * up below, on_sink_element_added() applies this then */
+    if ((usec = ca_latency_usec(latency)) > 0) {
+        s->buffer_time = (gint64) usec;
+        s->latency_time = (gint64) (usec / CA_LATENCY_PERIODS);
+    } else
+        s->buffer_time = s->latency_time = 0;
+
+    slot_apply_latency(s);
+
+    /* The slot now owns the file */
+    s->file = f;
+    s->frame_size = ca_sound_file_frame_size(f);
+    s->rate = ca_sound_file_get_rate(f);
+    s->offset = 0;
+    s->context = c;
+    s->id = id;
     f = NULL;
 
     ca_mutex_lock(p->outstanding_mutex);
+    s->outstanding = out;
+    out->slot = s;
     CA_LLIST_PREPEND(struct outstanding, p->outstanding, out);
     ca_mutex_unlock(p->outstanding_mutex);
 
-    if (gst_element_set_state(out->pipeline,
+    if (gst_element_set_state(s->pipeline,
                               GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
-        ret = CA_ERROR_NOTAVAILABLE;
-        goto fail;
+
+        /* Let the manager thread clean this up */
+        ca_mutex_lock(p->outstanding_mutex);
+        if (!out->dead)
+            send_eos_msg(out, CA_ERROR_NOTAVAILABLE);
+        ca_mutex_unlock(p->outstanding_mutex);
     }
 
     return CA_SUCCESS;
 
 fail:
-    if (f && f->fdsrc)
-        gst_object_unref(f->fdsrc);
+    if (out)
+        outstanding_free(out);
 
     if (f)
-        ca_free(f);
+        ca_sound_file_close(f);
 
     return ret;
 }
 
 int driver_cancel(ca_context *c, uint32_t id) {
     struct private *p;
-    struct outstanding *out = NULL;
+    struct outstanding *out;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(PRIVATE(c), CA_ERROR_STATE);
@@ -515,34 +740,20 @@ int driver_cancel(ca_context *c, uint32_t id) {
 
     ca_mutex_lock(p->outstanding_mutex);
 
-    for (out = p->outstanding; out;/* out = out->next*/) {
-        struct outstanding *next;
+    /* Stopping a pipeline waits for its streaming thread, which might
+     * be waiting for our lock in bus_cb(). Hence we leave that to the
+     * manager thread, which will call the callback, too. */
+    for (out = p->outstanding; out; out = out->next) {
 
-        if (out->id != id || out->pipeline == NULL || out->dead == TRUE)
-        {
-            out = out->next;
+        if (out->id != id || out->dead)
             continue;
-        }
 
-        if (gst_element_set_state(out->pipeline, GST_STATE_NULL) ==
-                GST_STATE_CHANGE_FAILURE) {
-            goto error;
-        }
-        if (out->callback)
-            out->callback(c, out->id, CA_ERROR_CANCELED, out->userdata);
-        next = out->next;
-        CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
-        outstanding_free(out);
-        out = next;
+        send_eos_msg(out, CA_ERROR_CANCELED);
     }
 
     ca_mutex_unlock(p->outstanding_mutex);
 
     return CA_SUCCESS;
-
-error:
-    ca_mutex_unlock(p->outstanding_mutex);
-    return CA_ERROR_SYSTEM;
 }
 
 int driver_cache(ca_context *c, ca_proplist *proplist) {
@@ -552,3 +763,12 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
 
     return CA_ERROR_NOTSUPPORTED;
 }
+
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+    ca_return_val_if_fail(PRIVATE(c), CA_ERROR_STATE);
+
+    return CA_ERROR_NOTSUPPORTED;
+}
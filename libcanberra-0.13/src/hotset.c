@@ -0,0 +1,494 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "canberra.h"
+#include "hotset.h"
+#include "prefetch.h"
+#include "sound-theme-spec.h"
+#include "malloc.h"
+#include "macro.h"
+
+#define FILENAME "event-sound-hotset"
+#define HEADER "# libcanberra event sound hot set\n"
+
+/* Longest event id we bother to remember */
+#define EVENT_ID_MAX 255U
+
+/* We keep some slack over what we save, so that new entries have a
+ * chance to overtake old ones */
+#define N_ENTRIES (CA_HOTSET_MAX*2U)
+
+struct entry {
+    char *id;
+
+    /* Score loaded from disk, and how often it was played since */
+    unsigned prev;
+    unsigned count;
+};
+
+struct ca_hotset {
+    char *path;
+
+    struct entry entries[N_ENTRIES];
+    unsigned n_entries;
+
+    ca_bool_t dirty;
+    time_t saved;
+};
+
+/* The file contents, ready to be written by whoever gets to it */
+struct ca_hotset_snapshot {
+    char *path;
+    char *data;
+};
+
+static unsigned entry_score(const struct entry *e) {
+    /* Every session halves the weight of older plays so that the set
+     * follows changes in what the application actually does */
+    return e->prev / 2U + e->count;
+}
+
+static int entry_compare(const void *a, const void *b) {
+    const struct entry *x = a, *y = b;
+    unsigned sx, sy;
+
+    sx = entry_score(x);
+    sy = entry_score(y);
+
+    if (sx != sy)
+        return sx > sy ? -1 : 1;
+
+    /* Among equals prefer what was popular last time */
+    if (x->prev != y->prev)
+        return x->prev > y->prev ? -1 : 1;
+
+    return 0;
+}
+
+static ca_bool_t valid_event_id(const char *id) {
+    const char *p;
+
+    if (!*id)
+        return FALSE;
+
+    for (p = id; *p; p++)
+        if (*p == '\n' || *p == '\r')
+            return FALSE;
+
+    return (size_t) (p - id) <= EVENT_ID_MAX;
+}
+
+static char *get_path(ca_proplist *cp) {
+    const char *app_id;
+    char *c, *n, *p;
+
+    ca_mutex_lock(cp->mutex);
+
+    if (!(app_id = ca_proplist_gets_unlocked(cp, CA_PROP_APPLICATION_ID)) || !*app_id) {
+        ca_mutex_unlock(cp->mutex);
+        return NULL;
+    }
+
+    n = ca_strdup(app_id);
+    ca_mutex_unlock(cp->mutex);
+
+    if (!n)
+        return NULL;
+
+    /* The application id ends up in a file name, so let's make sure
+     * it cannot escape the cache directory */
+    for (p = n; *p; p++)
+        if (!((*p >= 'a' && *p <= 'z') ||
+              (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') ||
+              *p == '.' || *p == '-' || *p == '_'))
+            *p = '_';
+
+    if (ca_get_cache_home(&c) < 0 || !c) {
+        ca_free(n);
+        return NULL;
+    }
+
+    p = ca_sprintf_malloc("%s/" FILENAME ".%s", c, n);
+    ca_free(c);
+    ca_free(n);
+
+    return p;
+}
+
+static void read_file(ca_hotset *h) {
+    FILE *f;
+    char line[EVENT_ID_MAX + 32];
+
+    if (!(f = fopen(h->path, "r")))
+        return;
+
+    while (h->n_entries < CA_HOTSET_MAX && fgets(line, sizeof(line), f)) {
+        char *e, *id;
+        unsigned long score;
+        size_t l;
+
+        if (line[0] == '#')
+            continue;
+
+        l = strlen(line);
+        if (l <= 0 || line[l-1] != '\n')
+            /* Overly long or truncated line, skip it */
+            continue;
+        line[l-1] = 0;
+
+        score = strtoul(line, &e, 10);
+        if (e == line || *e != ' ' || score <= 0 || score > 0xFFFFU)
+            continue;
+
+        id = e + 1;
+        if (!valid_event_id(id))
+            continue;
+
+        if (!(h->entries[h->n_entries].id = ca_strdup(id)))
+            break;
+
+        h->entries[h->n_entries].prev = (unsigned) score;
+        h->entries[h->n_entries].count = 0;
+        h->n_entries++;
+    }
+
+    fclose(f);
+
+    qsort(h->entries, h->n_entries, sizeof(struct entry), entry_compare);
+}
+
+int ca_hotset_load(ca_hotset **_h, ca_proplist *cp) {
+    ca_hotset *h;
+
+    ca_return_val_if_fail(_h, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+
+    *_h = NULL;
+
+    if (!(h = ca_new0(ca_hotset, 1)))
+        return CA_ERROR_OOM;
+
+    /* Without an application id or cache directory there is nothing
+     * we could key the set by */
+    if (!(h->path = get_path(cp))) {
+        ca_free(h);
+        return CA_ERROR_NOTFOUND;
+    }
+
+    read_file(h);
+    h->saved = time(NULL);
+
+    *_h = h;
+    return CA_SUCCESS;
+}
+
+void ca_hotset_record(ca_hotset *h, const char *event_id) {
+    unsigned i, j;
+
+    ca_return_if_fail(h);
+    ca_return_if_fail(event_id);
+
+    for (i = 0; i < h->n_entries; i++)
+        if (ca_streq(h->entries[i].id, event_id)) {
+            if (h->entries[i].count < 0xFFFFU)
+                h->entries[i].count++;
+            h->dirty = TRUE;
+            return;
+        }
+
+    if (!valid_event_id(event_id))
+        return;
+
+    if (h->n_entries < N_ENTRIES)
+        j = h->n_entries++;
+    else {
+        /* Replace the weakest entry that hasn't been played in this
+         * session yet. If all have been, give up on this one. */
+        j = N_ENTRIES;
+
+        for (i = 0; i < h->n_entries; i++)
+            if (h->entries[i].count <= 0 &&
+                (j >= N_ENTRIES || entry_score(&h->entries[i]) < entry_score(&h->entries[j])))
+                j = i;
+
+        if (j >= N_ENTRIES)
+            return;
+
+        ca_free(h->entries[j].id);
+        h->entries[j].id = NULL;
+    }
+
+    if (!(h->entries[j].id = ca_strdup(event_id))) {
+        if (j == h->n_entries - 1)
+            h->n_entries--;
+        else
+            h->entries[j] = h->entries[--h->n_entries];
+        return;
+    }
+
+    h->entries[j].prev = 0;
+    h->entries[j].count = 1;
+    h->dirty = TRUE;
+}
+
+int ca_hotset_prefetch(ca_hotset *h, ca_proplist *cp) {
+    ca_proplist *sp[CA_HOTSET_MAX];
+    unsigned i, n = 0;
+    int ret = CA_SUCCESS;
+
+    ca_return_val_if_fail(h, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+
+    /* Only what we loaded from disk is worth warming up, the entries
+     * are still sorted by their previous score at this point */
+    for (i = 0; i < h->n_entries && n < CA_HOTSET_MAX; i++) {
+
+        if (h->entries[i].prev <= 0)
+            continue;
+
+        if ((ret = ca_proplist_create(&sp[n])) < 0)
+            goto finish;
+
+        n++;
+
+        if ((ret = ca_proplist_sets(sp[n-1], CA_PROP_EVENT_ID, h->entries[i].id)) < 0)
+            goto finish;
+    }
+
+    /* One worker is enough, this is not supposed to compete with the
+     * application's own startup */
+    if (n > 0)
+        ret = ca_prefetch(cp, sp, n, 1, NULL, NULL, NULL, NULL);
+
+finish:
+
+    for (i = 0; i < n; i++)
+        ca_assert_se(ca_proplist_destroy(sp[i]) == CA_SUCCESS);
+
+    return ret;
+}
+
+static void snapshot_free(ca_hotset_snapshot *s) {
+    ca_assert(s);
+
+    ca_free(s->path);
+    ca_free(s->data);
+    ca_free(s);
+}
+
+static ca_hotset_snapshot *snapshot_new(ca_hotset *h) {
+    ca_hotset_snapshot *s;
+    struct entry sorted[N_ENTRIES];
+    size_t l;
+    char *d;
+    unsigned i;
+
+    memcpy(sorted, h->entries, sizeof(struct entry) * h->n_entries);
+    qsort(sorted, h->n_entries, sizeof(struct entry), entry_compare);
+
+    l = sizeof(HEADER);
+    for (i = 0; i < h->n_entries && i < CA_HOTSET_MAX; i++)
+        l += 10 + 1 + strlen(sorted[i].id) + 1;
+
+    if (!(s = ca_new0(ca_hotset_snapshot, 1)))
+        return NULL;
+
+    if (!(s->path = ca_strdup(h->path)) ||
+        !(s->data = ca_new(char, l))) {
+        snapshot_free(s);
+        return NULL;
+    }
+
+    strcpy(s->data, HEADER);
+    d = s->data + sizeof(HEADER) - 1;
+
+    for (i = 0; i < h->n_entries && i < CA_HOTSET_MAX; i++) {
+        unsigned score;
+
+        if ((score = entry_score(&sorted[i])) <= 0)
+            break;
+
+        d += sprintf(d, "%u %s\n", score, sorted[i].id);
+    }
+
+    return s;
+}
+
+static int snapshot_write(ca_hotset_snapshot *s) {
+    char *tmp = NULL, *c;
+    FILE *f = NULL;
+    int ret;
+
+    ca_assert(s);
+
+    /* Try to create, just in case it doesn't exist yet. We don't do
+     * this recursively however. */
+    if ((ret = ca_get_cache_home(&c)) < 0)
+        return ret;
+    if (c) {
+        mkdir(c, 0755);
+        ca_free(c);
+    }
+
+    /* Several snapshots of the same set might be written at the same
+     * time, hence the temporary file is named after the snapshot */
+    if (!(tmp = ca_sprintf_malloc("%s.tmp.%lu.%p", s->path, (unsigned long) getpid(), (void*) s))) {
+        ret = CA_ERROR_OOM;
+        goto finish;
+    }
+
+    if (!(f = fopen(tmp, "w"))) {
+        ret = CA_ERROR_ACCESS;
+        goto finish;
+    }
+
+    fputs(s->data, f);
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        ret = CA_ERROR_IO;
+        goto finish;
+    }
+    f = NULL;
+
+    /* Atomically replace the old set, so that a concurrently
+     * starting instance never sees a partial file */
+    if (rename(tmp, s->path) < 0) {
+        ret = CA_ERROR_ACCESS;
+        goto finish;
+    }
+
+    ca_free(tmp);
+    tmp = NULL;
+
+    ret = CA_SUCCESS;
+
+finish:
+
+    if (f)
+        fclose(f);
+
+    if (tmp) {
+        unlink(tmp);
+        ca_free(tmp);
+    }
+
+    return ret;
+}
+
+ca_hotset_snapshot *ca_hotset_snapshot_take(ca_hotset *h) {
+    ca_hotset_snapshot *s;
+    time_t now;
+
+    ca_return_null_if_fail(h);
+
+    if (!h->dirty)
+        return NULL;
+
+    now = time(NULL);
+    if (now >= h->saved && now < h->saved + CA_HOTSET_SAVE_INTERVAL_SEC)
+        return NULL;
+
+    /* Also if we fail, so that we don't retry on every play */
+    h->saved = now;
+
+    if (!(s = snapshot_new(h)))
+        return NULL;
+
+    /* If the write fails the next change will try again */
+    h->dirty = FALSE;
+
+    return s;
+}
+
+static int save_item(unsigned idx, ca_theme_data **t, ca_proplist *cp, ca_proplist *sp, void *userdata) {
+    return snapshot_write(userdata);
+}
+
+static void save_finish(void *userdata) {
+    snapshot_free(userdata);
+}
+
+int ca_hotset_snapshot_save_async(ca_hotset_snapshot *s, ca_proplist *cp) {
+    ca_proplist *sp;
+    int ret;
+
+    ca_return_val_if_fail(s, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+
+    /* The prefetch workers want a sound to work on, an empty one is
+     * fine for save_item() */
+    if ((ret = ca_proplist_create(&sp)) < 0) {
+        snapshot_free(s);
+        return ret;
+    }
+
+    if ((ret = ca_prefetch(cp, &sp, 1, 1, save_item, NULL, save_finish, s)) < 0)
+        snapshot_free(s);
+
+    ca_assert_se(ca_proplist_destroy(sp) == CA_SUCCESS);
+
+    return ret;
+}
+
+int ca_hotset_save(ca_hotset *h) {
+    ca_hotset_snapshot *s;
+    int ret;
+
+    ca_return_val_if_fail(h, CA_ERROR_INVALID);
+
+    if (!h->dirty)
+        return CA_SUCCESS;
+
+    if (!(s = snapshot_new(h)))
+        return CA_ERROR_OOM;
+
+    if ((ret = snapshot_write(s)) == CA_SUCCESS)
+        h->dirty = FALSE;
+
+    snapshot_free(s);
+
+    return ret;
+}
+
+void ca_hotset_free(ca_hotset *h) {
+    unsigned i;
+
+    ca_return_if_fail(h);
+
+    for (i = 0; i < h->n_entries; i++)
+        ca_free(h->entries[i].id);
+
+    ca_free(h->path);
+    ca_free(h);
+}
@@ -0,0 +1,58 @@
+#ifndef foocanberrahotsethfoo
+#define foocanberrahotsethfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include "canberra.h"
+#include "proplist.h"
+
+/* Number of event sounds we remember per application */
+#define CA_HOTSET_MAX 32U
+
+/* Minimum time between two saves while the context is in use */
+#define CA_HOTSET_SAVE_INTERVAL_SEC 30
+
+/* Tracks which event sounds an application plays most often, so that
+ * the next time it opens a context we can resolve and decode them in
+ * the background before they are actually needed. The set is keyed
+ * by CA_PROP_APPLICATION_ID and stored in the cache directory. Not
+ * thread-safe, the caller has to serialize access.
+ *
+ * While the context is in use the set is saved from time to time on
+ * a prefetch worker: ca_hotset_snapshot_take() is cheap and done with
+ * the lock held, ca_hotset_snapshot_save_async() hands the copy to a
+ * worker and needs no lock. Many contexts, like canberra-gtk's, live
+ * until the process exits, so we can't rely on ca_hotset_save() being
+ * called on destruction. */
+
+typedef struct ca_hotset ca_hotset;
+typedef struct ca_hotset_snapshot ca_hotset_snapshot;
+
+int ca_hotset_load(ca_hotset **h, ca_proplist *cp);
+void ca_hotset_record(ca_hotset *h, const char *event_id);
+int ca_hotset_prefetch(ca_hotset *h, ca_proplist *cp);
+int ca_hotset_save(ca_hotset *h);
+
+ca_hotset_snapshot *ca_hotset_snapshot_take(ca_hotset *h);
+int ca_hotset_snapshot_save_async(ca_hotset_snapshot *s, ca_proplist *cp);
+void ca_hotset_free(ca_hotset *h);
+
+#endif
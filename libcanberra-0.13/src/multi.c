@@ -330,3 +330,45 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
 
     return ret;
 }
+
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
+    int ret = CA_SUCCESS;
+    struct private *p;
+    struct backend *b;
+    struct closure *closure;
+
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+    ca_return_val_if_fail(c->private, CA_ERROR_STATE);
+
+    p = PRIVATE(c);
+
+    if (cb) {
+        if (!(closure = ca_new(struct closure, 1)))
+            return CA_ERROR_OOM;
+
+        closure->context = c;
+        closure->callback = cb;
+        closure->userdata = userdata;
+    } else
+        closure = NULL;
+
+    /* The first backend that can cache this, takes it. We talk to the
+     * backend drivers directly, since ca_context_cache_many() would
+     * turn their CA_ERROR_NOTSUPPORTED into success. */
+    for (b = p->backends; b; b = b->next) {
+        int r;
+
+        if ((r = ca_context_driver_cache_async(b->context, proplist, closure ? call_closure : NULL, closure)) == CA_SUCCESS)
+            return r;
+
+        /* We only return the first failure */
+        if (ret == CA_SUCCESS)
+            ret = r;
+    }
+
+    ca_free(closure);
+
+    return ret;
+}
@@ -27,6 +27,7 @@
 #include "canberra.h"
 #include "common.h"
 #include "driver.h"
+#include "probes.h"
 
 int driver_open(ca_context *c) {
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
@@ -60,8 +61,10 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
     ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
     ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
 
-    if (cb)
+    if (cb) {
+        CA_PROBE4(callback, "null", c, id, CA_SUCCESS);
         cb(c, id, CA_SUCCESS, userdata);
+    }
 
     return CA_SUCCESS;
 }
@@ -78,3 +81,11 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
 
     return CA_ERROR_NOTSUPPORTED;
 }
+
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+
+    return CA_ERROR_NOTSUPPORTED;
+}
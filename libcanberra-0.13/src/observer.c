@@ -0,0 +1,444 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "canberra.h"
+#include "common.h"
+#include "observer.h"
+#include "proplist.h"
+#include "malloc.h"
+#include "macro.h"
+#include "mutex.h"
+#include "llist.h"
+
+struct observer {
+    ca_play_observer_t callback;
+    void *userdata;
+    int flags;
+};
+
+struct ca_observer_set {
+    unsigned ref;
+    unsigned long generation;
+    struct ca_observer_sync *sync;
+    CA_LLIST_FIELDS(ca_observer_set);
+
+    unsigned n_observers;
+    ca_bool_t any_async;
+    struct observer observers[];
+};
+
+struct event {
+    ca_observer_set *set;
+    uint32_t id;
+    int error;
+    ca_proplist *p;
+    CA_LLIST_FIELDS(struct event);
+};
+
+/* Every set somebody still holds a reference to is on the live list,
+ * oldest first. Only the newest set of a context ever gains new
+ * references, hence once no set older than generation G is alive
+ * anymore, nobody can be running or have queued an observer that was
+ * left out of the set of generation G. */
+struct ca_observer_sync {
+    /* Protected by the context mutex */
+    unsigned long next_generation;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    /* Protected by mutex */
+    CA_LLIST_HEAD(ca_observer_set, live);
+};
+
+/* Asynchronous observers are called from one thread per context */
+struct ca_observer_queue {
+    ca_context *context;
+    ca_mutex *mutex;
+
+    sem_t semaphore;
+    pthread_t thread;
+
+    /* Protected by mutex */
+    CA_LLIST_HEAD(struct event, events);
+    struct event *events_tail;
+    ca_bool_t quit;
+};
+
+ca_observer_set* ca_observer_set_ref(ca_observer_set *s) {
+    ca_assert(s);
+
+    __sync_add_and_fetch(&s->ref, 1);
+    return s;
+}
+
+static void observer_set_unref(ca_observer_set *s) {
+    struct ca_observer_sync *y;
+
+    ca_assert(s);
+
+    if (__sync_sub_and_fetch(&s->ref, 1) > 0)
+        return;
+
+    y = s->sync;
+
+    pthread_mutex_lock(&y->mutex);
+    CA_LLIST_REMOVE(ca_observer_set, y->live, s);
+    pthread_cond_broadcast(&y->cond);
+    pthread_mutex_unlock(&y->mutex);
+
+    ca_free(s);
+}
+
+void ca_observers_synchronize(ca_context *c, unsigned long generation) {
+    struct ca_observer_sync *y;
+
+    ca_assert(c);
+    ca_assert(c->observer_sync);
+
+    y = c->observer_sync;
+
+    /* This is our grace period, it only lasts as long as the
+     * observers that are already running or queued take */
+    pthread_mutex_lock(&y->mutex);
+
+    while (y->live && y->live->generation < generation)
+        pthread_cond_wait(&y->cond, &y->mutex);
+
+    pthread_mutex_unlock(&y->mutex);
+}
+
+static int sync_new(ca_context *c) {
+    struct ca_observer_sync *y;
+
+    if (!(y = ca_new0(struct ca_observer_sync, 1)))
+        return CA_ERROR_OOM;
+
+    if (pthread_mutex_init(&y->mutex, NULL) != 0) {
+        ca_free(y);
+        return CA_ERROR_OOM;
+    }
+
+    if (pthread_cond_init(&y->cond, NULL) != 0) {
+        pthread_mutex_destroy(&y->mutex);
+        ca_free(y);
+        return CA_ERROR_OOM;
+    }
+
+    c->observer_sync = y;
+    return CA_SUCCESS;
+}
+
+static void sync_free(struct ca_observer_sync *y) {
+    ca_assert(y);
+    ca_assert(!y->live);
+
+    pthread_cond_destroy(&y->cond);
+    pthread_mutex_destroy(&y->mutex);
+    ca_free(y);
+}
+
+/* Called with c->mutex held */
+static ca_observer_set* observer_set_new(ca_context *c, unsigned n) {
+    struct ca_observer_sync *y = c->observer_sync;
+    ca_observer_set *s, *last;
+
+    if (!(s = ca_malloc(sizeof(ca_observer_set) + sizeof(struct observer) * n)))
+        return NULL;
+
+    s->ref = 1;
+    s->generation = y->next_generation++;
+    s->sync = y;
+    s->n_observers = n;
+    s->any_async = FALSE;
+
+    /* Sets are created in the order of their generations, so
+     * appending keeps the live list sorted */
+    pthread_mutex_lock(&y->mutex);
+
+    for (last = y->live; last && last->next; last = last->next)
+        ;
+
+    s->prev = last;
+    s->next = NULL;
+
+    if (last)
+        last->next = s;
+    else
+        y->live = s;
+
+    pthread_mutex_unlock(&y->mutex);
+
+    return s;
+}
+
+static void* queue_thread(void *userdata) {
+    struct ca_observer_queue *q = userdata;
+
+    for (;;) {
+        struct event *e;
+        unsigned i;
+
+        sem_wait(&q->semaphore);
+
+        ca_mutex_lock(q->mutex);
+
+        if ((e = q->events)) {
+            CA_LLIST_REMOVE(struct event, q->events, e);
+
+            if (q->events_tail == e)
+                q->events_tail = NULL;
+
+        } else if (q->quit) {
+            ca_mutex_unlock(q->mutex);
+            break;
+        }
+
+        ca_mutex_unlock(q->mutex);
+
+        if (!e)
+            continue;
+
+        for (i = 0; i < e->set->n_observers; i++)
+            if (e->set->observers[i].flags & CA_PLAY_OBSERVER_ASYNC)
+                e->set->observers[i].callback(q->context, e->id, e->p, e->error, e->set->observers[i].userdata);
+
+        ca_proplist_destroy(e->p);
+        observer_set_unref(e->set);
+        ca_free(e);
+    }
+
+    return NULL;
+}
+
+static int queue_new(ca_context *c) {
+    struct ca_observer_queue *q;
+
+    if (!(q = ca_new0(struct ca_observer_queue, 1)))
+        return CA_ERROR_OOM;
+
+    q->context = c;
+
+    if (!(q->mutex = ca_mutex_new())) {
+        ca_free(q);
+        return CA_ERROR_OOM;
+    }
+
+    if (sem_init(&q->semaphore, 0, 0) < 0) {
+        ca_mutex_free(q->mutex);
+        ca_free(q);
+        return CA_ERROR_OOM;
+    }
+
+    if (pthread_create(&q->thread, NULL, queue_thread, q) != 0) {
+        sem_destroy(&q->semaphore);
+        ca_mutex_free(q->mutex);
+        ca_free(q);
+        return CA_ERROR_OOM;
+    }
+
+    c->observer_queue = q;
+    return CA_SUCCESS;
+}
+
+static void queue_free(struct ca_observer_queue *q) {
+    ca_assert(q);
+
+    /* Whatever is queued still gets delivered */
+    ca_mutex_lock(q->mutex);
+    q->quit = TRUE;
+    ca_mutex_unlock(q->mutex);
+
+    sem_post(&q->semaphore);
+    pthread_join(q->thread, NULL);
+
+    ca_assert(!q->events);
+
+    sem_destroy(&q->semaphore);
+    ca_mutex_free(q->mutex);
+    ca_free(q);
+}
+
+static void queue_push(struct ca_observer_queue *q, ca_observer_set *s, uint32_t id, ca_proplist *p, int error) {
+    struct event *e;
+
+    if (!(e = ca_new0(struct event, 1)))
+        goto fail;
+
+    /* The caller may free or change its property list as soon as
+     * ca_context_play() returns */
+    if (ca_proplist_copy(&e->p, p) < 0) {
+        ca_free(e);
+        goto fail;
+    }
+
+    e->set = s;
+    e->id = id;
+    e->error = error;
+
+    ca_mutex_lock(q->mutex);
+    CA_LLIST_INSERT_AFTER(struct event, q->events, q->events_tail, e);
+    q->events_tail = e;
+    ca_mutex_unlock(q->mutex);
+
+    sem_post(&q->semaphore);
+    return;
+
+fail:
+    /* We have no way to report this, the event is lost for the
+     * asynchronous observers */
+    observer_set_unref(s);
+}
+
+int ca_observers_add(ca_context *c, ca_play_observer_t cb, void *userdata, int flags) {
+    ca_observer_set *s, *old;
+    unsigned n;
+    int ret;
+
+    ca_assert(c);
+    ca_assert(cb);
+
+    if (!c->observer_sync)
+        if ((ret = sync_new(c)) < 0)
+            return ret;
+
+    if ((flags & CA_PLAY_OBSERVER_ASYNC) && !c->observer_queue)
+        if ((ret = queue_new(c)) < 0)
+            return ret;
+
+    old = c->observers;
+    n = old ? old->n_observers : 0;
+
+    if (!(s = observer_set_new(c, n + 1)))
+        return CA_ERROR_OOM;
+
+    if (old) {
+        memcpy(s->observers, old->observers, sizeof(struct observer) * n);
+        s->any_async = old->any_async;
+    }
+
+    s->observers[n].callback = cb;
+    s->observers[n].userdata = userdata;
+    s->observers[n].flags = flags;
+
+    if (flags & CA_PLAY_OBSERVER_ASYNC)
+        s->any_async = TRUE;
+
+    c->observers = s;
+
+    /* Adding never needs to wait for anybody, whoever still uses the
+     * old set is kept track of by the live list */
+    if (old)
+        observer_set_unref(old);
+
+    return CA_SUCCESS;
+}
+
+int ca_observers_remove(ca_context *c, ca_play_observer_t cb, void *userdata, unsigned long *generation) {
+    ca_observer_set *s = NULL, *old;
+    unsigned i, j, k;
+
+    ca_assert(c);
+    ca_assert(cb);
+    ca_assert(generation);
+
+    if (!(old = c->observers))
+        return CA_ERROR_NOTFOUND;
+
+    for (i = 0; i < old->n_observers; i++)
+        if (old->observers[i].callback == cb &&
+            old->observers[i].userdata == userdata)
+            break;
+
+    if (i >= old->n_observers)
+        return CA_ERROR_NOTFOUND;
+
+    if (old->n_observers > 1) {
+
+        if (!(s = observer_set_new(c, old->n_observers - 1)))
+            return CA_ERROR_OOM;
+
+        for (j = 0, k = 0; j < old->n_observers; j++) {
+            if (j == i)
+                continue;
+
+            s->observers[k] = old->observers[j];
+
+            if (s->observers[k].flags & CA_PLAY_OBSERVER_ASYNC)
+                s->any_async = TRUE;
+
+            k++;
+        }
+    }
+
+    c->observers = s;
+    observer_set_unref(old);
+
+    /* The caller needs to wait until every set older than the new one
+     * is gone, not just the one we replaced: earlier sets that an add
+     * replaced may still be in use and contain the observer, too */
+    *generation = s ? s->generation : c->observer_sync->next_generation;
+
+    return CA_SUCCESS;
+}
+
+void ca_observers_notify(ca_context *c, ca_observer_set *s, uint32_t id, ca_proplist *p, int error) {
+    unsigned i;
+
+    ca_assert(c);
+    ca_assert(s);
+    ca_assert(p);
+
+    for (i = 0; i < s->n_observers; i++)
+        if (!(s->observers[i].flags & CA_PLAY_OBSERVER_ASYNC))
+            s->observers[i].callback(c, id, p, error, s->observers[i].userdata);
+
+    /* The queue inherits our reference */
+    if (s->any_async && c->observer_queue)
+        queue_push(c->observer_queue, s, id, p, error);
+    else
+        observer_set_unref(s);
+}
+
+void ca_observers_free(ca_context *c) {
+    ca_assert(c);
+
+    if (c->observer_queue) {
+        queue_free(c->observer_queue);
+        c->observer_queue = NULL;
+    }
+
+    if (c->observers) {
+        observer_set_unref(c->observers);
+        c->observers = NULL;
+    }
+
+    if (c->observer_sync) {
+        sync_free(c->observer_sync);
+        c->observer_sync = NULL;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef foocanberraobserverhfoo
+#define foocanberraobserverhfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include "canberra.h"
+#include "common.h"
+
+/* The registered observers of a context are kept in an immutable,
+ * reference counted array. Registering or unregistering replaces the
+ * array as a whole under the context mutex, so that ca_context_play()
+ * only has to grab a reference to the current one and can call the
+ * observers after dropping the mutex. If nothing is registered the
+ * array pointer is NULL. Each array gets a generation number, and
+ * unregistering waits until all arrays older than the new one are
+ * unused. */
+
+typedef struct ca_observer_set ca_observer_set;
+
+/* Called with c->mutex held */
+int ca_observers_add(ca_context *c, ca_play_observer_t cb, void *userdata, int flags);
+int ca_observers_remove(ca_context *c, ca_play_observer_t cb, void *userdata, unsigned long *generation);
+ca_observer_set* ca_observer_set_ref(ca_observer_set *s);
+
+/* Called without c->mutex held */
+void ca_observers_notify(ca_context *c, ca_observer_set *s, uint32_t id, ca_proplist *p, int error);
+void ca_observers_synchronize(ca_context *c, unsigned long generation);
+void ca_observers_free(ca_context *c);
+
+#endif
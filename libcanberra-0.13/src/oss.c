@@ -27,12 +27,15 @@
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <math.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
-#include <poll.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -53,9 +56,13 @@
 #include "read-sound-file.h"
 #include "sound-theme-spec.h"
 #include "malloc.h"
+#include "probes.h"
 
 struct private;
 
+#define BUFSIZE (4*1024)
+#define N_EVENTS 16
+
 struct outstanding {
     CA_LLIST_FIELDS(struct outstanding);
     ca_bool_t dead;
@@ -64,8 +71,16 @@ struct outstanding {
     void *userdata;
     ca_sound_file *file;
     int pcm;
-    int pipe_fd[2];
     ca_context *context;
+
+    /* Only touched by the reactor thread */
+    int error;
+    ca_bool_t finished;
+    ca_bool_t draining;
+    uint64_t drain_until;
+    size_t nbytes;
+    uint8_t *d;
+    uint8_t data[BUFSIZE];
 };
 
 struct private {
@@ -74,20 +89,25 @@ struct private {
     ca_bool_t signal_semaphore;
     sem_t semaphore;
     ca_bool_t semaphore_allocated;
+
+    /* All streams of a context are driven by a single reactor
+     * thread waiting on epoll_fd. Writing to event_fd wakes it up. */
+    int epoll_fd;
+    int event_fd;
+
+    /* Everything below protected by the outstanding_mutex */
+    ca_bool_t reactor_running;
+    ca_bool_t quit;
     CA_LLIST_HEAD(struct outstanding, outstanding);
 };
 
 #define PRIVATE(c) ((struct private *) ((c)->private))
 
+static void* thread_func(void *userdata);
+
 static void outstanding_free(struct outstanding *o) {
     ca_assert(o);
 
-    if (o->pipe_fd[1] >= 0)
-        close(o->pipe_fd[1]);
-
-    if (o->pipe_fd[0] >= 0)
-        close(o->pipe_fd[0]);
-
     if (o->file)
         ca_sound_file_close(o->file);
 
@@ -99,8 +119,22 @@ static void outstanding_free(struct outstanding *o) {
     ca_free(o);
 }
 
+static void wakeup(struct private *p) {
+    uint64_t one = 1;
+
+    ca_assert(p);
+
+    /* Apart from EINTR this can only fail with EAGAIN if the counter
+     * is about to overflow, in which case the reactor is going to
+     * wake up anyway */
+    while (write(p->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
 int driver_open(ca_context *c) {
     struct private *p;
+    struct epoll_event ev;
+    pthread_t thread;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(!c->driver || ca_streq(c->driver, "oss"), CA_ERROR_NODRIVER);
@@ -109,6 +143,8 @@ int driver_open(ca_context *c) {
     if (!(c->private = p = ca_new0(struct private, 1)))
         return CA_ERROR_OOM;
 
+    p->epoll_fd = p->event_fd = -1;
+
     if (!(p->outstanding_mutex = ca_mutex_new())) {
         driver_destroy(c);
         return CA_ERROR_OOM;
@@ -121,6 +157,32 @@ int driver_open(ca_context *c) {
 
     p->semaphore_allocated = TRUE;
 
+    if ((p->epoll_fd = epoll_create(N_EVENTS)) < 0 ||
+        (p->event_fd = eventfd(0, 0)) < 0) {
+        driver_destroy(c);
+        return CA_ERROR_SYSTEM;
+    }
+
+    fcntl(p->epoll_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(p->event_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(p->event_fd, F_SETFL, O_NONBLOCK);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->event_fd, &ev) < 0) {
+        driver_destroy(c);
+        return CA_ERROR_SYSTEM;
+    }
+
+    if (pthread_create(&thread, NULL, thread_func, p) != 0) {
+        driver_destroy(c);
+        return CA_ERROR_OOM;
+    }
+
+    p->reactor_running = TRUE;
+
     return CA_SUCCESS;
 }
 
@@ -136,7 +198,7 @@ int driver_destroy(ca_context *c) {
     if (p->outstanding_mutex) {
         ca_mutex_lock(p->outstanding_mutex);
 
-        /* Tell all player threads to terminate */
+        /* Tell the reactor to drop all streams */
         for (out = p->outstanding; out; out = out->next) {
 
             if (out->dead)
@@ -144,20 +206,19 @@ int driver_destroy(ca_context *c) {
 
             out->dead = TRUE;
 
-            if (out->callback)
+            if (out->callback) {
+                CA_PROBE4(callback, "oss", c, out->id, CA_ERROR_DESTROYED);
                 out->callback(c, out->id, CA_ERROR_DESTROYED, out->userdata);
-
-            /* This will cause the thread to wakeup and terminate */
-            if (out->pipe_fd[1] >= 0) {
-                close(out->pipe_fd[1]);
-                out->pipe_fd[1] = -1;
             }
         }
-		// Sneaky comment
-        if (p->semaphore_allocated) {
-            /* Now wait until all players are destroyed */
+
+        if (p->reactor_running && p->semaphore_allocated) {
+            /* Now wait until the reactor has cleaned up and exited */
+            p->quit = TRUE;
             p->signal_semaphore = TRUE;
-            while (p->outstanding) {
+            wakeup(p);
+
+            while (p->reactor_running) {
                 ca_mutex_unlock(p->outstanding_mutex);
                 sem_wait(&p->semaphore);
                 ca_mutex_lock(p->outstanding_mutex);
@@ -168,6 +229,12 @@ int driver_destroy(ca_context *c) {
         ca_mutex_free(p->outstanding_mutex);
     }
 
+    if (p->event_fd >= 0)
+        close(p->event_fd);
+
+    if (p->epoll_fd >= 0)
+        close(p->epoll_fd);
+
     if (p->theme)
         ca_theme_data_free(p->theme);
 
@@ -203,6 +270,14 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
     return CA_ERROR_NOTSUPPORTED;
 }
 
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
+
+    return CA_ERROR_NOTSUPPORTED;
+}
+
 static int translate_error(int error) {
 
     switch (error) {
@@ -227,9 +302,10 @@ static int translate_error(int error) {
     }
 }
 
-static int open_oss(ca_context *c, struct outstanding *out) {
+static int open_oss(ca_context *c, struct outstanding *out, ca_latency_t latency) {
     struct private *p;
     int mode, val, test, ret;
+    unsigned usec;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(c->private, CA_ERROR_STATE);
@@ -244,14 +320,31 @@ static int open_oss(ca_context *c, struct outstanding *out) {
     if ((out->pcm = open(c->device ? c->device : "/dev/dsp", O_WRONLY | O_NONBLOCK, 0)) < 0)
         goto finish_errno;
 
-    if ((mode = fcntl(out->pcm, F_GETFL)) < 0)
+    /* We keep the device in non-blocking mode, since the reactor
+     * must never block on a single stream */
+    if ((mode = fcntl(out->pcm, F_GETFD)) < 0)
         goto finish_errno;
 
-    mode &= ~O_NONBLOCK;
-
-    if (fcntl(out->pcm, F_SETFL, mode) < 0)
+    if (fcntl(out->pcm, F_SETFD, mode | FD_CLOEXEC) < 0)
         goto finish_errno;
 
+    /* The fragment size has to be configured before anything else */
+    if ((usec = ca_latency_usec(latency)) > 0) {
+        size_t fragment;
+        int shift = 4;
+
+        fragment = (size_t) ((uint64_t) usec * ca_sound_file_get_rate(out->file) / 1000000U / CA_LATENCY_PERIODS) * ca_sound_file_frame_size(out->file);
+
+        /* 2^shift bytes per fragment, with 16 bytes at least */
+        while (shift < 16 && ((size_t) 1 << (shift + 1)) <= fragment)
+            shift++;
+
+        /* Not all drivers allow this, so let's ignore any failure and
+         * go on with their defaults */
+        val = (int) (CA_LATENCY_PERIODS << 16) | shift;
+        ioctl(out->pcm, SNDCTL_DSP_SETFRAGMENT, &val);
+    }
+
     switch (ca_sound_file_get_sample_type(out->file)) {
         case CA_SAMPLE_U8:
             val = AFMT_U8;
@@ -306,97 +399,199 @@ finish_ret:
     return ret;
 }
 
-#define BUFSIZE (4*1024)
+static uint64_t now_usec(void) {
+    struct timespec ts;
 
-static void* thread_func(void *userdata) {
-    struct outstanding *out = userdata;
-    int ret;
-    void *data, *d = NULL;
-    size_t fs, data_size;
-    size_t nbytes = 0;
-    struct pollfd pfd[2];
-    nfds_t n_pfd = 2;
-    struct private *p;
+    ca_assert_se(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
 
-    p = PRIVATE(out->context);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+}
 
-    pthread_detach(pthread_self());
+/* Called from the reactor thread with the outstanding_mutex held */
+static void start_drain(struct private *p, struct outstanding *out) {
+    struct epoll_event ev;
+    int odelay;
+
+    /* Everything has been written, so stop waiting for POLLOUT. Since
+     * closing the device would drop what it still has buffered, we
+     * wait until that has been played. */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = 0;
+    ev.data.ptr = out;
+    epoll_ctl(p->epoll_fd, EPOLL_CTL_MOD, out->pcm, &ev);
+
+    out->draining = TRUE;
+
+#ifdef SNDCTL_DSP_GETODELAY
+    if (ioctl(out->pcm, SNDCTL_DSP_GETODELAY, &odelay) >= 0 && odelay > 0) {
+        out->drain_until = now_usec() +
+            (uint64_t) odelay * 1000000ULL / ((uint64_t) ca_sound_file_frame_size(out->file) * ca_sound_file_get_rate(out->file));
+        return;
+    }
+#endif
 
-    fs = ca_sound_file_frame_size(out->file);
-    data_size = (BUFSIZE/fs)*fs;
+    /* We don't know how much is left, so let's call it a day */
+    out->finished = TRUE;
+}
 
-    if (!(data = ca_malloc(data_size))) {
-        ret = CA_ERROR_OOM;
-        goto finish;
-    }
+/* Called from the reactor thread with the outstanding_mutex held.
+ * Writes as much as the device takes without blocking. */
+static int write_some(struct private *p, struct outstanding *out) {
+    ssize_t bytes_written;
+    size_t fs;
+    int ret;
 
-    pfd[0].fd = out->pipe_fd[0];
-    pfd[0].events = POLLIN;
-    pfd[0].revents = 0;
-    pfd[1].fd = out->pcm;
-    pfd[1].events = POLLOUT;
-    pfd[1].revents = 0;
+    fs = ca_sound_file_frame_size(out->file);
 
     for (;;) {
-        ssize_t bytes_written;
 
-        if (out->dead)
-            break;
+        if (out->nbytes <= 0) {
+            out->nbytes = (BUFSIZE/fs)*fs;
 
-        if (poll(pfd, n_pfd, -1) < 0) {
-            ret = CA_ERROR_SYSTEM;
-            goto finish;
+            if ((ret = ca_sound_file_read_arbitrary(out->file, out->data, &out->nbytes)) < 0)
+                return ret;
+
+            out->d = out->data;
         }
 
-        /* We have been asked to shut down */
-        if (pfd[0].revents)
-            break;
+        if (out->nbytes <= 0) {
+            start_drain(p, out);
+            return CA_SUCCESS;
+        }
+
+        if ((bytes_written = write(out->pcm, out->d, out->nbytes)) < 0) {
+
+            if (errno == EINTR)
+                continue;
 
-        if (pfd[1].revents != POLLOUT) {
-            ret = CA_ERROR_IO;
-            goto finish;
+            if (errno == EAGAIN)
+                return CA_SUCCESS;
+
+            return translate_error(errno);
         }
 
-        if (nbytes <= 0) {
-            nbytes = data_size;
+        if (bytes_written == 0)
+            return CA_SUCCESS;
+
+        CA_PROBE4(driver_write, "oss", out->context, out->id, (size_t) bytes_written);
+
+        out->nbytes -= (size_t) bytes_written;
+        out->d += (size_t) bytes_written;
+    }
+}
+
+/* The reactor thread, driving all streams of a context */
+static void* thread_func(void *userdata) {
+    struct private *p = userdata;
+    struct epoll_event events[N_EVENTS], dummy;
+    int timeout = -1;
+
+    pthread_detach(pthread_self());
 
-            if ((ret = ca_sound_file_read_arbitrary(out->file, data, &nbytes)) < 0)
-                goto finish;
+    memset(&dummy, 0, sizeof(dummy));
 
-            d = data;
+    for (;;) {
+        struct outstanding *out, *next, *done = NULL;
+        int i, n, ret, err = CA_SUCCESS;
+        ca_bool_t quit;
+        uint64_t now;
+
+        if ((n = epoll_wait(p->epoll_fd, events, N_EVENTS, timeout)) < 0) {
+            if (errno != EINTR)
+                err = CA_ERROR_SYSTEM;
+            n = 0;
         }
 
-        if (nbytes <= 0)
-            break;
+        ca_mutex_lock(p->outstanding_mutex);
+
+        for (i = 0; i < n; i++) {
+
+            /* The event fd only wakes us up */
+            if (!(out = events[i].data.ptr)) {
+                uint64_t v;
+
+                /* EAGAIN only means the counter was already reset */
+                while (read(p->event_fd, &v, sizeof(v)) < 0 && errno == EINTR)
+                    ;
+                continue;
+            }
+
+            if (out->dead || out->finished)
+                continue;
+
+            if (events[i].events & (EPOLLERR|EPOLLHUP)) {
+                out->error = CA_ERROR_IO;
+                out->finished = TRUE;
+                continue;
+            }
 
-        if ((bytes_written = write(out->pcm, d, nbytes)) <= 0) {
-            ret = translate_error(errno);
-            goto finish;
+            if (!out->draining && (events[i].events & EPOLLOUT))
+                if ((ret = write_some(p, out)) < 0) {
+                    out->error = ret;
+                    out->finished = TRUE;
+                }
         }
 
-        nbytes -= (size_t) bytes_written;
-        d = (uint8_t*) d + (size_t) bytes_written;
-    }
+        /* Collect everything that is done, and figure out when the
+         * next drain finishes */
+        now = now_usec();
+        timeout = -1;
 
-    ret = CA_SUCCESS;
+        for (out = p->outstanding; out; out = next) {
+            next = out->next;
 
-finish:
+            if (err < 0 && !out->finished) {
+                out->error = err;
+                out->finished = TRUE;
+            }
 
-    ca_free(data);
+            if (out->draining && !out->finished && !out->dead) {
+                if (now >= out->drain_until)
+                    out->finished = TRUE;
+                else {
+                    int t = (int) ((out->drain_until - now + 999ULL) / 1000ULL);
 
-    if (!out->dead)
-        if (out->callback)
-            out->callback(out->context, out->id, ret, out->userdata);
+                    if (timeout < 0 || t < timeout)
+                        timeout = t;
+                }
+            }
 
-    ca_mutex_lock(p->outstanding_mutex);
+            if (!out->dead && !out->finished)
+                continue;
 
-    CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+            epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, out->pcm, &dummy);
 
-    if (!p->outstanding && p->signal_semaphore)
-        sem_post(&p->semaphore);
+            CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+            CA_LLIST_PREPEND(struct outstanding, done, out);
+        }
+
+        quit = p->quit && !p->outstanding;
+
+        ca_mutex_unlock(p->outstanding_mutex);
+
+        /* Call the callbacks without holding the lock, so that they may
+         * call into libcanberra again */
+        while ((out = done)) {
+            CA_LLIST_REMOVE(struct outstanding, done, out);
+
+            if (!out->dead)
+                if (out->callback) {
+                    CA_PROBE4(callback, "oss", out->context, out->id, out->error);
+                    out->callback(out->context, out->id, out->error, out->userdata);
+                }
+
+            outstanding_free(out);
+        }
 
-    outstanding_free(out);
+        if (quit)
+            break;
+    }
 
+    /* Signal the semaphore and exit */
+    ca_mutex_lock(p->outstanding_mutex);
+    p->reactor_running = FALSE;
+    if (p->signal_semaphore)
+        sem_post(&p->semaphore);
     ca_mutex_unlock(p->outstanding_mutex);
 
     return NULL;
@@ -405,8 +600,9 @@ finish:
 int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
     struct private *p;
     struct outstanding *out = NULL;
+    struct epoll_event ev;
+    ca_latency_t latency;
     int ret;
-    pthread_t thread;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
@@ -424,35 +620,37 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
     out->id = id;
     out->callback = cb;
     out->userdata = userdata;
-    out->pipe_fd[0] = out->pipe_fd[1] = -1;
     out->pcm = -1;
 
-    if (pipe(out->pipe_fd) < 0) {
-        ret = CA_ERROR_SYSTEM;
+    if ((ret = ca_get_latency(&latency, c->props, proplist)) < 0)
         goto finish;
-    }
 
     if ((ret = ca_lookup_sound(&out->file, NULL, &p->theme, c->props, proplist)) < 0)
         goto finish;
 
-    if ((ret = open_oss(c, out)) < 0)
+    if ((ret = open_oss(c, out, latency)) < 0)
         goto finish;
 
-    /* OK, we're ready to go, so let's add this to our list */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = out;
+
+    /* OK, we're ready to go, so let's add this to our list and hand
+     * it to the reactor */
     ca_mutex_lock(p->outstanding_mutex);
     CA_LLIST_PREPEND(struct outstanding, p->outstanding, out);
-    ca_mutex_unlock(p->outstanding_mutex);
 
-    if (pthread_create(&thread, NULL, thread_func, out) < 0) {
-        ret = CA_ERROR_OOM;
+    if (epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, out->pcm, &ev) < 0) {
+        ret = translate_error(errno);
 
-        ca_mutex_lock(p->outstanding_mutex);
         CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
         ca_mutex_unlock(p->outstanding_mutex);
 
         goto finish;
     }
 
+    ca_mutex_unlock(p->outstanding_mutex);
+
     ret = CA_SUCCESS;
 
 finish:
@@ -485,16 +683,15 @@ int driver_cancel(ca_context *c, uint32_t id) {
 
         out->dead = TRUE;
 
-        if (out->callback)
+        if (out->callback) {
+            CA_PROBE4(callback, "oss", c, out->id, CA_ERROR_CANCELED);
             out->callback(c, out->id, CA_ERROR_CANCELED, out->userdata);
-
-        /* This will cause the thread to wakeup and terminate */
-        if (out->pipe_fd[1] >= 0) {
-            close(out->pipe_fd[1]);
-            out->pipe_fd[1] = -1;
         }
     }
 
+    /* The reactor will pick up the dead streams and close them */
+    wakeup(p);
+
     ca_mutex_unlock(p->outstanding_mutex);
 
     return CA_SUCCESS;
@@ -0,0 +1,305 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+
+#include "canberra.h"
+#include "prefetch.h"
+#include "proplist.h"
+#include "read-sound-file.h"
+#include "sound-theme-spec.h"
+#include "malloc.h"
+#include "mutex.h"
+#include "macro.h"
+
+struct job {
+    ca_mutex *mutex;
+
+    ca_proplist *cp;
+    ca_proplist **sp;
+    unsigned n;
+
+    /* Protected by mutex */
+    unsigned next;
+    unsigned n_workers;
+
+    ca_prefetch_item_callback_t item_cb;
+    ca_prefetch_done_callback_t done_cb;
+    ca_prefetch_finish_callback_t finish_cb;
+    void *userdata;
+};
+
+static void job_free(struct job *j) {
+    unsigned i;
+
+    ca_assert(j);
+
+    if (j->sp) {
+        for (i = 0; i < j->n; i++)
+            if (j->sp[i])
+                ca_proplist_destroy(j->sp[i]);
+
+        ca_free(j->sp);
+    }
+
+    if (j->cp)
+        ca_proplist_destroy(j->cp);
+
+    if (j->mutex)
+        ca_mutex_free(j->mutex);
+
+    ca_free(j);
+}
+
+static ca_bool_t job_worker_exit(struct job *j, unsigned n) {
+    ca_bool_t last;
+
+    ca_assert(j);
+
+    ca_mutex_lock(j->mutex);
+    ca_assert(j->n_workers >= n);
+    j->n_workers -= n;
+    last = j->n_workers <= 0;
+    ca_mutex_unlock(j->mutex);
+
+    if (!last)
+        return FALSE;
+
+    if (j->finish_cb)
+        j->finish_cb(j->userdata);
+
+    job_free(j);
+
+    return TRUE;
+}
+
+static void* worker_func(void *userdata) {
+    struct job *j = userdata;
+    ca_theme_data *t = NULL;
+    ca_proplist *cp = NULL;
+    int ret;
+
+    pthread_detach(pthread_self());
+
+    /* ca_lookup_sound() keeps the context property list locked while
+     * it is searching, hence every worker gets its own copy */
+    ret = ca_proplist_copy(&cp, j->cp);
+
+    for (;;) {
+        unsigned idx;
+        int r;
+
+        ca_mutex_lock(j->mutex);
+
+        if (j->next >= j->n) {
+            ca_mutex_unlock(j->mutex);
+            break;
+        }
+
+        idx = j->next++;
+
+        ca_mutex_unlock(j->mutex);
+
+        if (ret < 0)
+            r = ret;
+        else if (j->item_cb)
+            r = j->item_cb(idx, &t, cp, j->sp[idx], j->userdata);
+        else
+            r = ca_prefetch_sound(&t, cp, j->sp[idx]);
+
+        if (j->done_cb)
+            j->done_cb(idx, r, j->userdata);
+    }
+
+    if (t)
+        ca_theme_data_free(t);
+
+    if (cp)
+        ca_proplist_destroy(cp);
+
+    job_worker_exit(j, 1);
+
+    return NULL;
+}
+
+int ca_prefetch(
+        ca_proplist *cp,
+        ca_proplist *const *sp,
+        unsigned n,
+        unsigned n_workers,
+        ca_prefetch_item_callback_t item_cb,
+        ca_prefetch_done_callback_t done_cb,
+        ca_prefetch_finish_callback_t finish_cb,
+        void *userdata) {
+
+    struct job *j;
+    unsigned i;
+    int ret;
+
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+    ca_return_val_if_fail(sp, CA_ERROR_INVALID);
+    ca_return_val_if_fail(n > 0, CA_ERROR_INVALID);
+
+    if (n_workers <= 0 || n_workers > CA_PREFETCH_WORKERS_MAX)
+        n_workers = CA_PREFETCH_WORKERS_MAX;
+
+    if (n_workers > n)
+        n_workers = n;
+
+    if (!(j = ca_new0(struct job, 1)))
+        return CA_ERROR_OOM;
+
+    j->n = n;
+    j->item_cb = item_cb;
+    j->done_cb = done_cb;
+    j->finish_cb = finish_cb;
+    j->userdata = userdata;
+
+    if (!(j->mutex = ca_mutex_new())) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    if ((ret = ca_proplist_copy(&j->cp, cp)) < 0)
+        goto fail;
+
+    if (!(j->sp = ca_new0(ca_proplist*, n))) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!sp[i]) {
+            ret = CA_ERROR_INVALID;
+            goto fail;
+        }
+
+        if ((ret = ca_proplist_copy(&j->sp[i], sp[i])) < 0)
+            goto fail;
+    }
+
+    /* Account for all workers up front, so that the first one to
+     * finish doesn't free the job under our feet */
+    j->n_workers = n_workers;
+
+    for (i = 0; i < n_workers; i++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, worker_func, j) != 0)
+            break;
+    }
+
+    if (i <= 0) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    /* If we couldn't start all of them the ones we have will pick up
+     * the remaining work */
+    if (i < n_workers)
+        job_worker_exit(j, n_workers - i);
+
+    return CA_SUCCESS;
+
+fail:
+    job_free(j);
+
+    return ret;
+}
+
+int ca_prefetch_sound(ca_theme_data **t, ca_proplist *cp, ca_proplist *sp) {
+    ca_sound_file *f;
+    int ret;
+
+    ca_return_val_if_fail(t, CA_ERROR_INVALID);
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+    ca_return_val_if_fail(sp, CA_ERROR_INVALID);
+
+    if ((ret = ca_lookup_sound(&f, NULL, t, cp, sp)) < 0)
+        return ret;
+
+    ret = ca_sound_file_cache(f);
+    ca_sound_file_close(f);
+
+    return ret;
+}
+
+/* The sounds canberra-gtk-module generates on its own, i.e. what the
+ * user is going to hear first after switching themes */
+static const char * const well_known_event_ids[] = {
+    "button-pressed",
+    "button-released",
+    "button-toggle-on",
+    "button-toggle-off",
+    "dialog-error",
+    "dialog-information",
+    "dialog-question",
+    "dialog-warning",
+    "dialog-ok",
+    "dialog-cancel",
+    "item-selected",
+    "link-pressed",
+    "link-released",
+    "menu-click",
+    "menu-popup",
+    "menu-popdown",
+    "menu-replace",
+    "notebook-tab-changed",
+    "tooltip-popup",
+    "tooltip-popdown",
+    "window-new",
+    "window-close",
+    "window-maximized",
+    "window-unmaximized",
+    "window-minimized",
+    "window-unminimized"
+};
+
+int ca_prefetch_theme(ca_proplist *cp) {
+    ca_proplist *sp[CA_ELEMENTSOF(well_known_event_ids)];
+    unsigned i, n = 0;
+    int ret = CA_SUCCESS;
+
+    ca_return_val_if_fail(cp, CA_ERROR_INVALID);
+
+    for (i = 0; i < CA_ELEMENTSOF(well_known_event_ids); i++) {
+
+        if ((ret = ca_proplist_create(&sp[n])) < 0)
+            goto finish;
+
+        n++;
+
+        if ((ret = ca_proplist_sets(sp[n-1], CA_PROP_EVENT_ID, well_known_event_ids[i])) < 0)
+            goto finish;
+    }
+
+    ret = ca_prefetch(cp, sp, n, 0, NULL, NULL, NULL, NULL);
+
+finish:
+
+    for (i = 0; i < n; i++)
+        ca_assert_se(ca_proplist_destroy(sp[i]) == CA_SUCCESS);
+
+    return ret;
+}
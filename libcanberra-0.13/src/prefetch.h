@@ -0,0 +1,60 @@
+#ifndef foocanberraprefetchhfoo
+#define foocanberraprefetchhfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include "canberra.h"
+#include "sound-theme-spec.h"
+
+#define CA_PREFETCH_WORKERS_MAX 4U
+
+/* Resolves and decodes a list of sounds into the lookup and PCM
+ * caches on a small pool of background threads.
+ *
+ * item_cb is called for each entry in a worker thread and does the
+ * actual work. If it is NULL ca_prefetch_sound() is used. done_cb is
+ * called exactly once for each entry with the result, finish_cb once
+ * after all entries have been processed. Neither may call into the
+ * public API. The property lists are copied, the caller may free them
+ * right after this call. */
+
+typedef int (*ca_prefetch_item_callback_t)(unsigned idx, ca_theme_data **t, ca_proplist *cp, ca_proplist *sp, void *userdata);
+typedef void (*ca_prefetch_done_callback_t)(unsigned idx, int error, void *userdata);
+typedef void (*ca_prefetch_finish_callback_t)(void *userdata);
+
+int ca_prefetch(
+        ca_proplist *cp,
+        ca_proplist *const *sp,
+        unsigned n,
+        unsigned n_workers,
+        ca_prefetch_item_callback_t item_cb,
+        ca_prefetch_done_callback_t done_cb,
+        ca_prefetch_finish_callback_t finish_cb,
+        void *userdata);
+
+int ca_prefetch_sound(ca_theme_data **t, ca_proplist *cp, ca_proplist *sp);
+
+/* Resolves and decodes the event sounds most applications play, in
+ * the theme selected by cp. Used to warm up the caches after the
+ * theme has been switched. */
+int ca_prefetch_theme(ca_proplist *cp);
+
+#endif
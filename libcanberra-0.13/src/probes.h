@@ -0,0 +1,79 @@
+#ifndef foocanberraprobeshfoo
+#define foocanberraprobeshfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+/* USDT probes for perf, bpftrace and SystemTap, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libcanberra.so.0:libcanberra:lookup_result { printf("%s %d\n", str(arg1), arg4); }'
+ *
+ * When nobody is attached each probe is a single nop, and without
+ * <sys/sdt.h> they compile to nothing at all. The arguments are still
+ * computed when the probes are built in, so only pass values that are
+ * at hand anyway.
+ *
+ * The argument layouts below are a stable interface: new arguments
+ * may be appended, but existing ones are never reordered, removed or
+ * changed in meaning. Strings may be NULL. "driver" is the static
+ * name of the backend ("alsa", "pulse", ...).
+ *
+ *   play_full_start    (ca_context *c, uint32_t id, ca_proplist *p)
+ *   play_full_end      (ca_context *c, uint32_t id, int ret)
+ *   driver_play_start  (ca_context *c, uint32_t id)
+ *   driver_play_end    (ca_context *c, uint32_t id, int ret)
+ *   cache_lookup_hit   (const char *theme, const char *name, const char *locale, const char *profile, const char *path)
+ *                      path is NULL for negative entries
+ *   cache_lookup_miss  (const char *theme, const char *name, const char *locale, const char *profile)
+ *   lookup_result      (const char *theme, const char *name, const char *locale, const char *profile, int ret, const char *path)
+ *   sound_file_open_start (const char *fn)
+ *   sound_file_open_end   (const char *fn, int ret)
+ *   driver_write       (const char *driver, ca_context *c, uint32_t id, size_t bytes)
+ *   driver_recover     (const char *driver, ca_context *c, uint32_t id, int err)
+ *                      err is the negative errno we recover from
+ *   callback           (const char *driver, ca_context *c, uint32_t id, int error)
+ *                      fired right before a finish callback is called
+ *   visual_start       (const char *effect, const char *event_id)
+ *   visual_end         (const char *effect, const char *event_id)
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define CA_PROBE1(name, a) DTRACE_PROBE1(libcanberra, name, a)
+#define CA_PROBE2(name, a, b) DTRACE_PROBE2(libcanberra, name, a, b)
+#define CA_PROBE3(name, a, b, c) DTRACE_PROBE3(libcanberra, name, a, b, c)
+#define CA_PROBE4(name, a, b, c, d) DTRACE_PROBE4(libcanberra, name, a, b, c, d)
+#define CA_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(libcanberra, name, a, b, c, d, e)
+#define CA_PROBE6(name, a, b, c, d, e, f) DTRACE_PROBE6(libcanberra, name, a, b, c, d, e, f)
+
+#else
+
+#define CA_PROBE1(name, a) do { } while (0)
+#define CA_PROBE2(name, a, b) do { } while (0)
+#define CA_PROBE3(name, a, b, c) do { } while (0)
+#define CA_PROBE4(name, a, b, c, d) do { } while (0)
+#define CA_PROBE5(name, a, b, c, d, e) do { } while (0)
+#define CA_PROBE6(name, a, b, c, d, e, f) do { } while (0)
+
+#endif
+
+#endif
@@ -260,6 +260,31 @@ finish:
     return ret;
 }
 
+/**
+ * ca_proplist_gets:
+ * @p: The property list to look the key up in
+ * @key: The key to look up
+ *
+ * Look up a string value in the property list. The returned string
+ * is owned by the property list and stays valid only as long as the
+ * key is not changed or removed.
+ *
+ * Returns: the value, or %NULL if the key is not set or not a valid string.
+ */
+
+const char* ca_proplist_gets(ca_proplist *p, const char *key) {
+    const char *r;
+
+    ca_return_null_if_fail(p);
+    ca_return_null_if_fail(key);
+
+    ca_mutex_lock(p->mutex);
+    r = ca_proplist_gets_unlocked(p, key);
+    ca_mutex_unlock(p->mutex);
+
+    return r;
+}
+
 /* Not exported, not self-locking */
 ca_prop* ca_proplist_get_unlocked(ca_proplist *p, const char *key) {
     ca_prop *prop;
@@ -359,6 +384,25 @@ int ca_proplist_merge(ca_proplist **_a, ca_proplist *b, ca_proplist *c) {
     return CA_SUCCESS;
 }
 
+int ca_proplist_copy(ca_proplist **_a, ca_proplist *b) {
+    ca_proplist *a;
+    int ret;
+
+    ca_return_val_if_fail(_a, CA_ERROR_INVALID);
+    ca_return_val_if_fail(b, CA_ERROR_INVALID);
+
+    if ((ret = ca_proplist_create(&a)) < 0)
+        return ret;
+
+    if ((ret = merge_into(a, b)) < 0) {
+        ca_proplist_destroy(a);
+        return ret;
+    }
+
+    *_a = a;
+    return CA_SUCCESS;
+}
+
 ca_bool_t ca_proplist_contains(ca_proplist *p, const char *key) {
     ca_bool_t b;
 
@@ -44,6 +44,7 @@ struct ca_proplist {
 };
 
 int ca_proplist_merge(ca_proplist **_a, ca_proplist *b, ca_proplist *c);
+int ca_proplist_copy(ca_proplist **_a, ca_proplist *b);
 ca_bool_t ca_proplist_contains(ca_proplist *p, const char *key);
 
 /* Both of the following two functions are not locked! Need manual locking! */
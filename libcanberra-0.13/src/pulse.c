@@ -25,10 +25,12 @@
 /* The locking order needs to be strictly followed! First take the
  * mainloop mutex, only then take outstanding_mutex if you need both!
  * Not the other way round, beacause we might then enter a
- * deadlock!  */
+ * deadlock! connection_mutex is never taken while holding the
+ * mainloop mutex. */
 
 #include <errno.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <pulse/thread-mainloop.h>
 #include <pulse/context.h>
@@ -43,6 +45,8 @@
 #include "read-sound-file.h"
 #include "sound-theme-spec.h"
 #include "malloc.h"
+#include "probes.h"
+#include "mutex.h"
 
 enum outstanding_type {
     OUTSTANDING_SAMPLE,
@@ -64,18 +68,48 @@ struct outstanding {
     ca_bool_t clean_up;
 };
 
-struct private {
+/* All ca_contexts of a process share a single PulseAudio connection
+ * and the threaded mainloop driving it. Each driver_open() takes a
+ * reference on it, the last driver_destroy() tears it down again. */
+struct connection {
+    unsigned ref;
+
     pa_threaded_mainloop *mainloop;
     pa_context *context;
-    ca_theme_data *theme;
     ca_bool_t subscribed;
 
+    /* Client properties, kept around so that we can restore them
+     * when we have to reconnect */
+    pa_proplist *props;
+
+    /* Protected by the mainloop lock */
+    CA_LLIST_HEAD(struct private, privates);
+};
+
+struct private {
+    CA_LLIST_FIELDS(struct private);
+
+    ca_context *parent;
+    struct connection *connection;
+    ca_theme_data *theme;
+
+    /* c->props translated once and kept in sync by
+     * driver_change_props(), so that driver_play() only needs to
+     * translate the event properties. Protected by the context lock */
+    pa_proplist *props;
+
     ca_mutex *outstanding_mutex;
     CA_LLIST_HEAD(struct outstanding, outstanding);
 };
 
 #define PRIVATE(c) ((struct private *) ((c)->private))
 
+/* This part is not portable due to pthread_once usage, should be abstracted
+ * when we port this to platforms that do not have POSIX threading */
+
+static ca_mutex *connection_mutex = NULL;
+static struct connection *connection = NULL;
+
 static void context_state_cb(pa_context *pc, void *userdata);
 static void context_subscribe_cb(pa_context *pc, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
 
@@ -149,6 +183,19 @@ static void add_common(pa_proplist *l) {
     }
 }
 
+static void add_context_props(pa_proplist *l, struct private *p) {
+    ca_assert(l);
+    ca_assert(p);
+    ca_assert(p->props);
+
+    /* Since the PulseAudio connection is shared between all contexts
+     * the client properties cannot carry the context properties of
+     * each of them. Hence we attach them to every stream we
+     * create. Event properties take precedence. */
+
+    pa_proplist_update(l, PA_UPDATE_MERGE, p->props);
+}
+
 static int translate_error(int error) {
     static const int table[PA_ERR_MAX] = {
         [PA_OK]                       = CA_SUCCESS,
@@ -195,57 +242,66 @@ static int translate_error(int error) {
     return table[error];
 }
 
-static int context_connect(ca_context *c) {
-    pa_proplist *l;
-    struct private *p;
+static int context_connect(struct connection *conn) {
     int ret;
 
-    ca_return_val_if_fail(c, CA_ERROR_INVALID);
-    ca_return_val_if_fail(p = c->private, CA_ERROR_STATE);
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
-    ca_return_val_if_fail(!p->context, CA_ERROR_STATE);
+    ca_return_val_if_fail(conn, CA_ERROR_INVALID);
+    ca_return_val_if_fail(conn->mainloop, CA_ERROR_STATE);
+    ca_return_val_if_fail(conn->props, CA_ERROR_STATE);
+    ca_return_val_if_fail(!conn->context, CA_ERROR_STATE);
 
-    if ((ret = convert_proplist(&l, c->props)) < 0) {
-        driver_destroy(c);
+    if (!(conn->context = pa_context_new_with_proplist(pa_threaded_mainloop_get_api(conn->mainloop), "libcanberra", conn->props)))
+        return CA_ERROR_OOM;
+
+    pa_context_set_state_callback(conn->context, context_state_cb, conn);
+    pa_context_set_subscribe_callback(conn->context, context_subscribe_cb, conn);
+
+    if (pa_context_connect(conn->context, NULL, PA_CONTEXT_NOFAIL, NULL) < 0) {
+        ret = translate_error(pa_context_errno(conn->context));
+        pa_context_unref(conn->context);
+        conn->context = NULL;
         return ret;
     }
 
-    strip_prefix(l, "canberra.");
+    return CA_SUCCESS;
+}
 
-    if (!(p->context = pa_context_new_with_proplist(pa_threaded_mainloop_get_api(p->mainloop), "libcanberra", l))) {
-        pa_proplist_free(l);
-        driver_destroy(c);
-        return CA_ERROR_OOM;
-    }
+static void fail_outstanding(struct private *p, int error) {
+    struct outstanding *out;
 
-    pa_proplist_free(l);
+    ca_assert(p);
+
+    ca_mutex_lock(p->outstanding_mutex);
 
-    pa_context_set_state_callback(p->context, context_state_cb, c);
-    pa_context_set_subscribe_callback(p->context, context_subscribe_cb, c);
+    while ((out = p->outstanding)) {
 
-    if (pa_context_connect(p->context, NULL, PA_CONTEXT_NOFAIL, NULL) < 0) {
-        ret = translate_error(pa_context_errno(p->context));
-        driver_destroy(c);
-        return ret;
+        CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+        ca_mutex_unlock(p->outstanding_mutex);
+
+        if (out->callback) {
+            CA_PROBE4(callback, "pulse", p->parent, out->id, error);
+            out->callback(p->parent, out->id, error, out->userdata);
+        }
+
+        outstanding_free(out);
+
+        ca_mutex_lock(p->outstanding_mutex);
     }
 
-    return CA_SUCCESS;
+    ca_mutex_unlock(p->outstanding_mutex);
 }
 
 static void context_state_cb(pa_context *pc, void *userdata) {
-    ca_context *c = userdata;
+    struct connection *conn = userdata;
     pa_context_state_t state;
-    struct private *p;
 
     ca_assert(pc);
-    ca_assert(c);
-
-    p = PRIVATE(c);
+    ca_assert(conn);
 
     state = pa_context_get_state(pc);
 
     if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED) {
-        struct outstanding *out;
+        struct private *p;
         int ret;
 
         if (state == PA_CONTEXT_TERMINATED)
@@ -253,164 +309,311 @@ static void context_state_cb(pa_context *pc, void *userdata) {
         else
             ret = translate_error(pa_context_errno(pc));
 
-        ca_mutex_lock(p->outstanding_mutex);
+        for (p = conn->privates; p; p = p->next)
+            fail_outstanding(p, ret);
 
-        while ((out = p->outstanding)) {
-
-            CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
-            ca_mutex_unlock(p->outstanding_mutex);
-
-            if (out->callback)
-                out->callback(c, out->id, ret, out->userdata);
-
-            outstanding_free(out);
-
-            ca_mutex_lock(p->outstanding_mutex);
+        if (conn->context) {
+            pa_context_disconnect(conn->context);
+            pa_context_unref(conn->context);
+            conn->subscribed = FALSE;
+            conn->context = NULL;
         }
 
-        ca_mutex_unlock(p->outstanding_mutex);
-
-        if (p->context) {
-            pa_context_disconnect(p->context);
-            pa_context_unref(p->context);
-            p->subscribed = FALSE;
-            p->context = NULL;
-        }
-
-        /* FIXME: recycle previous pa_context_proplist and restore state as much as possible? */
-        if (context_connect(c) != CA_SUCCESS)
+        if (context_connect(conn) != CA_SUCCESS)
             return;
     }
 
-    pa_threaded_mainloop_signal(p->mainloop, FALSE);
+    pa_threaded_mainloop_signal(conn->mainloop, FALSE);
 }
 
 static void context_subscribe_cb(pa_context *pc, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
     struct outstanding *out, *n;
     CA_LLIST_HEAD(struct outstanding, l);
-    ca_context *c = userdata;
+    struct connection *conn = userdata;
     struct private *p;
 
     ca_assert(pc);
-    ca_assert(c);
+    ca_assert(conn);
 
     if (t != (PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_REMOVE))
         return;
 
-    p = PRIVATE(c);
+    /* Sink input indexes are unique on the connection, so at most one
+     * of the contexts will find a match here */
 
-    CA_LLIST_HEAD_INIT(struct outstanding, l);
+    for (p = conn->privates; p; p = p->next) {
 
-    ca_mutex_lock(p->outstanding_mutex);
+        CA_LLIST_HEAD_INIT(struct outstanding, l);
 
-    for (out = p->outstanding; out; out = n) {
-        n = out->next;
+        ca_mutex_lock(p->outstanding_mutex);
 
-        if (out->type != OUTSTANDING_SAMPLE || out->sink_input != idx)
-            continue;
+        for (out = p->outstanding; out; out = n) {
+            n = out->next;
 
-        CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
-        CA_LLIST_PREPEND(struct outstanding, l, out);
+            if (out->type != OUTSTANDING_SAMPLE || out->sink_input != idx)
+                continue;
+
+            CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+            CA_LLIST_PREPEND(struct outstanding, l, out);
+        }
+
+        ca_mutex_unlock(p->outstanding_mutex);
+
+        while (l) {
+            out = l;
+
+            CA_LLIST_REMOVE(struct outstanding, l, out);
+
+            if (out->callback) {
+                CA_PROBE4(callback, "pulse", p->parent, out->id, CA_SUCCESS);
+                out->callback(p->parent, out->id, CA_SUCCESS, out->userdata);
+            }
+
+            outstanding_free(out);
+        }
     }
+}
 
-    ca_mutex_unlock(p->outstanding_mutex);
+static void allocate_mutex_once(void) {
+    connection_mutex = ca_mutex_new();
+}
 
-    while (l) {
-        out = l;
+static int allocate_mutex(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
 
-        CA_LLIST_REMOVE(struct outstanding, l, out);
+    if (pthread_once(&once, allocate_mutex_once) != 0)
+        return CA_ERROR_OOM;
 
-        if (out->callback)
-            out->callback(c, out->id, CA_SUCCESS, out->userdata);
+    if (!connection_mutex)
+        return CA_ERROR_OOM;
 
-        outstanding_free(out);
+    return 0;
+}
+
+static void connection_free(struct connection *conn) {
+    ca_assert(conn);
+    ca_assert(!conn->privates);
+
+    if (conn->mainloop)
+        pa_threaded_mainloop_stop(conn->mainloop);
+
+    if (conn->context) {
+        pa_context_disconnect(conn->context);
+        pa_context_unref(conn->context);
     }
+
+    if (conn->mainloop)
+        pa_threaded_mainloop_free(conn->mainloop);
+
+    if (conn->props)
+        pa_proplist_free(conn->props);
+
+    ca_free(conn);
 }
 
-int driver_open(ca_context *c) {
-    struct private *p;
+static int connection_new(struct connection **_conn, pa_proplist *props) {
+    struct connection *conn;
     int ret;
 
-    ca_return_val_if_fail(c, CA_ERROR_INVALID);
-    ca_return_val_if_fail(!c->driver || ca_streq(c->driver, "pulse"), CA_ERROR_NODRIVER);
-    ca_return_val_if_fail(!PRIVATE(c), CA_ERROR_STATE);
+    ca_assert(_conn);
+    ca_assert(props);
 
-    if (!(c->private = p = ca_new0(struct private, 1)))
+    if (!(conn = ca_new0(struct connection, 1)))
         return CA_ERROR_OOM;
 
+    conn->ref = 1;
 
-    if (!(p->outstanding_mutex = ca_mutex_new())) {
-        driver_destroy(c);
-        return CA_ERROR_OOM;
+    /* The first context to connect determines the initial client
+     * properties */
+    if (!(conn->props = pa_proplist_copy(props))) {
+        ret = CA_ERROR_OOM;
+        goto fail;
     }
 
-    if (!(p->mainloop = pa_threaded_mainloop_new())) {
-        driver_destroy(c);
-        return CA_ERROR_OOM;
+    if (!(conn->mainloop = pa_threaded_mainloop_new())) {
+        ret = CA_ERROR_OOM;
+        goto fail;
     }
 
-    if ((ret = context_connect(c)) != CA_SUCCESS)
-        return ret;
+    if ((ret = context_connect(conn)) != CA_SUCCESS)
+        goto fail;
 
-    pa_threaded_mainloop_lock(p->mainloop);
+    pa_threaded_mainloop_lock(conn->mainloop);
 
-    if (pa_threaded_mainloop_start(p->mainloop) < 0) {
-        pa_threaded_mainloop_unlock(p->mainloop);
-        driver_destroy(c);
-        return CA_ERROR_OOM;
+    if (pa_threaded_mainloop_start(conn->mainloop) < 0) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
+        ret = CA_ERROR_OOM;
+        goto fail;
     }
 
     for (;;) {
-        pa_context_state_t state = pa_context_get_state(p->context);
+        pa_context_state_t state = pa_context_get_state(conn->context);
 
         if (state == PA_CONTEXT_READY)
             break;
 
         if (state == PA_CONTEXT_FAILED) {
-            ret = translate_error(pa_context_errno(p->context));
-            pa_threaded_mainloop_unlock(p->mainloop);
-            driver_destroy(c);
-            return ret;
+            ret = translate_error(pa_context_errno(conn->context));
+            pa_threaded_mainloop_unlock(conn->mainloop);
+            goto fail;
         }
 
         ca_assert(state != PA_CONTEXT_TERMINATED);
 
-        pa_threaded_mainloop_wait(p->mainloop);
+        pa_threaded_mainloop_wait(conn->mainloop);
     }
 
-    pa_threaded_mainloop_unlock(p->mainloop);
+    pa_threaded_mainloop_unlock(conn->mainloop);
+
+    *_conn = conn;
 
     return CA_SUCCESS;
+
+fail:
+    connection_free(conn);
+
+    return ret;
 }
 
-int driver_destroy(ca_context *c) {
+static int connection_attach(struct private *p) {
+    int ret;
+
+    ca_assert(p);
+    ca_assert(!p->connection);
+
+    if ((ret = allocate_mutex()) < 0)
+        return ret;
+
+    ca_mutex_lock(connection_mutex);
+
+    if (connection)
+        connection->ref++;
+    else if ((ret = connection_new(&connection, p->props)) < 0) {
+        ca_mutex_unlock(connection_mutex);
+        return ret;
+    }
+
+    p->connection = connection;
+
+    ca_mutex_unlock(connection_mutex);
+
+    pa_threaded_mainloop_lock(p->connection->mainloop);
+    CA_LLIST_PREPEND(struct private, p->connection->privates, p);
+    pa_threaded_mainloop_unlock(p->connection->mainloop);
+
+    return CA_SUCCESS;
+}
+
+static void connection_detach(struct private *p) {
+    struct connection *conn;
+    struct outstanding *out;
+
+    ca_assert(p);
+    ca_assert(p->connection);
+
+    conn = p->connection;
+
+    pa_threaded_mainloop_lock(conn->mainloop);
+
+    CA_LLIST_REMOVE(struct private, conn->privates, p);
+
+    /* Other contexts keep the connection alive, so we need to stop
+     * the samples that are still playing on behalf of this one
+     * ourselves. Streams are disconnected by outstanding_free(). */
+
+    if (conn->context) {
+        ca_mutex_lock(p->outstanding_mutex);
+
+        for (out = p->outstanding; out; out = out->next) {
+            pa_operation *o;
+
+            if (out->type != OUTSTANDING_SAMPLE || out->sink_input == PA_INVALID_INDEX)
+                continue;
+
+            if ((o = pa_context_kill_sink_input(conn->context, out->sink_input, NULL, NULL)))
+                pa_operation_unref(o);
+        }
+
+        ca_mutex_unlock(p->outstanding_mutex);
+    }
+
+    fail_outstanding(p, CA_ERROR_DESTROYED);
+
+    pa_threaded_mainloop_unlock(conn->mainloop);
+
+    p->connection = NULL;
+
+    ca_mutex_lock(connection_mutex);
+
+    if (--conn->ref > 0) {
+        ca_mutex_unlock(connection_mutex);
+        return;
+    }
+
+    connection = NULL;
+
+    ca_mutex_unlock(connection_mutex);
+
+    connection_free(conn);
+}
+
+#ifdef CA_GCC_DESTRUCTOR
+
+static void connection_mutex_free(void) CA_GCC_DESTRUCTOR;
+
+static void connection_mutex_free(void) {
+    /* Only here to make this valgrind clean */
+    if (connection_mutex) {
+        ca_mutex_free(connection_mutex);
+        connection_mutex = NULL;
+    }
+}
+
+#endif
+
+int driver_open(ca_context *c) {
     struct private *p;
+    int ret;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
-    ca_return_val_if_fail(c->private, CA_ERROR_STATE);
+    ca_return_val_if_fail(!c->driver || ca_streq(c->driver, "pulse"), CA_ERROR_NODRIVER);
+    ca_return_val_if_fail(!PRIVATE(c), CA_ERROR_STATE);
 
-    p = PRIVATE(c);
+    if (!(c->private = p = ca_new0(struct private, 1)))
+        return CA_ERROR_OOM;
 
-    if (p->mainloop)
-        pa_threaded_mainloop_stop(p->mainloop);
+    p->parent = c;
 
-    if (p->context) {
-        pa_context_disconnect(p->context);
-        pa_context_unref(p->context);
+    if (!(p->outstanding_mutex = ca_mutex_new())) {
+        driver_destroy(c);
+        return CA_ERROR_OOM;
     }
 
-    while (p->outstanding) {
-        struct outstanding *out = p->outstanding;
-        CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
+    if ((ret = convert_proplist(&p->props, c->props)) < 0) {
+        driver_destroy(c);
+        return ret;
+    }
 
-        if (out->callback)
-            out->callback(c, out->id, CA_ERROR_DESTROYED, out->userdata);
+    strip_prefix(p->props, "canberra.");
 
-        outstanding_free(out);
+    if ((ret = connection_attach(p)) < 0) {
+        driver_destroy(c);
+        return ret;
     }
 
-    if (p->mainloop)
-        pa_threaded_mainloop_free(p->mainloop);
+    return CA_SUCCESS;
+}
+
+int driver_destroy(ca_context *c) {
+    struct private *p;
+
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(c->private, CA_ERROR_STATE);
+
+    p = PRIVATE(c);
+
+    if (p->connection)
+        connection_detach(p);
 
     if (p->theme)
         ca_theme_data_free(p->theme);
@@ -418,6 +621,9 @@ int driver_destroy(ca_context *c) {
     if (p->outstanding_mutex)
         ca_mutex_free(p->outstanding_mutex);
 
+    if (p->props)
+        pa_proplist_free(p->props);
+
     ca_free(p);
 
     c->private = NULL;
@@ -438,9 +644,8 @@ int driver_change_device(ca_context *c, const char *device) {
 
 int driver_change_props(ca_context *c, ca_proplist *changed, ca_proplist *merged) {
     struct private *p;
-    pa_operation *o;
     pa_proplist *l;
-    int ret = CA_SUCCESS;
+    int ret;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(changed, CA_ERROR_INVALID);
@@ -449,79 +654,67 @@ int driver_change_props(ca_context *c, ca_proplist *changed, ca_proplist *merged
 
     p = PRIVATE(c);
 
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
-
-    pa_threaded_mainloop_lock(p->mainloop);
-
-    if (!p->context) {
-        pa_threaded_mainloop_unlock(p->mainloop);
-        return CA_ERROR_STATE; /* can be silently ignored */
-    }
-
     if ((ret = convert_proplist(&l, changed)) < 0)
         return ret;
 
     strip_prefix(l, "canberra.");
 
-    /* We start these asynchronously and don't care about the return
-     * value */
-
-    if (!(o = pa_context_proplist_update(p->context, PA_UPDATE_REPLACE, l, NULL, NULL)))
-        ret = translate_error(pa_context_errno(p->context));
-    else
-        pa_operation_unref(o);
-
-    pa_threaded_mainloop_unlock(p->mainloop);
+    /* The client properties belong to all contexts sharing the
+     * connection, hence we leave them alone. Streams created from
+     * now on pick this up via add_context_props(). */
+    pa_proplist_update(p->props, PA_UPDATE_REPLACE, l);
 
     pa_proplist_free(l);
 
-    return ret;
+    return CA_SUCCESS;
 }
 
 static int subscribe(ca_context *c) {
-    struct private *p;
+    struct connection *conn;
     pa_operation *o;
     int ret = CA_SUCCESS;
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(c->private, CA_ERROR_STATE);
-    p = PRIVATE(c);
+    ca_return_val_if_fail(conn = PRIVATE(c)->connection, CA_ERROR_STATE);
 
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
+    pa_threaded_mainloop_lock(conn->mainloop);
 
-    if (p->subscribed)
+    if (conn->subscribed) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
         return CA_SUCCESS;
+    }
 
-    pa_threaded_mainloop_lock(p->mainloop);
-
-    if (!p->context) {
-        pa_threaded_mainloop_unlock(p->mainloop);
+    if (!conn->context) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
         return CA_ERROR_STATE;
     }
 
     /* We start these asynchronously and don't care about the return
      * value */
 
-    if (!(o = pa_context_subscribe(p->context, PA_SUBSCRIPTION_MASK_SINK_INPUT, NULL, NULL)))
-        ret = translate_error(pa_context_errno(p->context));
+    if (!(o = pa_context_subscribe(conn->context, PA_SUBSCRIPTION_MASK_SINK_INPUT, NULL, NULL)))
+        ret = translate_error(pa_context_errno(conn->context));
     else
         pa_operation_unref(o);
 
-    pa_threaded_mainloop_unlock(p->mainloop);
+    conn->subscribed = TRUE;
 
-    p->subscribed = TRUE;
+    pa_threaded_mainloop_unlock(conn->mainloop);
 
     return ret;
 }
 
 static void play_sample_cb(pa_context *c, uint32_t idx, void *userdata) {
     struct private *p;
+    struct connection *conn;
     struct outstanding *out = userdata;
 
     ca_assert(c);
     ca_assert(out);
 
     p = PRIVATE(out->context);
+    conn = p->connection;
 
     if (idx != PA_INVALID_INDEX) {
         out->error = CA_SUCCESS;
@@ -529,17 +722,19 @@ static void play_sample_cb(pa_context *c, uint32_t idx, void *userdata) {
     } else
         out->error = translate_error(pa_context_errno(c));
 
-    pa_threaded_mainloop_signal(p->mainloop, FALSE);
+    pa_threaded_mainloop_signal(conn->mainloop, FALSE);
 }
 
 static void stream_state_cb(pa_stream *s, void *userdata) {
     struct private *p;
+    struct connection *conn;
     struct outstanding *out = userdata;
 
     ca_assert(s);
     ca_assert(out);
 
     p = PRIVATE(out->context);
+    conn = p->connection;
 
     if (out->clean_up) {
         pa_stream_state_t state;
@@ -553,26 +748,36 @@ static void stream_state_cb(pa_stream *s, void *userdata) {
             CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
             ca_mutex_unlock(p->outstanding_mutex);
 
-            err = state == PA_STREAM_FAILED ? translate_error(pa_context_errno(pa_stream_get_context(s))) : CA_ERROR_DESTROYED;
+            if (state == PA_STREAM_FAILED)
+                err = translate_error(pa_context_errno(pa_stream_get_context(s)));
+            else if (out->type == OUTSTANDING_UPLOAD)
+                /* Upload streams terminate once the sample is in the cache */
+                err = CA_SUCCESS;
+            else
+                err = CA_ERROR_DESTROYED;
 
-            if (out->callback)
+            if (out->callback) {
+                CA_PROBE4(callback, "pulse", out->context, out->id, err);
                 out->callback(out->context, out->id, err, out->userdata);
+            }
 
             outstanding_free(out);
         }
     }
 
-    pa_threaded_mainloop_signal(p->mainloop, FALSE);
+    pa_threaded_mainloop_signal(conn->mainloop, FALSE);
 }
 
 static void stream_drain_cb(pa_stream *s, int success, void *userdata) {
     struct private *p;
+    struct connection *conn;
     struct outstanding *out = userdata;
 
     ca_assert(s);
     ca_assert(out);
 
     p = PRIVATE(out->context);
+    conn = p->connection;
 
     ca_assert(out->type == OUTSTANDING_STREAM);
     ca_assert(out->clean_up);
@@ -584,7 +789,8 @@ static void stream_drain_cb(pa_stream *s, int success, void *userdata) {
     if (out->callback) {
         int err;
 
-        err = success ? CA_SUCCESS : translate_error(pa_context_errno(p->context));
+        err = success ? CA_SUCCESS : translate_error(pa_context_errno(conn->context));
+        CA_PROBE4(callback, "pulse", out->context, out->id, err);
         out->callback(out->context, out->id, err, out->userdata);
     }
 
@@ -594,6 +800,7 @@ static void stream_drain_cb(pa_stream *s, int success, void *userdata) {
 static void stream_write_cb(pa_stream *s, size_t bytes, void *userdata) {
     struct outstanding *out = userdata;
     struct private *p;
+    struct connection *conn;
     void *data;
     int ret;
 
@@ -602,6 +809,7 @@ static void stream_write_cb(pa_stream *s, size_t bytes, void *userdata) {
     ca_assert(out);
 
     p = PRIVATE(out->context);
+    conn = p->connection;
 
     while (bytes > 0) {
         size_t rbytes = bytes;
@@ -624,6 +832,8 @@ static void stream_write_cb(pa_stream *s, size_t bytes, void *userdata) {
             goto finish;
         }
 
+        CA_PROBE4(driver_write, "pulse", out->context, out->id, rbytes);
+
         data = NULL;
 
         bytes -= rbytes;
@@ -636,19 +846,19 @@ static void stream_write_cb(pa_stream *s, size_t bytes, void *userdata) {
         if (out->type == OUTSTANDING_UPLOAD) {
 
             if (pa_stream_finish_upload(s) < 0) {
-                ret = translate_error(pa_context_errno(p->context));
+                ret = translate_error(pa_context_errno(conn->context));
                 goto finish;
             }
 
-            /* Let's just signal driver_cache() which has been waiting for us */
-            pa_threaded_mainloop_signal(p->mainloop, FALSE);
+            /* The stream will terminate as soon as the server has
+             * the sample, stream_state_cb() will then notify us */
 
         } else {
             pa_operation *o;
             ca_assert(out->type == OUTSTANDING_STREAM);
 
             if (!(o = pa_stream_drain(s, stream_drain_cb, out))) {
-                ret = translate_error(pa_context_errno(p->context));
+                ret = translate_error(pa_context_errno(conn->context));
                 goto finish;
             }
 
@@ -671,13 +881,15 @@ finish:
         CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
         ca_mutex_unlock(p->outstanding_mutex);
 
-        if (out->callback)
+        if (out->callback) {
+            CA_PROBE4(callback, "pulse", out->context, out->id, ret);
             out->callback(out->context, out->id, ret, out->userdata);
+        }
 
         outstanding_free(out);
     } else {
         pa_stream_disconnect(s);
-        pa_threaded_mainloop_signal(p->mainloop, FALSE);
+        pa_threaded_mainloop_signal(conn->mainloop, FALSE);
         out->error = ret;
     }
 }
@@ -729,6 +941,7 @@ static ca_bool_t convert_channel_map(ca_sound_file *f, pa_channel_map *cm) {
 
 int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
     struct private *p;
+    struct connection *conn;
     pa_proplist *l = NULL;
     const char *n, *vol, *ct, *channel;
     char *name = NULL;
@@ -744,6 +957,9 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
     pa_channel_position_t position = PA_CHANNEL_POSITION_INVALID;
     ca_bool_t cm_good;
     ca_cache_control_t cache_control = CA_CACHE_CONTROL_NEVER;
+    ca_latency_t latency;
+    unsigned usec;
+    pa_buffer_attr ba;
     struct outstanding *out = NULL;
     int try = 3;
     int ret;
@@ -757,7 +973,7 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
 
     p = PRIVATE(c);
 
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
+    ca_return_val_if_fail(conn = p->connection, CA_ERROR_STATE);
 
     if (!(out = ca_new0(struct outstanding, 1))) {
         ret = CA_ERROR_OOM;
@@ -820,7 +1036,13 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
         }
     }
 
+    /* This one may be set on the context, too */
+    if ((ret = ca_get_latency(&latency, c->props, proplist)) < 0)
+        goto finish;
+
     strip_prefix(l, "canberra.");
+
+    add_context_props(l, p);
     add_common(l);
 
     if ((ret = subscribe(c)) < 0)
@@ -833,12 +1055,18 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
         for (;;) {
             ca_bool_t canceled;
 
-            pa_threaded_mainloop_lock(p->mainloop);
+            pa_threaded_mainloop_lock(conn->mainloop);
+
+            if (!conn->context) {
+                pa_threaded_mainloop_unlock(conn->mainloop);
+                ret = CA_ERROR_STATE;
+                goto finish;
+            }
 
             /* Let's try to play the sample */
-            if (!(o = pa_context_play_sample_with_proplist(p->context, name, c->device, v, l, play_sample_cb, out))) {
-                ret = translate_error(pa_context_errno(p->context));
-                pa_threaded_mainloop_unlock(p->mainloop);
+            if (!(o = pa_context_play_sample_with_proplist(conn->context, name, c->device, v, l, play_sample_cb, out))) {
+                ret = translate_error(pa_context_errno(conn->context));
+                pa_threaded_mainloop_unlock(conn->mainloop);
                 goto finish;
             }
 
@@ -853,12 +1081,12 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
                     break;
                 }
 
-                pa_threaded_mainloop_wait(p->mainloop);
+                pa_threaded_mainloop_wait(conn->mainloop);
             }
 
             pa_operation_unref(o);
 
-            pa_threaded_mainloop_unlock(p->mainloop);
+            pa_threaded_mainloop_unlock(conn->mainloop);
 
             /* The operation might have been canceled due to connection termination */
             if (canceled) {
@@ -922,11 +1150,17 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
         name = ca_strdup(n);
     }
 
-    pa_threaded_mainloop_lock(p->mainloop);
+    pa_threaded_mainloop_lock(conn->mainloop);
 
-    if (!(out->stream = pa_stream_new_with_proplist(p->context, name, &ss, cm_good ? &cm : NULL, l))) {
-        ret = translate_error(pa_context_errno(p->context));
-        pa_threaded_mainloop_unlock(p->mainloop);
+    if (!conn->context) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
+        ret = CA_ERROR_STATE;
+        goto finish;
+    }
+
+    if (!(out->stream = pa_stream_new_with_proplist(conn->context, name, &ss, cm_good ? &cm : NULL, l))) {
+        ret = translate_error(pa_context_errno(conn->context));
+        pa_threaded_mainloop_unlock(conn->mainloop);
         goto finish;
     }
 
@@ -936,16 +1170,27 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
     if (volume_set)
         pa_cvolume_set(&cvol, ss.channels, v);
 
-    if (pa_stream_connect_playback(out->stream, NULL, NULL,
+    if ((usec = ca_latency_usec(latency)) > 0) {
+        /* Ask for a total latency of usec, and start playback as soon
+         * as the first period worth of data has been written */
+        ba.maxlength = (uint32_t) -1;
+        ba.tlength = (uint32_t) pa_usec_to_bytes(usec, &ss);
+        ba.prebuf = (uint32_t) pa_usec_to_bytes(usec / CA_LATENCY_PERIODS, &ss);
+        ba.minreq = (uint32_t) -1;
+        ba.fragsize = (uint32_t) -1;
+    }
+
+    if (pa_stream_connect_playback(out->stream, NULL, usec > 0 ? &ba : NULL,
 #ifdef PA_STREAM_FAIL_ON_SUSPEND
                                    PA_STREAM_FAIL_ON_SUSPEND
 #else
                                    0
 #endif
                                    | (position != PA_CHANNEL_POSITION_INVALID ? PA_STREAM_NO_REMIX_CHANNELS : 0)
+                                   | (usec > 0 ? PA_STREAM_ADJUST_LATENCY : 0)
                                    , volume_set ? &cvol : NULL, NULL) < 0) {
-        ret = translate_error(pa_context_errno(p->context));
-        pa_threaded_mainloop_unlock(p->mainloop);
+        ret = translate_error(pa_context_errno(conn->context));
+        pa_threaded_mainloop_unlock(conn->mainloop);
         goto finish;
     }
 
@@ -958,30 +1203,30 @@ int driver_play(ca_context *c, uint32_t id, ca_proplist *proplist, ca_finish_cal
 
         /* Check for failure */
         if (state == PA_STREAM_FAILED) { /* it means it was disconnected */
-            if (pa_context_errno(p->context) == PA_OK) /* and context reconnected immediately */
+            if (pa_context_errno(conn->context) == PA_OK) /* and context reconnected immediately */
                 ret = CA_ERROR_STATE;
             else
-                ret = translate_error(pa_context_errno(p->context));
-            pa_threaded_mainloop_unlock(p->mainloop);
+                ret = translate_error(pa_context_errno(conn->context));
+            pa_threaded_mainloop_unlock(conn->mainloop);
             goto finish;
         }
 
         if (state == PA_STREAM_TERMINATED) {
             ret = out->error;
-            pa_threaded_mainloop_unlock(p->mainloop);
+            pa_threaded_mainloop_unlock(conn->mainloop);
             goto finish;
         }
 
-        pa_threaded_mainloop_wait(p->mainloop);
+        pa_threaded_mainloop_wait(conn->mainloop);
     }
 
     if ((out->sink_input = pa_stream_get_index(out->stream)) == PA_INVALID_INDEX) {
-        ret = translate_error(pa_context_errno(p->context));
-        pa_threaded_mainloop_unlock(p->mainloop);
+        ret = translate_error(pa_context_errno(conn->context));
+        pa_threaded_mainloop_unlock(conn->mainloop);
         goto finish;
     }
 
-    pa_threaded_mainloop_unlock(p->mainloop);
+    pa_threaded_mainloop_unlock(conn->mainloop);
 
     ret = CA_SUCCESS;
 
@@ -1007,6 +1252,7 @@ finish:
 
 int driver_cancel(ca_context *c, uint32_t id) {
     struct private *p;
+    struct connection *conn;
     pa_operation *o;
     int ret = CA_SUCCESS;
     struct outstanding *out, *n;
@@ -1016,12 +1262,12 @@ int driver_cancel(ca_context *c, uint32_t id) {
 
     p = PRIVATE(c);
 
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
+    ca_return_val_if_fail(conn = p->connection, CA_ERROR_STATE);
 
-    pa_threaded_mainloop_lock(p->mainloop);
+    pa_threaded_mainloop_lock(conn->mainloop);
 
-    if (!p->context) {
-        pa_threaded_mainloop_unlock(p->mainloop);
+    if (!conn->context) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
         return CA_ERROR_STATE;
     }
 
@@ -1039,8 +1285,8 @@ int driver_cancel(ca_context *c, uint32_t id) {
             out->sink_input == PA_INVALID_INDEX)
             continue;
 
-        if (!(o = pa_context_kill_sink_input(p->context, out->sink_input, NULL, NULL)))
-            ret2 = translate_error(pa_context_errno(p->context));
+        if (!(o = pa_context_kill_sink_input(conn->context, out->sink_input, NULL, NULL)))
+            ret2 = translate_error(pa_context_errno(conn->context));
         else
             pa_operation_unref(o);
 
@@ -1051,8 +1297,10 @@ int driver_cancel(ca_context *c, uint32_t id) {
         if (ret2 && ret == CA_SUCCESS)
             ret = ret2;
 
-        if (out->callback)
+        if (out->callback) {
+            CA_PROBE4(callback, "pulse", c, out->id, CA_ERROR_CANCELED);
             out->callback(c, out->id, CA_ERROR_CANCELED, out->userdata);
+        }
 
         CA_LLIST_REMOVE(struct outstanding, p->outstanding, out);
         outstanding_free(out);
@@ -1060,13 +1308,14 @@ int driver_cancel(ca_context *c, uint32_t id) {
 
     ca_mutex_unlock(p->outstanding_mutex);
 
-    pa_threaded_mainloop_unlock(p->mainloop);
+    pa_threaded_mainloop_unlock(conn->mainloop);
 
     return ret;
 }
 
-int driver_cache(ca_context *c, ca_proplist *proplist) {
+int driver_cache_async(ca_context *c, ca_proplist *proplist, ca_finish_callback_t cb, void *userdata) {
     struct private *p;
+    struct connection *conn;
     pa_proplist *l = NULL;
     const char *n, *ct;
     char *name = NULL;
@@ -1080,11 +1329,12 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
 
     ca_return_val_if_fail(c, CA_ERROR_INVALID);
     ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(!userdata || cb, CA_ERROR_INVALID);
     ca_return_val_if_fail(c->private, CA_ERROR_STATE);
 
     p = PRIVATE(c);
 
-    ca_return_val_if_fail(p->mainloop, CA_ERROR_STATE);
+    ca_return_val_if_fail(conn = p->connection, CA_ERROR_STATE);
 
     if (!(out = ca_new0(struct outstanding, 1))) {
         ret = CA_ERROR_OOM;
@@ -1094,6 +1344,8 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
     out->type = OUTSTANDING_UPLOAD;
     out->context = c;
     out->sink_input = PA_INVALID_INDEX;
+    out->callback = cb;
+    out->userdata = userdata;
 
     if ((ret = convert_proplist(&l, proplist)) < 0)
         goto finish;
@@ -1145,18 +1397,18 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
 
     cm_good = convert_channel_map(out->file, &cm);
 
-    pa_threaded_mainloop_lock(p->mainloop);
+    pa_threaded_mainloop_lock(conn->mainloop);
 
-    if (!p->context) {
-        pa_threaded_mainloop_unlock(p->mainloop);
+    if (!conn->context) {
+        pa_threaded_mainloop_unlock(conn->mainloop);
         ret = CA_ERROR_STATE;
         goto finish;
     }
 
-    if (!(out->stream = pa_stream_new_with_proplist(p->context, name, &ss, cm_good ? &cm : NULL, l))) {
-        ret = translate_error(pa_context_errno(p->context));
+    if (!(out->stream = pa_stream_new_with_proplist(conn->context, name, &ss, cm_good ? &cm : NULL, l))) {
+        ret = translate_error(pa_context_errno(conn->context));
 
-        pa_threaded_mainloop_unlock(p->mainloop);
+        pa_threaded_mainloop_unlock(conn->mainloop);
         goto finish;
     }
 
@@ -1164,35 +1416,30 @@ int driver_cache(ca_context *c, ca_proplist *proplist) {
     pa_stream_set_write_callback(out->stream, stream_write_cb, out);
 
     if (pa_stream_connect_upload(out->stream, (size_t) ca_sound_file_get_size(out->file)) < 0) {
-        ret = translate_error(pa_context_errno(p->context));
-        pa_threaded_mainloop_unlock(p->mainloop);
+        ret = translate_error(pa_context_errno(conn->context));
+        pa_threaded_mainloop_unlock(conn->mainloop);
         goto finish;
     }
 
-    for (;;) {
-        pa_stream_state_t state = pa_stream_get_state(out->stream);
-
-        /* Stream sucessfully created and uploaded */
-        if (state == PA_STREAM_TERMINATED)
-            break;
+    /* From now on the stream callbacks take care of this upload. We
+     * need to register it before we release the lock, since they
+     * might fire right away. */
+    out->clean_up = TRUE;
 
-        /* Check for failure */
-        if (state == PA_STREAM_FAILED) {
-            ret = translate_error(pa_context_errno(p->context));
-            pa_threaded_mainloop_unlock(p->mainloop);
-            goto finish;
-        }
+    ca_mutex_lock(p->outstanding_mutex);
+    CA_LLIST_PREPEND(struct outstanding, p->outstanding, out);
+    ca_mutex_unlock(p->outstanding_mutex);
 
-        pa_threaded_mainloop_wait(p->mainloop);
-    }
+    out = NULL;
 
-    pa_threaded_mainloop_unlock(p->mainloop);
+    pa_threaded_mainloop_unlock(conn->mainloop);
 
     ret = CA_SUCCESS;
 
 finish:
 
-    outstanding_free(out);
+    if (out)
+        outstanding_free(out);
 
     if (l)
         pa_proplist_free(l);
@@ -1201,3 +1448,51 @@ finish:
 
     return ret;
 }
+
+struct cache_sync {
+    struct connection *connection;
+    ca_bool_t done;
+    int error;
+};
+
+static void cache_sync_cb(ca_context *c, uint32_t id, int error, void *userdata) {
+    struct cache_sync *s = userdata;
+
+    /* Always called with the mainloop lock held */
+
+    s->error = error;
+    s->done = TRUE;
+
+    pa_threaded_mainloop_signal(s->connection->mainloop, FALSE);
+}
+
+int driver_cache(ca_context *c, ca_proplist *proplist) {
+    struct private *p;
+    struct connection *conn;
+    struct cache_sync s;
+    int ret;
+
+    ca_return_val_if_fail(c, CA_ERROR_INVALID);
+    ca_return_val_if_fail(proplist, CA_ERROR_INVALID);
+    ca_return_val_if_fail(c->private, CA_ERROR_STATE);
+
+    p = PRIVATE(c);
+
+    ca_return_val_if_fail(conn = p->connection, CA_ERROR_STATE);
+
+    s.connection = conn;
+    s.done = FALSE;
+    s.error = CA_SUCCESS;
+
+    if ((ret = driver_cache_async(c, proplist, cache_sync_cb, &s)) < 0)
+        return ret;
+
+    pa_threaded_mainloop_lock(conn->mainloop);
+
+    while (!s.done)
+        pa_threaded_mainloop_wait(conn->mainloop);
+
+    pa_threaded_mainloop_unlock(conn->mainloop);
+
+    return s.error;
+}
@@ -23,17 +23,86 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "read-sound-file.h"
 #include "read-wav.h"
 #include "read-vorbis.h"
 #include "macro.h"
 #include "malloc.h"
+#include "mutex.h"
+#include "llist.h"
 #include "canberra.h"
+#include "probes.h"
+
+/* Default budget for the PCM cache, may be overridden in KiB with
+ * $CANBERRA_PCM_CACHE_SIZE. Half of it may be used for raw PCM of the
+ * most recently used sounds, everything else is kept compressed. */
+#define PCM_CACHE_SIZE_DEFAULT ((size_t) (4U*1024U*1024U))
+
+/* Compressed PCM is stored in independently decodable blocks of this
+ * many frames */
+#define PCM_BLOCK_FRAMES 64U
+#define PCM_CHANNELS_MAX 8U
+
+/* A compressed entry that is used this many times is decompressed
+ * again */
+#define PCM_PROMOTE_HITS 2U
+
+/* The actual sample data of a cache entry, either raw PCM or
+ * compressed. It never changes once created, so readers may access
+ * it without holding the lock. When an entry is compressed or
+ * decompressed it simply gets a new one. */
+struct pcm_data {
+    unsigned ref;
+
+    uint8_t *data;
+    size_t size;
+
+    /* Only set for compressed data: the offset of each block in
+     * data */
+    uint32_t *blocks;
+    unsigned n_blocks;
+};
+
+/* A fully decoded sound file, kept in memory so that playing it again
+ * needs neither file access nor decoding */
+struct pcm_entry {
+    CA_LLIST_FIELDS(struct pcm_entry);
+
+    unsigned ref;
+    ca_bool_t dead;
+
+    char *filename;
+    time_t mtime;
+    off_t file_size;
+
+    unsigned nchannels;
+    unsigned rate;
+    ca_sample_type_t type;
+    ca_channel_position_t *channel_map;
+
+    /* The decoded size */
+    size_t size;
+
+    struct pcm_data *data;
+    ca_bool_t incompressible;
+    unsigned hits;
+
+    /* Set while a thread converts the data without holding
+     * pcm_mutex */
+    ca_bool_t busy;
+};
 
 struct ca_sound_file {
     ca_wav *wav;
     ca_vorbis *vorbis;
+    struct pcm_entry *pcm;
+    struct pcm_data *pcm_data;
+    size_t pcm_index;
     char *filename;
 
     unsigned nchannels;
@@ -41,7 +110,523 @@ struct ca_sound_file {
     ca_sample_type_t type;
 };
 
-int ca_sound_file_open(ca_sound_file **_f, const char *fn) {
+/* This part is not portable due to pthread_once usage, should be abstracted
+ * when we port this to platforms that do not have POSIX threading */
+
+static ca_mutex *pcm_mutex = NULL;
+static CA_LLIST_HEAD(struct pcm_entry, pcm_entries) = NULL;
+
+/* Memory used by all entries, and by those kept raw */
+static size_t pcm_size = 0, pcm_raw_size = 0;
+static size_t pcm_size_max = PCM_CACHE_SIZE_DEFAULT;
+
+static void allocate_mutex_once(void) {
+    const char *e;
+
+    if ((e = getenv("CANBERRA_PCM_CACHE_SIZE"))) {
+        char *end = NULL;
+        unsigned long k;
+
+        errno = 0;
+        k = strtoul(e, &end, 10);
+
+        if (errno == 0 && end && end != e && !*end)
+            pcm_size_max = (size_t) k * 1024U;
+    }
+
+    pcm_mutex = ca_mutex_new();
+}
+
+static int allocate_mutex(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if (pthread_once(&once, allocate_mutex_once) != 0)
+        return CA_ERROR_OOM;
+
+    if (!pcm_mutex)
+        return CA_ERROR_OOM;
+
+    return 0;
+}
+
+static struct pcm_data *pcm_data_new(uint8_t *data, size_t size, uint32_t *blocks, unsigned n_blocks) {
+    struct pcm_data *d;
+
+    if (!(d = ca_new0(struct pcm_data, 1)))
+        return NULL;
+
+    d->ref = 1;
+    d->data = data;
+    d->size = size;
+    d->blocks = blocks;
+    d->n_blocks = n_blocks;
+
+    return d;
+}
+
+static void pcm_data_free(struct pcm_data *d) {
+    ca_assert(d);
+
+    ca_free(d->data);
+    ca_free(d->blocks);
+    ca_free(d);
+}
+
+/* Needs to be called with pcm_mutex held */
+static ca_bool_t pcm_data_unref_unlocked(struct pcm_data *d) {
+    ca_assert(d);
+    ca_assert(d->ref >= 1);
+
+    return --d->ref <= 0;
+}
+
+static void pcm_entry_free(struct pcm_entry *e) {
+    ca_assert(e);
+
+    ca_free(e->filename);
+    ca_free(e->channel_map);
+
+    if (e->data)
+        pcm_data_free(e->data);
+
+    ca_free(e);
+}
+
+/* Needs to be called with pcm_mutex held. Replaces the sample data of
+ * an entry, the old data is freed as soon as no reader uses it
+ * anymore. */
+static void pcm_entry_set_data(struct pcm_entry *e, struct pcm_data *d) {
+    ca_assert(e);
+    ca_assert(e->data);
+    ca_assert(d);
+
+    pcm_size -= e->data->size;
+    if (!e->data->n_blocks)
+        pcm_raw_size -= e->data->size;
+
+    if (pcm_data_unref_unlocked(e->data))
+        pcm_data_free(e->data);
+
+    e->data = d;
+
+    pcm_size += d->size;
+    if (!d->n_blocks)
+        pcm_raw_size += d->size;
+}
+
+/* Needs to be called with pcm_mutex held */
+static void pcm_entry_kill(struct pcm_entry *e) {
+    ca_assert(e);
+    ca_assert(!e->dead);
+
+    CA_LLIST_REMOVE(struct pcm_entry, pcm_entries, e);
+    pcm_size -= e->data->size;
+    if (!e->data->n_blocks)
+        pcm_raw_size -= e->data->size;
+    e->dead = TRUE;
+
+    /* Files still reading from this entry keep it alive */
+    if (e->ref <= 0)
+        pcm_entry_free(e);
+}
+
+static void pcm_entry_unref(struct pcm_entry *e, struct pcm_data *d) {
+    ca_bool_t free_it, free_data;
+
+    ca_assert(e);
+    ca_assert(d);
+
+    ca_mutex_lock(pcm_mutex);
+    ca_assert(e->ref >= 1);
+    free_it = --e->ref <= 0 && e->dead;
+
+    /* The entry holds a reference on its current data, so this only
+     * frees data that has been replaced in the meantime */
+    free_data = pcm_data_unref_unlocked(d);
+    ca_mutex_unlock(pcm_mutex);
+
+    if (free_data)
+        pcm_data_free(d);
+
+    if (free_it)
+        pcm_entry_free(e);
+}
+
+/* The codec for compressed PCM. Each block starts with the bit width
+ * used, followed by the first frame verbatim. For every further
+ * sample the difference to the previous sample of the same channel is
+ * zigzag encoded and packed with that bit width. This is lossless,
+ * works on any 16 bit data regardless of byte order and decodes at
+ * memcpy-like speeds. */
+
+static size_t pcm_block_bound(unsigned frames, unsigned nchannels) {
+    return 1U + nchannels * sizeof(int16_t) + ((frames - 1U) * nchannels * 17U + 7U) / 8U;
+}
+
+static size_t pcm_block_compress(const int16_t *s, unsigned frames, unsigned nchannels, uint8_t *out) {
+    uint32_t max = 0;
+    unsigned i, n, bits = 0;
+    uint64_t acc = 0;
+    unsigned nacc = 0;
+    uint8_t *o;
+
+    n = frames * nchannels;
+
+    for (i = nchannels; i < n; i++) {
+        int32_t d = (int32_t) s[i] - (int32_t) s[i - nchannels];
+        max |= ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+    }
+
+    while (bits < 32 && (max >> bits))
+        bits++;
+
+    out[0] = (uint8_t) bits;
+    memcpy(out + 1, s, nchannels * sizeof(int16_t));
+    o = out + 1 + nchannels * sizeof(int16_t);
+
+    if (bits <= 0)
+        return (size_t) (o - out);
+
+    for (i = nchannels; i < n; i++) {
+        int32_t d = (int32_t) s[i] - (int32_t) s[i - nchannels];
+
+        acc |= (uint64_t) (((uint32_t) d << 1) ^ (uint32_t) (d >> 31)) << nacc;
+        nacc += bits;
+
+        while (nacc >= 8) {
+            *(o++) = (uint8_t) acc;
+            acc >>= 8;
+            nacc -= 8;
+        }
+    }
+
+    if (nacc > 0)
+        *(o++) = (uint8_t) acc;
+
+    return (size_t) (o - out);
+}
+
+static void pcm_block_decompress(const uint8_t *in, unsigned frames, unsigned nchannels, int16_t *s) {
+    unsigned i, n, bits;
+    uint64_t acc = 0;
+    unsigned nacc = 0;
+    uint32_t mask;
+
+    n = frames * nchannels;
+    bits = in[0];
+
+    memcpy(s, in + 1, nchannels * sizeof(int16_t));
+    in += 1 + nchannels * sizeof(int16_t);
+
+    if (bits <= 0) {
+        for (i = nchannels; i < n; i++)
+            s[i] = s[i - nchannels];
+        return;
+    }
+
+    mask = (uint32_t) ((1ULL << bits) - 1U);
+
+    for (i = nchannels; i < n; i++) {
+        uint32_t z;
+
+        while (nacc < bits) {
+            acc |= (uint64_t) *(in++) << nacc;
+            nacc += 8;
+        }
+
+        z = (uint32_t) acc & mask;
+        acc >>= bits;
+        nacc -= bits;
+
+        s[i] = (int16_t) (uint16_t) ((uint32_t) (uint16_t) s[i - nchannels] + ((z >> 1) ^ (0U - (z & 1U))));
+    }
+}
+
+/* Works on data nobody modifies anymore, hence needs no lock */
+static int pcm_compress(struct pcm_data **_d, const struct pcm_data *raw, unsigned nchannels, ca_sample_type_t type) {
+    size_t fs, block_size, n = 0, max;
+    unsigned n_blocks, b;
+    uint8_t *out = NULL, *data;
+    uint32_t *blocks = NULL;
+
+    ca_assert(_d);
+    ca_assert(raw);
+    ca_assert(!raw->n_blocks);
+
+    fs = nchannels * sizeof(int16_t);
+
+    if (type == CA_SAMPLE_U8 ||
+        nchannels > PCM_CHANNELS_MAX ||
+        raw->size % fs != 0)
+        return CA_ERROR_NOTSUPPORTED;
+
+    block_size = PCM_BLOCK_FRAMES * fs;
+    n_blocks = (unsigned) ((raw->size / fs + PCM_BLOCK_FRAMES - 1U) / PCM_BLOCK_FRAMES);
+
+    /* There's no point in storing it compressed if it doesn't get
+     * smaller than that */
+    max = raw->size - raw->size / 8U;
+
+    if (n_blocks <= 0 ||
+        !(out = ca_malloc(max)) ||
+        !(blocks = ca_new(uint32_t, n_blocks))) {
+        ca_free(out);
+        return CA_ERROR_OOM;
+    }
+
+    for (b = 0; b < n_blocks; b++) {
+        unsigned frames;
+
+        frames = (unsigned) ((raw->size - b * block_size) / fs);
+        if (frames > PCM_BLOCK_FRAMES)
+            frames = PCM_BLOCK_FRAMES;
+
+        if (n + pcm_block_bound(frames, nchannels) > max) {
+            ca_free(out);
+            ca_free(blocks);
+            return CA_ERROR_TOOBIG;
+        }
+
+        blocks[b] = (uint32_t) n;
+        n += pcm_block_compress((const int16_t*) (raw->data + b * block_size), frames, nchannels, out + n);
+    }
+
+    data = ca_memdup(out, n);
+    ca_free(out);
+
+    if (!data || !(*_d = pcm_data_new(data, n, blocks, n_blocks))) {
+        ca_free(data);
+        ca_free(blocks);
+        return CA_ERROR_OOM;
+    }
+
+    return CA_SUCCESS;
+}
+
+static void pcm_decompress(const struct pcm_data *d, size_t size, unsigned nchannels, size_t index, uint8_t *dst, size_t n) {
+    int16_t tmp[PCM_BLOCK_FRAMES * PCM_CHANNELS_MAX];
+    size_t fs, block_size;
+
+    ca_assert(d);
+    ca_assert(d->n_blocks > 0);
+
+    fs = nchannels * sizeof(int16_t);
+    block_size = PCM_BLOCK_FRAMES * fs;
+
+    while (n > 0) {
+        size_t b, offset, l, k;
+        unsigned frames;
+
+        b = index / block_size;
+        offset = index % block_size;
+
+        ca_assert(b < d->n_blocks);
+
+        frames = (unsigned) ((size - b * block_size) / fs);
+        if (frames > PCM_BLOCK_FRAMES)
+            frames = PCM_BLOCK_FRAMES;
+
+        l = frames * fs;
+
+        if (offset == 0 && n >= l) {
+            /* Whole blocks go right into the destination buffer */
+            pcm_block_decompress(d->data + d->blocks[b], frames, nchannels, (int16_t*) dst);
+            k = l;
+        } else {
+            pcm_block_decompress(d->data + d->blocks[b], frames, nchannels, tmp);
+            k = l - offset;
+            if (k > n)
+                k = n;
+            memcpy(dst, (uint8_t*) tmp + offset, k);
+        }
+
+        index += k;
+        dst += k;
+        n -= k;
+    }
+}
+
+/* Works on data nobody modifies anymore, hence needs no lock */
+static int pcm_uncompress(struct pcm_data **_d, const struct pcm_data *z, size_t size, unsigned nchannels) {
+    uint8_t *data;
+
+    ca_assert(_d);
+    ca_assert(z);
+    ca_assert(z->n_blocks > 0);
+
+    if (!(data = ca_malloc(size)))
+        return CA_ERROR_OOM;
+
+    pcm_decompress(z, size, nchannels, 0, data, size);
+
+    if (!(*_d = pcm_data_new(data, size, NULL, 0))) {
+        ca_free(data);
+        return CA_ERROR_OOM;
+    }
+
+    return CA_SUCCESS;
+}
+
+/* Needs to be called with pcm_mutex held. Installs data that was
+ * converted from old without holding the lock, unless the entry was
+ * dropped or got new data in the meantime. Frees whatever is not
+ * used. */
+static void pcm_entry_swap_data(struct pcm_entry *e, struct pcm_data *old, struct pcm_data *d) {
+    ca_assert(e);
+    ca_assert(old);
+
+    e->busy = FALSE;
+
+    if (d && !e->dead && e->data == old)
+        pcm_entry_set_data(e, d);
+    else if (d)
+        pcm_data_free(d);
+}
+
+/* Needs to be called without pcm_mutex held. Compresses the least
+ * recently used raw entries until the raw ones fit into their share of
+ * the budget, and then drops the least recently used entries until
+ * everything fits. The most recently used entry is always kept. The
+ * compression itself is done without holding the lock, so that other
+ * threads can open cached files meanwhile. */
+static void pcm_balance(void) {
+    struct pcm_entry *e;
+
+    for (;;) {
+        struct pcm_entry *victim = NULL;
+        struct pcm_data *old, *d = NULL;
+
+        ca_mutex_lock(pcm_mutex);
+
+        /* Never the most recently used one, so that we don't compress
+         * what we just decompressed */
+        if (pcm_entries && pcm_raw_size > pcm_size_max / 2U)
+            for (e = pcm_entries->next; e; e = e->next)
+                if (!e->data->n_blocks && !e->incompressible && !e->busy)
+                    victim = e;
+
+        if (!victim)
+            break;
+
+        /* Keep both alive while we work on them */
+        victim->busy = TRUE;
+        victim->ref++;
+        old = victim->data;
+        old->ref++;
+
+        ca_mutex_unlock(pcm_mutex);
+
+        if (pcm_compress(&d, old, victim->nchannels, victim->type) < 0)
+            d = NULL;
+
+        ca_mutex_lock(pcm_mutex);
+
+        if (!d)
+            victim->incompressible = TRUE;
+        else if (!victim->dead && victim->data == old)
+            victim->hits = 0;
+
+        pcm_entry_swap_data(victim, old, d);
+
+        ca_mutex_unlock(pcm_mutex);
+
+        pcm_entry_unref(victim, old);
+    }
+
+    while (pcm_entries && pcm_entries->next && pcm_size > pcm_size_max) {
+        struct pcm_entry *last;
+
+        for (last = pcm_entries; last->next; last = last->next)
+            ;
+
+        pcm_entry_kill(last);
+    }
+
+    ca_mutex_unlock(pcm_mutex);
+}
+
+static int pcm_lookup(ca_sound_file *f) {
+    struct pcm_entry *e;
+    struct pcm_data *old, *d = NULL;
+    ca_bool_t promote;
+    struct stat st;
+    int ret;
+
+    ca_assert(f);
+    ca_assert(f->filename);
+
+    if ((ret = allocate_mutex()) < 0)
+        return ret;
+
+    /* Avoid the stat() if there's nothing cached anyway */
+    ca_mutex_lock(pcm_mutex);
+    e = pcm_entries;
+    ca_mutex_unlock(pcm_mutex);
+
+    if (!e)
+        return CA_ERROR_NOTFOUND;
+
+    if (stat(f->filename, &st) < 0)
+        return CA_ERROR_NOTFOUND;
+
+    ca_mutex_lock(pcm_mutex);
+
+    for (e = pcm_entries; e; e = e->next)
+        if (ca_streq(e->filename, f->filename))
+            break;
+
+    if (!e) {
+        ca_mutex_unlock(pcm_mutex);
+        return CA_ERROR_NOTFOUND;
+    }
+
+    if (e->mtime != st.st_mtime || e->file_size != st.st_size) {
+        /* The file changed behind our back */
+        pcm_entry_kill(e);
+        ca_mutex_unlock(pcm_mutex);
+        return CA_ERROR_NOTFOUND;
+    }
+
+    /* Keep the list in LRU order */
+    CA_LLIST_REMOVE(struct pcm_entry, pcm_entries, e);
+    CA_LLIST_PREPEND(struct pcm_entry, pcm_entries, e);
+
+    e->ref++;
+    e->data->ref++;
+    old = e->data;
+
+    /* Sounds that are played again and again become hot and are kept
+     * raw. The file reads from the compressed data until the raw
+     * data is installed, which happens without holding the lock. */
+    promote = old->n_blocks > 0 && !e->busy && ++e->hits >= PCM_PROMOTE_HITS;
+    if (promote)
+        e->busy = TRUE;
+
+    ca_mutex_unlock(pcm_mutex);
+
+    if (promote) {
+        if (pcm_uncompress(&d, old, e->size, e->nchannels) < 0)
+            d = NULL;
+
+        ca_mutex_lock(pcm_mutex);
+        pcm_entry_swap_data(e, old, d);
+        ca_mutex_unlock(pcm_mutex);
+
+        if (d)
+            pcm_balance();
+    }
+
+    f->pcm = e;
+    f->pcm_data = old;
+    f->pcm_index = 0;
+    f->nchannels = e->nchannels;
+    f->rate = e->rate;
+    f->type = e->type;
+
+    return CA_SUCCESS;
+}
+
+static int sound_file_open(ca_sound_file **_f, const char *fn) {
     FILE *file;
     ca_sound_file *f;
     int ret;
@@ -57,6 +642,11 @@ int ca_sound_file_open(ca_sound_file **_f, const char *fn) {
         goto fail;
     }
 
+    if (pcm_lookup(f) == CA_SUCCESS) {
+        *_f = f;
+        return CA_SUCCESS;
+    }
+
     if (!(file = fopen(fn, "r"))) {
         ret = errno == ENOENT ? CA_ERROR_NOTFOUND : CA_ERROR_SYSTEM;
         goto fail;
@@ -94,6 +684,16 @@ fail:
     return ret;
 }
 
+int ca_sound_file_open(ca_sound_file **f, const char *fn) {
+    int ret;
+
+    CA_PROBE1(sound_file_open_start, fn);
+    ret = sound_file_open(f, fn);
+    CA_PROBE2(sound_file_open_end, fn, ret);
+
+    return ret;
+}
+
 void ca_sound_file_close(ca_sound_file *f) {
     ca_assert(f);
 
@@ -101,6 +701,8 @@ void ca_sound_file_close(ca_sound_file *f) {
         ca_wav_close(f->wav);
     if (f->vorbis)
         ca_vorbis_close(f->vorbis);
+    if (f->pcm)
+        pcm_entry_unref(f->pcm, f->pcm_data);
 
     ca_free(f->filename);
     ca_free(f);
@@ -124,21 +726,49 @@ ca_sample_type_t ca_sound_file_get_sample_type(ca_sound_file *f) {
 const ca_channel_position_t* ca_sound_file_get_channel_map(ca_sound_file *f) {
     ca_assert(f);
 
-    if (f->wav)
+    if (f->pcm)
+        return f->pcm->channel_map;
+    else if (f->wav)
         return ca_wav_get_channel_map(f->wav);
     else
         return ca_vorbis_get_channel_map(f->vorbis);
 }
 
+static int pcm_read(ca_sound_file *f, void *d, size_t *n, size_t sample_size) {
+    size_t k;
+
+    ca_assert(f);
+    ca_assert(f->pcm);
+    ca_assert(f->pcm_index <= f->pcm->size);
+
+    k = (f->pcm->size - f->pcm_index) / sample_size;
+
+    if (k > *n)
+        k = *n;
+
+    if (f->pcm_data->n_blocks > 0)
+        pcm_decompress(f->pcm_data, f->pcm->size, f->nchannels, f->pcm_index, d, k * sample_size);
+    else
+        memcpy(d, f->pcm_data->data + f->pcm_index, k * sample_size);
+
+    f->pcm_index += k * sample_size;
+
+    *n = k;
+
+    return CA_SUCCESS;
+}
+
 int ca_sound_file_read_int16(ca_sound_file *f, int16_t *d, size_t *n) {
     ca_return_val_if_fail(f, CA_ERROR_INVALID);
     ca_return_val_if_fail(d, CA_ERROR_INVALID);
     ca_return_val_if_fail(n, CA_ERROR_INVALID);
     ca_return_val_if_fail(*n > 0, CA_ERROR_INVALID);
-    ca_return_val_if_fail(f->wav || f->vorbis, CA_ERROR_STATE);
+    ca_return_val_if_fail(f->wav || f->vorbis || f->pcm, CA_ERROR_STATE);
     ca_return_val_if_fail(f->type == CA_SAMPLE_S16NE || f->type == CA_SAMPLE_S16RE, CA_ERROR_STATE);
 
-    if (f->wav)
+    if (f->pcm)
+        return pcm_read(f, d, n, sizeof(int16_t));
+    else if (f->wav)
         return ca_wav_read_s16le(f->wav, d, n);
     else
         return ca_vorbis_read_s16ne(f->vorbis, d, n);
@@ -149,10 +779,12 @@ int ca_sound_file_read_uint8(ca_sound_file *f, uint8_t *d, size_t *n) {
     ca_return_val_if_fail(d, CA_ERROR_INVALID);
     ca_return_val_if_fail(n, CA_ERROR_INVALID);
     ca_return_val_if_fail(*n > 0, CA_ERROR_INVALID);
-    ca_return_val_if_fail(f->wav && !f->vorbis, CA_ERROR_STATE);
+    ca_return_val_if_fail((f->wav && !f->vorbis) || f->pcm, CA_ERROR_STATE);
     ca_return_val_if_fail(f->type == CA_SAMPLE_U8, CA_ERROR_STATE);
 
-    if (f->wav)
+    if (f->pcm)
+        return pcm_read(f, d, n, sizeof(uint8_t));
+    else if (f->wav)
         return ca_wav_read_u8(f->wav, d, n);
 
     return CA_ERROR_STATE;
@@ -198,7 +830,9 @@ int ca_sound_file_read_arbitrary(ca_sound_file *f, void *d, size_t *n) {
 off_t ca_sound_file_get_size(ca_sound_file *f) {
     ca_return_val_if_fail(f, (off_t) -1);
 
-    if (f->wav)
+    if (f->pcm)
+        return (off_t) (f->pcm->size - f->pcm_index);
+    else if (f->wav)
         return ca_wav_get_size(f->wav);
     else
         return ca_vorbis_get_size(f->vorbis);
@@ -213,3 +847,140 @@ size_t ca_sound_file_frame_size(ca_sound_file *f) {
 
     return c * (ca_sound_file_get_sample_type(f) == CA_SAMPLE_U8 ? 1U : 2U);
 }
+
+int ca_sound_file_cache(ca_sound_file *f) {
+    struct pcm_entry *e, *i;
+    const ca_channel_position_t *positions;
+    struct stat st;
+    off_t size;
+    uint8_t *data = NULL;
+    size_t n = 0;
+    int ret;
+
+    ca_return_val_if_fail(f, CA_ERROR_INVALID);
+
+    if (f->pcm)
+        return CA_SUCCESS;
+
+    ca_return_val_if_fail(f->wav || f->vorbis, CA_ERROR_STATE);
+
+    if ((ret = allocate_mutex()) < 0)
+        return ret;
+
+    if ((size = ca_sound_file_get_size(f)) <= 0)
+        return CA_ERROR_CORRUPT;
+
+    if ((size_t) size > pcm_size_max)
+        return CA_ERROR_TOOBIG;
+
+    if (stat(f->filename, &st) < 0)
+        return errno == ENOENT ? CA_ERROR_NOTFOUND : CA_ERROR_SYSTEM;
+
+    if (!(e = ca_new0(struct pcm_entry, 1)))
+        return CA_ERROR_OOM;
+
+    e->mtime = st.st_mtime;
+    e->file_size = st.st_size;
+    e->nchannels = f->nchannels;
+    e->rate = f->rate;
+    e->type = f->type;
+
+    if (!(e->filename = ca_strdup(f->filename)) ||
+        !(data = ca_malloc((size_t) size))) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    if ((positions = ca_sound_file_get_channel_map(f))) {
+        if (!(e->channel_map = ca_newdup(ca_channel_position_t, positions, f->nchannels))) {
+            ret = CA_ERROR_OOM;
+            goto fail;
+        }
+    }
+
+    /* Decode the whole file in one go */
+    while (n < (size_t) size) {
+        size_t k = (size_t) size - n;
+
+        if ((ret = ca_sound_file_read_arbitrary(f, data + n, &k)) < 0)
+            goto fail;
+
+        if (k <= 0)
+            break;
+
+        n += k;
+    }
+
+    e->size = n;
+
+    if (!(e->data = pcm_data_new(data, n, NULL, 0))) {
+        ret = CA_ERROR_OOM;
+        goto fail;
+    }
+
+    data = NULL;
+    e->ref = 1;
+
+    ca_mutex_lock(pcm_mutex);
+
+    /* Somebody else might have been quicker than us */
+    for (i = pcm_entries; i; i = i->next)
+        if (ca_streq(i->filename, e->filename)) {
+            pcm_entry_kill(i);
+            break;
+        }
+
+    CA_LLIST_PREPEND(struct pcm_entry, pcm_entries, e);
+    pcm_size += e->data->size;
+    pcm_raw_size += e->data->size;
+
+    /* Our reference on the current data */
+    f->pcm_data = e->data;
+    f->pcm_data->ref++;
+
+    ca_mutex_unlock(pcm_mutex);
+
+    /* This might compress or drop older entries */
+    pcm_balance();
+
+    /* From now on this file is served from memory, starting from the
+     * beginning again */
+    if (f->wav) {
+        ca_wav_close(f->wav);
+        f->wav = NULL;
+    }
+
+    if (f->vorbis) {
+        ca_vorbis_close(f->vorbis);
+        f->vorbis = NULL;
+    }
+
+    f->pcm = e;
+    f->pcm_index = 0;
+
+    return CA_SUCCESS;
+
+fail:
+    ca_free(data);
+    pcm_entry_free(e);
+
+    return ret;
+}
+
+#ifdef CA_GCC_DESTRUCTOR
+
+static void pcm_cache_free(void) CA_GCC_DESTRUCTOR;
+
+static void pcm_cache_free(void) {
+    /* Only here to make this valgrind clean */
+
+    while (pcm_entries)
+        pcm_entry_kill(pcm_entries);
+
+    if (pcm_mutex) {
+        ca_mutex_free(pcm_mutex);
+        pcm_mutex = NULL;
+    }
+}
+
+#endif
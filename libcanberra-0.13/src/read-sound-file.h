@@ -72,4 +72,10 @@ int ca_sound_file_read_arbitrary(ca_sound_file *f, void *d, size_t *n);
 
 size_t ca_sound_file_frame_size(ca_sound_file *f);
 
+/* Decode the file into the in-memory PCM cache. Needs to be called
+ * before anything has been read from it. Afterwards this and all later
+ * ca_sound_file_open() calls for the same file are served from
+ * memory. */
+int ca_sound_file_cache(ca_sound_file *f);
+
 #endif
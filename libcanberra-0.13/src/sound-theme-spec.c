@@ -31,6 +31,7 @@
 #include "malloc.h"
 #include "llist.h"
 #include "cache.h"
+#include "probes.h"
 
 #define DEFAULT_THEME "freedesktop"
 #define FALLBACK_THEME "freedesktop"
@@ -80,6 +81,53 @@ int ca_get_data_home(char **e) {
     return CA_SUCCESS;
 }
 
+int ca_get_cache_home(char **e) {
+    const char *env, *subdir;
+    char *r;
+    ca_return_val_if_fail(e, CA_ERROR_INVALID);
+
+    if ((env = getenv("XDG_CACHE_HOME")) && *env == '/')
+        subdir = "";
+    else if ((env = getenv("HOME")) && *env == '/')
+        subdir = "/.cache";
+    else {
+        *e = NULL;
+        return CA_SUCCESS;
+    }
+
+    if (!(r = ca_new(char, strlen(env) + strlen(subdir) + 1)))
+        return CA_ERROR_OOM;
+
+    sprintf(r, "%s%s", env, subdir);
+    *e = r;
+
+    return CA_SUCCESS;
+}
+
+int ca_get_config_home(char **e) {
+    const char *env, *subdir;
+    char *r;
+
+    ca_return_val_if_fail(e, CA_ERROR_INVALID);
+
+    if ((env = getenv("XDG_CONFIG_HOME")) && *env == '/')
+        subdir = "";
+    else if ((env = getenv("HOME")) && *env == '/')
+        subdir = "/.config";
+    else {
+        *e = NULL;
+        return CA_SUCCESS;
+    }
+
+    if (!(r = ca_new(char, strlen(env) + strlen(subdir) + 1)))
+        return CA_ERROR_OOM;
+
+    sprintf(r, "%s%s", env, subdir);
+    *e = r;
+
+    return CA_SUCCESS;
+}
+
 static ca_bool_t data_dir_matches(ca_data_dir *d, const char*output_profile) {
     ca_assert(d);
     ca_assert(output_profile);
@@ -745,11 +793,17 @@ static int find_sound_for_theme(
             ret = load_theme_data(t, FALLBACK_THEME);
 
     if (ret == CA_SUCCESS)
-        if ((ret = find_sound_in_theme(f, sfopen, sound_path, *t, name, locale, profile)) != CA_ERROR_NOTFOUND)
-            return ret;
+        ret = find_sound_in_theme(f, sfopen, sound_path, *t, name, locale, profile);
+    else
+        ret = CA_ERROR_NOTFOUND;
 
     /* Then, fall back to "unthemed" files */
-    return find_sound_in_theme(f, sfopen, sound_path, NULL, name, locale, profile);
+    if (ret == CA_ERROR_NOTFOUND)
+        ret = find_sound_in_theme(f, sfopen, sound_path, NULL, name, locale, profile);
+
+    CA_PROBE6(lookup_result, theme, name, locale, profile, ret, sound_path && ret == CA_SUCCESS ? *sound_path : NULL);
+
+    return ret;
 }
 
 int ca_lookup_sound_with_callback(
@@ -34,5 +34,7 @@ void ca_theme_data_free(ca_theme_data *t);
 
 int ca_get_data_home(char **e);
 const char *ca_get_data_dirs(void);
+int ca_get_cache_home(char **e);
+int ca_get_config_home(char **e);
 
 #endif
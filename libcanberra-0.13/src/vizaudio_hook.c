@@ -1,71 +1,234 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2009 Lennart Poettering
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef HAVE_VIZAUDIO
+#include <ltdl.h>
+#endif
+
 #include "canberra.h"
 #include "vizaudio_hook.h"
-#include "vizaudio.h"
-#include "config.h"
 #include "proplist.h"
+#include "sound-theme-spec.h"
+#include "vizaudio_rules.h"
+#include "vizaudio_settings.h"
+#include "malloc.h"
+#include "macro.h"
+#include "probes.h"
 
+#ifdef HAVE_VIZAUDIO
 
-#include <stdio.h>
-#include <string.h>
+/* libvizaudio pulls in GTK, GConf and cairo. We don't want any of
+ * that in processes that never show a visual effect, hence it is
+ * loaded on the first event that actually needs it. */
+
+struct vizaudio_module {
+    void (*flash_color)(char *color);
+    void (*flash_color_ex)(char *color, int duration_ms, double opacity);
+    void (*flash_image)(char *filename);
+    void (*flash_image_ex)(char *filename, int duration_ms);
+    void (*flash_text)(char *text);
+    void (*song_popup)(char *artist, char *title);
+};
+
+static struct vizaudio_module module;
+static ca_bool_t module_loaded = FALSE;
+
+#define MAKE_FUNC_PTR(ret, args, x) ((ret (*) args ) (size_t) (x))
+#define GET_FUNC_PTR(h, symbol, ret, args) MAKE_FUNC_PTR(ret, args, lt_dlsym((h), (symbol)))
 
-void vizaudio_display(ca_proplist *proplist) {
-	// Sorry for the goto. We skip the entire procedure if we're not enabled
-
-	if(!isVAEnabled()){
-		 goto finish;
-	}
-	
-	char* effect;
-	// Get the visual effect
-    effect = (char*) ca_proplist_gets_unlocked(proplist, CA_PROP_EVENT_VISUAL_EFFECT);
-	printf("NOT SEGFAULTING");
-	if(!strcmp(effect, "SONG_INFO_POPUP")){
-		// Grab additional info and goto finish if any are found
-		char* artist;
-		char* title;
-		artist = (char*) ca_proplist_gets_unlocked(proplist, CA_PROP_MEDIA_ARTIST);
-		title = (char*) ca_proplist_gets_unlocked(proplist, CA_PROP_MEDIA_TITLE);
-		
-		// Check for errors, break out if found
-		if(!artist){
-			printf("Artist not defined in property list\n");
-			goto finish;
-		}else if(!title){
-			printf("Title not defined in property list\n");
-			goto finish;
-		}
-		song_popup(artist, title);
-	}
-	else if (!strcmp(effect, "COLOR_ALERT")){
-		flash_color();
-		goto finish;
-	}
-	else if (!strcmp(effect, "IMAGE_ALERT")){
-		char* filename = (char*) ca_proplist_gets_unlocked(proplist, CA_PROP_MEDIA_IMAGE_FILENAME);
-		
-		// Determine if the file actually exists
-		FILE* file = fopen(filename, "r");
-		if(!file){
-			fclose(file);
-		}else{
-			printf("CA_PROP_MEDIA_IMAGE_FILENAME is invalid.\n");
-			goto finish;
-		}
-		flash_image(filename);
-	}
-	else if(!strcmp(effect, "FLYING_DESCRIPTION_TEXT_ALERT")){
-		char* text = (char*) ca_proplist_gets_unlocked(proplist, CA_PROP_EVENT_DESCRIPTION);
-		
-		// Check for errors
-		if(!text){
-			printf("CA_PROP_EVENT_DESCRIPTION is not defined.\n");
-		}else{
-			flash_text(text);
-		}
-	}
-	
-	finish:;
-	// Do nothing. This point is reached when the function completes either
-	// having displayed error messages or completing successfully.
+static void load_module_once(void) {
+    lt_dlhandle h;
+
+    if (lt_dlinit() != 0)
+        return;
+
+    if (!(h = lt_dlopenext(VIZAUDIO_MODULE))) {
+        lt_dlexit();
+        return;
+    }
+
+    /* Effects the module doesn't implement are simply skipped */
+    module.flash_color = GET_FUNC_PTR(h, "flash_color", void, (char *));
+    module.flash_color_ex = GET_FUNC_PTR(h, "flash_color_ex", void, (char *, int, double));
+    module.flash_image = GET_FUNC_PTR(h, "flash_image", void, (char *));
+    module.flash_image_ex = GET_FUNC_PTR(h, "flash_image_ex", void, (char *, int));
+    module.flash_text = GET_FUNC_PTR(h, "flash_text", void, (char *));
+    module.song_popup = GET_FUNC_PTR(h, "song_popup", void, (char *, char *));
+
+    /* We never unload the module again, GTK doesn't support that */
+    module_loaded = TRUE;
+}
+
+static ca_bool_t load_module(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if (pthread_once(&once, load_module_once) != 0)
+        return FALSE;
+
+    return module_loaded;
 }
 
+/* Used if there is no settings file, or for what it doesn't override */
+static const struct vizaudio_category_settings default_settings = {
+    .enabled = 1,
+    .effect = VIZAUDIO_SETTINGS_EFFECT_DEFAULT,
+    .color = 0xFFFFFFU,
+    .duration_ms = 250,
+    .opacity = 100
+};
+
+#endif
+
+void vizaudio_display(ca_proplist *p) {
+#ifdef HAVE_VIZAUDIO
+    const char *s, *id, *param = NULL;
+    const ca_visual_rule *r = NULL;
+    ca_visual_effect_t effect = CA_VISUAL_EFFECT_NONE;
+    struct vizaudio_settings settings;
+    struct vizaudio_category_settings cs = default_settings;
+    char color[8];
+
+    ca_return_if_fail(p);
+
+    id = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_ID);
+
+    /* Reading the settings is just a memcpy() from shared memory */
+    if (vizaudio_settings_get(&settings) == CA_SUCCESS) {
+
+        if (!settings.enabled)
+            return;
+
+        cs = settings.categories[id ? vizaudio_category_from_event_id(id) : VIZAUDIO_CATEGORY_OTHER];
+
+        if (!cs.enabled)
+            return;
+    }
+
+    /* An effect set explicitly by the application takes precedence,
+     * then the user's rules for the event id, and finally the
+     * preferences for the class of event. Most events end up with no
+     * effect at all, so let's find that out before we load
+     * anything. */
+    if ((s = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_VISUAL_EFFECT))) {
+        if (ca_visual_effect_from_string(&effect, s) < 0)
+            return;
+    } else if (id && (r = ca_visual_rule_lookup(id))) {
+        effect = r->effect;
+        param = r->param;
+    } else if (cs.effect == VIZAUDIO_SETTINGS_EFFECT_COLOR_ALERT)
+        effect = CA_VISUAL_EFFECT_COLOR_ALERT;
+    else if (cs.effect == VIZAUDIO_SETTINGS_EFFECT_TEXT_ALERT)
+        effect = CA_VISUAL_EFFECT_TEXT_ALERT;
+
+    if (effect == CA_VISUAL_EFFECT_NONE)
+        return;
+
+    if (!load_module())
+        return;
+
+    if ((s = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_VISUAL_DURATION))) {
+        char *e = NULL;
+        unsigned long ms;
+
+        errno = 0;
+        ms = strtoul(s, &e, 10);
+
+        if (errno == 0 && e > s && *e == 0 && ms > 0 && ms <= 60000)
+            cs.duration_ms = (uint32_t) ms;
+    }
+
+    /* The effects block until they are over */
+    CA_PROBE2(visual_start, ca_visual_effect_to_string(effect), id);
+
+    switch (effect) {
+
+        case CA_VISUAL_EFFECT_SONG_INFO_POPUP: {
+            const char *artist, *title;
+
+            artist = ca_proplist_gets_unlocked(p, CA_PROP_MEDIA_ARTIST);
+            title = ca_proplist_gets_unlocked(p, CA_PROP_MEDIA_TITLE);
+
+            if (artist && title && module.song_popup)
+                module.song_popup((char*) artist, (char*) title);
+
+            break;
+        }
+
+        case CA_VISUAL_EFFECT_COLOR_ALERT:
+
+            if (!param)
+                param = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_VISUAL_COLOR);
+
+            if (!param) {
+                snprintf(color, sizeof(color), "#%06x", (unsigned) (cs.color & 0xFFFFFFU));
+                param = color;
+            }
+
+            if (module.flash_color_ex)
+                module.flash_color_ex((char*) param, (int) cs.duration_ms, (double) CA_MIN(cs.opacity, 100U) / 100.0);
+            else if (module.flash_color)
+                module.flash_color((char*) param);
+
+            break;
+
+        case CA_VISUAL_EFFECT_IMAGE_ALERT:
+
+            if (!param)
+                param = ca_proplist_gets_unlocked(p, CA_PROP_MEDIA_IMAGE_FILENAME);
+
+            if (!param || access(param, R_OK) < 0)
+                break;
+
+            if (module.flash_image_ex)
+                module.flash_image_ex((char*) param, (int) cs.duration_ms);
+            else if (module.flash_image)
+                module.flash_image((char*) param);
+
+            break;
+
+        case CA_VISUAL_EFFECT_TEXT_ALERT:
+
+            if (!param)
+                param = ca_proplist_gets_unlocked(p, CA_PROP_EVENT_DESCRIPTION);
+
+            if (param && module.flash_text)
+                module.flash_text((char*) param);
+
+            break;
+
+        case CA_VISUAL_EFFECT_NONE:
+            break;
+    }
+
+    CA_PROBE2(visual_end, ca_visual_effect_to_string(effect), id);
+#endif
+}
@@ -1,3 +1,31 @@
-#include "canberra.h"
+#ifndef foocanberravizaudiohookhfoo
+#define foocanberravizaudiohookhfoo
 
-void vizaudio_display(ca_proplist *data);
+/***
+  This file is part of libcanberra.
+
+  Copyright 2009 Lennart Poettering
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include "proplist.h"
+
+/* Shows the visual effect requested by an event, if VizAudio is
+ * enabled. Blocks until the effect is over. Reads the property list
+ * without locking it, so pass a list nobody else uses. */
+void vizaudio_display(ca_proplist *p);
+
+#endif
@@ -0,0 +1,298 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "canberra.h"
+#include "vizaudio_rules.h"
+#include "sound-theme-spec.h"
+#include "malloc.h"
+#include "macro.h"
+
+/* Nodes are stored in one array and refer to each other by index.
+ * The root is node 0, so 0 doubles as "no node". */
+struct node {
+    char c;
+    unsigned child;
+    unsigned sibling;
+    int rule;
+};
+
+static struct node *nodes = NULL;
+static unsigned n_nodes = 0, n_nodes_allocated = 0;
+
+static ca_visual_rule *rules = NULL;
+static unsigned n_rules = 0, n_rules_allocated = 0;
+
+int ca_visual_effect_from_string(ca_visual_effect_t *effect, const char *s) {
+    ca_return_val_if_fail(effect, CA_ERROR_INVALID);
+    ca_return_val_if_fail(s, CA_ERROR_INVALID);
+
+    if (ca_streq(s, "NONE"))
+        *effect = CA_VISUAL_EFFECT_NONE;
+    else if (ca_streq(s, "SONG_INFO_POPUP"))
+        *effect = CA_VISUAL_EFFECT_SONG_INFO_POPUP;
+    else if (ca_streq(s, "COLOR_ALERT"))
+        *effect = CA_VISUAL_EFFECT_COLOR_ALERT;
+    else if (ca_streq(s, "IMAGE_ALERT"))
+        *effect = CA_VISUAL_EFFECT_IMAGE_ALERT;
+    else if (ca_streq(s, "FLYING_DESCRIPTION_TEXT_ALERT"))
+        *effect = CA_VISUAL_EFFECT_TEXT_ALERT;
+    else
+        return CA_ERROR_INVALID;
+
+    return CA_SUCCESS;
+}
+
+const char *ca_visual_effect_to_string(ca_visual_effect_t effect) {
+
+    switch (effect) {
+        case CA_VISUAL_EFFECT_NONE:
+            return "NONE";
+        case CA_VISUAL_EFFECT_SONG_INFO_POPUP:
+            return "SONG_INFO_POPUP";
+        case CA_VISUAL_EFFECT_COLOR_ALERT:
+            return "COLOR_ALERT";
+        case CA_VISUAL_EFFECT_IMAGE_ALERT:
+            return "IMAGE_ALERT";
+        case CA_VISUAL_EFFECT_TEXT_ALERT:
+            return "FLYING_DESCRIPTION_TEXT_ALERT";
+    }
+
+    return NULL;
+}
+
+static int node_new(unsigned *idx, char c) {
+
+    if (n_nodes >= n_nodes_allocated) {
+        struct node *n;
+        unsigned k;
+
+        k = n_nodes_allocated > 0 ? n_nodes_allocated * 2 : 64;
+
+        if (!(n = ca_new(struct node, k)))
+            return CA_ERROR_OOM;
+
+        if (nodes)
+            memcpy(n, nodes, sizeof(struct node) * n_nodes);
+
+        ca_free(nodes);
+        nodes = n;
+        n_nodes_allocated = k;
+    }
+
+    nodes[n_nodes].c = c;
+    nodes[n_nodes].child = 0;
+    nodes[n_nodes].sibling = 0;
+    nodes[n_nodes].rule = -1;
+
+    *idx = n_nodes++;
+    return CA_SUCCESS;
+}
+
+static int rule_new(int *idx, ca_visual_effect_t effect, const char *param) {
+
+    if (n_rules >= n_rules_allocated) {
+        ca_visual_rule *r;
+        unsigned k;
+
+        k = n_rules_allocated > 0 ? n_rules_allocated * 2 : 16;
+
+        if (!(r = ca_new(ca_visual_rule, k)))
+            return CA_ERROR_OOM;
+
+        if (rules)
+            memcpy(r, rules, sizeof(ca_visual_rule) * n_rules);
+
+        ca_free(rules);
+        rules = r;
+        n_rules_allocated = k;
+    }
+
+    rules[n_rules].effect = effect;
+    rules[n_rules].param = NULL;
+
+    if (param && *param)
+        if (!(rules[n_rules].param = ca_strdup(param)))
+            return CA_ERROR_OOM;
+
+    *idx = (int) n_rules++;
+    return CA_SUCCESS;
+}
+
+static int trie_insert(const char *id, ca_visual_effect_t effect, const char *param) {
+    unsigned n = 0;
+    const char *s;
+    int ret, r;
+
+    for (s = id; *s; s++) {
+        unsigned c, last = 0;
+
+        for (c = nodes[n].child; c; c = nodes[c].sibling) {
+            if (nodes[c].c == *s)
+                break;
+            last = c;
+        }
+
+        if (!c) {
+            if ((ret = node_new(&c, *s)) < 0)
+                return ret;
+
+            if (last)
+                nodes[last].sibling = c;
+            else
+                nodes[n].child = c;
+        }
+
+        n = c;
+    }
+
+    if ((ret = rule_new(&r, effect, param)) < 0)
+        return ret;
+
+    /* Later lines override earlier ones */
+    nodes[n].rule = r;
+
+    return CA_SUCCESS;
+}
+
+static void parse_line(char *l, const char *fn, unsigned line) {
+    char *id, *effect, *param, *e;
+    ca_visual_effect_t v;
+
+    l[strcspn(l, "\r\n")] = 0;
+    id = l + strspn(l, " \t");
+
+    if (!*id || *id == '#')
+        return;
+
+    e = id + strcspn(id, " \t");
+    if (*e)
+        *(e++) = 0;
+
+    effect = e + strspn(e, " \t");
+    e = effect + strcspn(effect, " \t");
+    if (*e)
+        *(e++) = 0;
+
+    param = e + strspn(e, " \t");
+    for (e = param + strlen(param); e > param && (e[-1] == ' ' || e[-1] == '\t'); e--)
+        e[-1] = 0;
+
+    /* We run inside some application, whose stderr is not ours to
+     * write to, unless debugging has been enabled */
+    if (!*effect || ca_visual_effect_from_string(&v, effect) < 0) {
+        if (ca_debug())
+            fprintf(stderr, "%s:%u: invalid visual effect rule.\n", fn, line);
+        return;
+    }
+
+    trie_insert(id, v, param);
+}
+
+static void load_rules_once(void) {
+    char *c, *fn;
+    FILE *f;
+    char l[1024];
+    unsigned line = 0, root;
+
+    if (node_new(&root, 0) < 0)
+        return;
+
+    if (ca_get_config_home(&c) < 0 || !c)
+        return;
+
+    fn = ca_sprintf_malloc("%s/vizaudio/rules", c);
+    ca_free(c);
+
+    if (!fn)
+        return;
+
+    if ((f = fopen(fn, "r"))) {
+
+        while (fgets(l, sizeof(l), f))
+            parse_line(l, fn, ++line);
+
+        fclose(f);
+    }
+
+    ca_free(fn);
+}
+
+const ca_visual_rule *ca_visual_rule_lookup(const char *event_id) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    const ca_visual_rule *r = NULL;
+    const char *s;
+    unsigned n = 0;
+
+    ca_return_null_if_fail(event_id);
+
+    if (pthread_once(&once, load_rules_once) != 0)
+        return NULL;
+
+    if (n_nodes <= 0)
+        return NULL;
+
+    /* Walk down the trie once, remembering the longest rule that
+     * covers a complete dash separated prefix of the id */
+    for (s = event_id;; s++) {
+        unsigned k;
+
+        if (s > event_id && (*s == 0 || *s == '-') && nodes[n].rule >= 0)
+            r = &rules[nodes[n].rule];
+
+        if (!*s)
+            break;
+
+        for (k = nodes[n].child; k; k = nodes[k].sibling)
+            if (nodes[k].c == *s)
+                break;
+
+        if (!k)
+            break;
+
+        n = k;
+    }
+
+    return r;
+}
+
+#ifdef CA_GCC_DESTRUCTOR
+
+static void free_rules(void) CA_GCC_DESTRUCTOR;
+
+static void free_rules(void) {
+    unsigned i;
+
+    /* Only here to make this valgrind clean */
+    for (i = 0; i < n_rules; i++)
+        ca_free(rules[i].param);
+
+    ca_free(rules);
+    ca_free(nodes);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef foocanberravizaudioruleshfoo
+#define foocanberravizaudioruleshfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+typedef enum ca_visual_effect {
+    CA_VISUAL_EFFECT_NONE,
+    CA_VISUAL_EFFECT_SONG_INFO_POPUP,
+    CA_VISUAL_EFFECT_COLOR_ALERT,
+    CA_VISUAL_EFFECT_IMAGE_ALERT,
+    CA_VISUAL_EFFECT_TEXT_ALERT
+} ca_visual_effect_t;
+
+typedef struct ca_visual_rule {
+    ca_visual_effect_t effect;
+
+    /* Color, image file name or text, depending on the effect. May
+     * be NULL. */
+    char *param;
+} ca_visual_rule;
+
+int ca_visual_effect_from_string(ca_visual_effect_t *effect, const char *s);
+const char *ca_visual_effect_to_string(ca_visual_effect_t effect);
+
+/* Finds the rule for an event id in $XDG_CONFIG_HOME/vizaudio/rules.
+ * Each line of that file consists of an event id, the name of an
+ * effect as used for CA_PROP_EVENT_VISUAL_EFFECT (or NONE) and an
+ * optional parameter for it:
+ *
+ *   dialog-error   COLOR_ALERT   red
+ *   dialog         COLOR_ALERT   yellow
+ *   window-close   FLYING_DESCRIPTION_TEXT_ALERT  Window closed
+ *
+ * Like sound names, event ids fall back to the next shorter dash
+ * separated prefix, so "dialog" above also matches "dialog-warning".
+ * The file is read and compiled into a trie on first use and never
+ * changes afterwards. Returns NULL if no rule matches. */
+const ca_visual_rule *ca_visual_rule_lookup(const char *event_id);
+
+#endif
@@ -0,0 +1,246 @@
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "canberra.h"
+#include "vizaudio_settings.h"
+#include "sound-theme-spec.h"
+#include "malloc.h"
+#include "macro.h"
+#include "mutex.h"
+
+/* How often we look for the settings file if it didn't exist */
+#define RETRY_INTERVAL 10
+
+/* How often a reader retries before it gives up on a writer that
+ * seems to be stuck in the middle of an update */
+#define N_READ_TRIES 100
+
+/* This part is not portable due to pthread_once usage, should be abstracted
+ * when we port this to platforms that do not have POSIX threading */
+
+static ca_mutex *mutex = NULL;
+
+/* Protected by mutex. Once set, map never changes again, hence it may
+ * be read without holding the mutex. */
+static const volatile struct vizaudio_settings *map = NULL;
+static time_t last_try = 0;
+
+static void allocate_mutex_once(void) {
+    mutex = ca_mutex_new();
+}
+
+static int allocate_mutex(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if (pthread_once(&once, allocate_mutex_once) != 0)
+        return CA_ERROR_OOM;
+
+    if (!mutex)
+        return CA_ERROR_OOM;
+
+    return 0;
+}
+
+static void map_file(void) {
+    char *c, *fn;
+    int fd;
+    struct stat st;
+    void *m;
+
+    if (ca_get_config_home(&c) < 0 || !c)
+        return;
+
+    fn = ca_sprintf_malloc("%s/" VIZAUDIO_SETTINGS_FILE, c);
+    ca_free(c);
+
+    if (!fn)
+        return;
+
+    fd = open(fn, O_RDONLY|O_NOCTTY
+#ifdef O_CLOEXEC
+              | O_CLOEXEC
+#endif
+              );
+    ca_free(fn);
+
+    if (fd < 0)
+        return;
+
+    /* The writer never truncates the file once it has created it, so
+     * as long as it is large enough now it will stay so */
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct vizaudio_settings)) {
+        close(fd);
+        return;
+    }
+
+    m = mmap(NULL, sizeof(struct vizaudio_settings), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (m == MAP_FAILED)
+        return;
+
+    map = m;
+}
+
+static const volatile struct vizaudio_settings *get_map(void) {
+    time_t now;
+
+    if (map)
+        return map;
+
+    if (allocate_mutex() < 0)
+        return NULL;
+
+    ca_mutex_lock(mutex);
+
+    if (!map) {
+        ca_assert_se(time(&now) != (time_t) -1);
+
+        if (last_try <= 0 || now < last_try || now >= last_try + RETRY_INTERVAL) {
+            last_try = now;
+            map_file();
+        }
+    }
+
+    ca_mutex_unlock(mutex);
+
+    return map;
+}
+
+int vizaudio_settings_get(struct vizaudio_settings *s) {
+    const volatile struct vizaudio_settings *m;
+    unsigned i;
+
+    ca_return_val_if_fail(s, CA_ERROR_INVALID);
+
+    if (!(m = get_map()))
+        return CA_ERROR_NOTFOUND;
+
+    for (i = 0; i < N_READ_TRIES; i++) {
+        uint32_t seq;
+
+        if ((seq = m->seq) & 1U) {
+            /* Writer is busy */
+            sched_yield();
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(s, (const void*) m, sizeof(*s));
+        __sync_synchronize();
+
+        if (m->seq != seq)
+            continue;
+
+        if (s->magic != VIZAUDIO_SETTINGS_MAGIC ||
+            s->version != VIZAUDIO_SETTINGS_VERSION ||
+            s->size < sizeof(*s))
+            return CA_ERROR_NOTFOUND;
+
+        return CA_SUCCESS;
+    }
+
+    return CA_ERROR_NOTFOUND;
+}
+
+static const struct {
+    const char *id;
+    vizaudio_category_t category;
+} category_table[] = {
+    { "bell",                       VIZAUDIO_CATEGORY_ALERT },
+    { "dialog-error",               VIZAUDIO_CATEGORY_ALERT },
+    { "dialog-warning",             VIZAUDIO_CATEGORY_ALERT },
+    { "alarm-clock-elapsed",        VIZAUDIO_CATEGORY_ALERT },
+    { "battery-caution",            VIZAUDIO_CATEGORY_ALERT },
+    { "battery-low",                VIZAUDIO_CATEGORY_ALERT },
+    { "suspend-error",              VIZAUDIO_CATEGORY_ALERT },
+    { "network-connectivity-error", VIZAUDIO_CATEGORY_ALERT },
+    { "software-update-urgent",     VIZAUDIO_CATEGORY_ALERT },
+
+    { "message",                    VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "dialog-information",         VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "dialog-question",            VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "complete",                   VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "phone",                      VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "service",                    VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "device",                     VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "network",                    VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "power",                      VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "battery",                    VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "software-update",            VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "desktop-login",              VIZAUDIO_CATEGORY_NOTIFICATION },
+    { "desktop-logout",             VIZAUDIO_CATEGORY_NOTIFICATION },
+
+    { "window",                     VIZAUDIO_CATEGORY_ACTION },
+    { "desktop",                    VIZAUDIO_CATEGORY_ACTION },
+    { "trash",                      VIZAUDIO_CATEGORY_ACTION },
+    { "item-deleted",               VIZAUDIO_CATEGORY_ACTION },
+    { "dialog-ok",                  VIZAUDIO_CATEGORY_ACTION },
+    { "dialog-cancel",              VIZAUDIO_CATEGORY_ACTION },
+    { "screen-capture",             VIZAUDIO_CATEGORY_ACTION },
+    { "camera-shutter",             VIZAUDIO_CATEGORY_ACTION },
+
+    { "button",                     VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "menu",                       VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "link",                       VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "item-selected",              VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "tooltip",                    VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "notebook",                   VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "expander",                   VIZAUDIO_CATEGORY_INPUT_FEEDBACK },
+    { "audio-volume-change",        VIZAUDIO_CATEGORY_INPUT_FEEDBACK }
+};
+
+vizaudio_category_t vizaudio_category_from_event_id(const char *event_id) {
+    size_t l;
+
+    ca_return_val_if_fail(event_id, VIZAUDIO_CATEGORY_OTHER);
+
+    /* Like sound names we fall back to shorter dash separated
+     * prefixes, so that "dialog-error-foo" is still an alert */
+    for (l = strlen(event_id); l > 0;) {
+        unsigned i;
+        const char *d;
+
+        for (i = 0; i < CA_ELEMENTSOF(category_table); i++)
+            if (strlen(category_table[i].id) == l &&
+                strncmp(category_table[i].id, event_id, l) == 0)
+                return category_table[i].category;
+
+        for (d = event_id + l - 1; d > event_id && *d != '-'; d--)
+            ;
+
+        l = (size_t) (d - event_id);
+    }
+
+    return VIZAUDIO_CATEGORY_OTHER;
+}
@@ -0,0 +1,82 @@
+#ifndef foocanberravizaudiosettingshfoo
+#define foocanberravizaudiosettingshfoo
+
+/***
+  This file is part of libcanberra.
+
+  Copyright 2026 The VizAudio Authors
+
+  libcanberra is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation, either version 2.1 of the
+  License, or (at your option) any later version.
+
+  libcanberra is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with libcanberra. If not, see
+  <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+/* The file format is shared between the VizAudio configuration tool
+ * (the writer) and libcanberra (the readers) and hence defined in
+ * both source trees. Keep the two copies identical; anything
+ * incompatible needs a new VIZAUDIO_SETTINGS_VERSION. */
+
+#define VIZAUDIO_SETTINGS_MAGIC 0x535a4956U
+#define VIZAUDIO_SETTINGS_VERSION 1U
+
+/* Event classes with their own visual preferences */
+typedef enum vizaudio_category {
+    VIZAUDIO_CATEGORY_ALERT,
+    VIZAUDIO_CATEGORY_NOTIFICATION,
+    VIZAUDIO_CATEGORY_ACTION,
+    VIZAUDIO_CATEGORY_INPUT_FEEDBACK,
+    VIZAUDIO_CATEGORY_OTHER,
+    VIZAUDIO_CATEGORY_MAX
+} vizaudio_category_t;
+
+typedef enum vizaudio_settings_effect {
+    /* Leave it to the application and the rule file */
+    VIZAUDIO_SETTINGS_EFFECT_DEFAULT,
+    VIZAUDIO_SETTINGS_EFFECT_COLOR_ALERT,
+    VIZAUDIO_SETTINGS_EFFECT_TEXT_ALERT
+} vizaudio_settings_effect_t;
+
+struct vizaudio_category_settings {
+    uint32_t enabled;
+    uint32_t effect;
+    uint32_t color;         /* 0xRRGGBB */
+    uint32_t duration_ms;
+    uint32_t opacity;       /* 0..100 */
+};
+
+/* The file is mapped shared by the writer and all readers. The writer
+ * makes seq odd while it is updating the rest and even again when it
+ * is done. Readers retry if seq was odd or changed while they copied
+ * the data. */
+struct vizaudio_settings {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t seq;
+
+    uint32_t enabled;
+    struct vizaudio_category_settings categories[VIZAUDIO_CATEGORY_MAX];
+};
+
+#define VIZAUDIO_SETTINGS_FILE "vizaudio/settings"
+
+/* Takes a consistent snapshot of $XDG_CONFIG_HOME/vizaudio/settings,
+ * without locking or talking to anybody. Returns CA_ERROR_NOTFOUND
+ * if the file doesn't exist (yet) or isn't usable. */
+int vizaudio_settings_get(struct vizaudio_settings *s);
+
+vizaudio_category_t vizaudio_category_from_event_id(const char *event_id);
+
+#endif
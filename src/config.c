@@ -28,16 +28,162 @@ GConfClient* client;
 gchar* dir = "/apps/vizaudio/preferences";
 gchar* key = "/apps/vizaudio/preferences/enabled";
 
+struct vizaudio_settings* settings;
+
+static const gchar* categoryNames[VIZAUDIO_CATEGORY_MAX] = {
+    "Alerts",
+    "Notifications",
+    "Actions",
+    "Input feedback",
+    "Other events"
+};
+
+/**
+ * Mirrors the enabled flag into the shared settings file. libcanberra
+ * checks that instead of GConf, so that it doesn't have to load
+ * libvizaudio (and GConf with it) just to find out it is disabled.
+ */
+static void writeEnabledFlag(gboolean enabled)
+{
+    if(!settings)
+    {
+        return;
+    }
+
+    settingsBeginUpdate(settings);
+    settings->enabled = enabled ? 1 : 0;
+    settingsEndUpdate(settings);
+}
+
+static void categoryEnabledCb(GtkToggleButton* button, gpointer data)
+{
+    int category = GPOINTER_TO_INT(data);
+
+    settingsBeginUpdate(settings);
+    settings->categories[category].enabled = gtk_toggle_button_get_active(button) ? 1 : 0;
+    settingsEndUpdate(settings);
+}
+
+static void categoryEffectCb(GtkComboBox* combo, gpointer data)
+{
+    int category = GPOINTER_TO_INT(data);
+
+    /* The combo box entries are in the order of vizaudio_settings_effect */
+    settingsBeginUpdate(settings);
+    settings->categories[category].effect = gtk_combo_box_get_active(combo);
+    settingsEndUpdate(settings);
+}
+
+static void categoryColorCb(GtkColorButton* button, gpointer data)
+{
+    int category = GPOINTER_TO_INT(data);
+    GdkColor color;
+
+    gtk_color_button_get_color(button, &color);
+
+    settingsBeginUpdate(settings);
+    settings->categories[category].color =
+        ((color.red >> 8) << 16) | ((color.green >> 8) << 8) | (color.blue >> 8);
+    settingsEndUpdate(settings);
+}
+
+static void categoryDurationCb(GtkSpinButton* spin, gpointer data)
+{
+    int category = GPOINTER_TO_INT(data);
+
+    settingsBeginUpdate(settings);
+    settings->categories[category].duration_ms = gtk_spin_button_get_value_as_int(spin);
+    settingsEndUpdate(settings);
+}
+
+static void categoryOpacityCb(GtkSpinButton* spin, gpointer data)
+{
+    int category = GPOINTER_TO_INT(data);
+
+    settingsBeginUpdate(settings);
+    settings->categories[category].opacity = gtk_spin_button_get_value_as_int(spin);
+    settingsEndUpdate(settings);
+}
+
+/**
+ * Builds a table with one row of preferences per event category
+ */
+static GtkWidget* createCategoryTable(void)
+{
+    GtkWidget* table;
+    int i;
+
+    table = gtk_table_new(VIZAUDIO_CATEGORY_MAX + 1, 5, FALSE);
+    gtk_table_set_col_spacings(GTK_TABLE(table), 8);
+
+    gtk_table_attach_defaults(GTK_TABLE(table), gtk_label_new("Effect"), 1, 2, 0, 1);
+    gtk_table_attach_defaults(GTK_TABLE(table), gtk_label_new("Color"), 2, 3, 0, 1);
+    gtk_table_attach_defaults(GTK_TABLE(table), gtk_label_new("Duration (ms)"), 3, 4, 0, 1);
+    gtk_table_attach_defaults(GTK_TABLE(table), gtk_label_new("Opacity (%)"), 4, 5, 0, 1);
+
+    for(i = 0; i < VIZAUDIO_CATEGORY_MAX; i++)
+    {
+        struct vizaudio_category_settings* c = &settings->categories[i];
+        GtkWidget* enabled;
+        GtkWidget* effect;
+        GtkWidget* color;
+        GtkWidget* duration;
+        GtkWidget* opacity;
+        GdkColor gdkColor;
+
+        enabled = gtk_check_button_new_with_label(categoryNames[i]);
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(enabled), c->enabled != 0);
+        g_signal_connect(G_OBJECT(enabled), "toggled",
+                         G_CALLBACK(categoryEnabledCb), GINT_TO_POINTER(i));
+
+        effect = gtk_combo_box_new_text();
+        gtk_combo_box_append_text(GTK_COMBO_BOX(effect), "Default");
+        gtk_combo_box_append_text(GTK_COMBO_BOX(effect), "Color flash");
+        gtk_combo_box_append_text(GTK_COMBO_BOX(effect), "Flying text");
+        gtk_combo_box_set_active(GTK_COMBO_BOX(effect), c->effect);
+        g_signal_connect(G_OBJECT(effect), "changed",
+                         G_CALLBACK(categoryEffectCb), GINT_TO_POINTER(i));
+
+        gdkColor.pixel = 0;
+        gdkColor.red = ((c->color >> 16) & 0xFF) * 0x101;
+        gdkColor.green = ((c->color >> 8) & 0xFF) * 0x101;
+        gdkColor.blue = (c->color & 0xFF) * 0x101;
+        color = gtk_color_button_new_with_color(&gdkColor);
+        g_signal_connect(G_OBJECT(color), "color-set",
+                         G_CALLBACK(categoryColorCb), GINT_TO_POINTER(i));
+
+        duration = gtk_spin_button_new_with_range(50, 5000, 50);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(duration), c->duration_ms);
+        g_signal_connect(G_OBJECT(duration), "value-changed",
+                         G_CALLBACK(categoryDurationCb), GINT_TO_POINTER(i));
+
+        opacity = gtk_spin_button_new_with_range(10, 100, 5);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(opacity), c->opacity);
+        g_signal_connect(G_OBJECT(opacity), "value-changed",
+                         G_CALLBACK(categoryOpacityCb), GINT_TO_POINTER(i));
+
+        gtk_table_attach_defaults(GTK_TABLE(table), enabled, 0, 1, i + 1, i + 2);
+        gtk_table_attach_defaults(GTK_TABLE(table), effect, 1, 2, i + 1, i + 2);
+        gtk_table_attach_defaults(GTK_TABLE(table), color, 2, 3, i + 1, i + 2);
+        gtk_table_attach_defaults(GTK_TABLE(table), duration, 3, 4, i + 1, i + 2);
+        gtk_table_attach_defaults(GTK_TABLE(table), opacity, 4, 5, i + 1, i + 2);
+    }
+
+    return table;
+}
+
 static gboolean toggleCb(GtkWidget* widget, GdkEvent* event, gpointer data)
 {
     /* Link the toggle button to the Gconf variable */
     if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)))
     {
         gconf_client_set_int(client, "/apps/vizaudio/preferences/enabled", 1, NULL);
+        writeEnabledFlag(TRUE);
     }
     else
     {
         gconf_client_set_int(client, "/apps/vizaudio/preferences/enabled", 0, NULL);
+        writeEnabledFlag(FALSE);
     }
     return FALSE;
 }
@@ -55,8 +201,10 @@ int main(int argc, char *argv[])
     GtkWidget* toggleButton;
     GtkWidget* quitButton;
     GtkWidget* vBox;
+    GtkWidget* categoryTable = NULL;
     
     client = gconf_client_get_default();
+    settings = settingsOpen();
     
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "VizAudio Configuration Manager");
@@ -68,6 +216,14 @@ int main(int argc, char *argv[])
     
     vBox = gtk_vbox_new(TRUE, 8);
     gtk_box_pack_start(GTK_BOX(vBox), toggleButton, FALSE, FALSE, 5);
+
+    /* Per category preferences only exist in the shared settings file */
+    if(settings)
+    {
+        categoryTable = createCategoryTable();
+        gtk_box_pack_start(GTK_BOX(vBox), categoryTable, FALSE, FALSE, 5);
+    }
+
     gtk_box_pack_start(GTK_BOX(vBox), quitButton, FALSE, FALSE, 0);
     
 
@@ -77,10 +233,12 @@ int main(int argc, char *argv[])
     if(gconf_client_get_int(client, "/apps/vizaudio/preferences/enabled", NULL))
     {
         gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggleButton), TRUE);
+        writeEnabledFlag(TRUE);
     }
     else
     {
         gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(toggleButton), FALSE);
+        writeEnabledFlag(FALSE);
     }
 
     /* Link up our callbacks */
@@ -98,6 +256,10 @@ int main(int argc, char *argv[])
     
     gtk_widget_show(quitButton);
     gtk_widget_show(toggleButton);
+    if(categoryTable)
+    {
+        gtk_widget_show_all(categoryTable);
+    }
     gtk_widget_show(vBox);
     gtk_widget_show(window);
     
@@ -3,4 +3,6 @@
 #include <gtk/gtk.h>
 #include <gconf/gconf-client.h>
 
+#include "settings.h"
+
 static gboolean toggleCb(GtkWidget* widget, GdkEvent* event, gpointer data);
@@ -0,0 +1,91 @@
+/**
+* Project: VizAudio
+* File name: governor.c
+* Description: Frame budget governor. Every animation tick reports how late
+*  it was, and the border, which doesn't animate, how late it appeared; if
+*  these are consistently late, effects step down one rung of the
+*  quality ladder, so alerts stay timely on machines that can't keep up
+*  instead of piling up behind each other. Once there was no pressure for a
+*  while we step back up again, one rung at a time.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#include "governor.h"
+#include "telemetry.h"
+#include "probes.h"
+
+/* Weight of a new sample in the moving average of the load */
+#define LOAD_WEIGHT 0.125
+
+/* Step down once the average tick takes a quarter longer than it
+ * should, but not on fewer samples than this */
+#define STEP_DOWN_LOAD 1.25
+#define STEP_DOWN_SAMPLES 8
+
+/* Step up again after this long without a late tick */
+#define RECOVER_QUIET_US (5 * G_GINT64_CONSTANT(1000000))
+
+/* All of this is only touched from the GTK main loop */
+static gdouble load = 0.0;
+static guint samples = 0;
+static GovernorQuality level = QUALITY_FULL;
+static gint64 lastChange = 0;
+static gint64 lastPressure = 0;
+
+void governorSample(gint64 us, gint64 budgetUs)
+{
+    gdouble r;
+    gint64 now;
+
+    if(budgetUs <= 0)
+    {
+        return;
+    }
+
+    now = telemetryNow();
+    r = (gdouble) us / (gdouble) budgetUs;
+
+    load = samples > 0 ? load + (r - load) * LOAD_WEIGHT : r;
+    samples++;
+
+    if(r > STEP_DOWN_LOAD)
+    {
+        lastPressure = now;
+    }
+
+    if(load > STEP_DOWN_LOAD && samples >= STEP_DOWN_SAMPLES && level < QUALITY_MAX - 1)
+    {
+        VA_PROBE2(quality_change, (int) level, (int) level + 1);
+        level++;
+        load = 0.0;
+        samples = 0;
+        lastChange = now;
+    }
+}
+
+GovernorQuality governorQuality(void)
+{
+    gint64 now = telemetryNow();
+
+    /* The cheaper rungs report one sample per effect at most, and
+     * the last one none at all, so recovery has to go by time alone */
+    if(level > QUALITY_FULL &&
+       now - lastPressure > RECOVER_QUIET_US &&
+       now - lastChange > RECOVER_QUIET_US)
+    {
+        VA_PROBE2(quality_change, (int) level, (int) level - 1);
+        level--;
+        load = 0.0;
+        samples = 0;
+        lastChange = now;
+    }
+
+    return level;
+}
@@ -0,0 +1,42 @@
+/**
+* Project: VizAudio
+* File name: governor.h
+* Description: Picks how elaborate the visual effects may be, based on how
+*  well the recent animations kept up with their frame cadence, and how
+*  quickly the border showed up.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#ifndef VIZAUDIO_GOVERNOR_H
+#define VIZAUDIO_GOVERNOR_H
+
+#include <glib.h>
+
+/* The quality ladder, from most to least expensive */
+typedef enum {
+    /* Full screen alpha text, color fades */
+    QUALITY_FULL,
+    /* Text in a window just big enough for it, colors without fade */
+    QUALITY_REGION,
+    /* A solid border around the screen, no animation at all */
+    QUALITY_BORDER,
+    /* Only make the window manager blink our windows' titles */
+    QUALITY_TITLE,
+    QUALITY_MAX
+} GovernorQuality;
+
+/* Feeds the time an animation tick, or showing the border, actually
+ * took, against the time it should have taken */
+void governorSample(gint64 us, gint64 budgetUs);
+
+/* The quality the next effect should be shown at */
+GovernorQuality governorQuality(void);
+
+#endif
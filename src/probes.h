@@ -0,0 +1,51 @@
+/**
+* Project: VizAudio
+* File name: probes.h
+* Description: USDT probes under the "libvizaudio" provider, for tracing
+*  live effect latency with perf, bpftrace or SystemTap. Each probe is a
+*  single nop when nobody is attached, and without <sys/sdt.h> they
+*  compile to nothing at all.
+* 
+*  The argument layouts are a stable interface. Arguments may be
+*  appended, but are never reordered, removed or changed in meaning.
+*  Effect and metric names are the ones vizaudio_telemetry_dump() uses.
+* 
+*   effect_start   (const char* effect, gint64 eventTimeUs)
+*                  the effect window is about to be shown or updated,
+*                  eventTimeUs is the CLOCK_MONOTONIC time of the request
+*   effect_end     (const char* effect)
+*                  the effect is over and its call returns
+*   metric         (const char* effect, const char* metric, gint64 us)
+*                  every sample that goes into the telemetry histograms
+*   quality_change (int from, int to)
+*                  the governor moved along the quality ladder
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#ifndef VIZAUDIO_PROBES_H
+#define VIZAUDIO_PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define VA_PROBE1(name, a) DTRACE_PROBE1(libvizaudio, name, a)
+#define VA_PROBE2(name, a, b) DTRACE_PROBE2(libvizaudio, name, a, b)
+#define VA_PROBE3(name, a, b, c) DTRACE_PROBE3(libvizaudio, name, a, b, c)
+
+#else
+
+#define VA_PROBE1(name, a) do { } while (0)
+#define VA_PROBE2(name, a, b) do { } while (0)
+#define VA_PROBE3(name, a, b, c) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+/**
+* Project: VizAudio
+* File name: settings.c
+* Description: Writer side of the settings file shared with libcanberra. The
+*  file is mapped into every process showing visual effects; readers take
+*  snapshots under a sequence lock, so an update here shows up everywhere
+*  without any notification traffic.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "settings.h"
+
+/* Only one writer at a time, serialized with flock() on this */
+static int settingsFd = -1;
+
+static void setDefaults(struct vizaudio_settings* settings)
+{
+    struct vizaudio_settings defaults;
+    int i;
+
+    memset(&defaults, 0, sizeof(defaults));
+
+    defaults.magic = VIZAUDIO_SETTINGS_MAGIC;
+    defaults.version = VIZAUDIO_SETTINGS_VERSION;
+    defaults.size = sizeof(defaults);
+    defaults.enabled = 1;
+
+    for(i = 0; i < VIZAUDIO_CATEGORY_MAX; i++)
+    {
+        defaults.categories[i].enabled = 1;
+        defaults.categories[i].effect = VIZAUDIO_SETTINGS_EFFECT_DEFAULT;
+        defaults.categories[i].color = 0xFFFFFF;
+        defaults.categories[i].duration_ms = 250;
+        defaults.categories[i].opacity = 100;
+    }
+
+    /* The caller made seq odd to keep readers away while we do this,
+     * so it must not change underneath them. Copying it over with
+     * the very same value leaves it as it is. */
+    defaults.seq = settings->seq;
+    memcpy(settings, &defaults, sizeof(defaults));
+}
+
+struct vizaudio_settings* settingsOpen(void)
+{
+    gchar* settingsDir;
+    gchar* settingsFile;
+    struct stat st;
+    struct vizaudio_settings* settings = NULL;
+    void* m;
+
+    settingsDir = g_build_filename(g_get_user_config_dir(), "vizaudio", NULL);
+    settingsFile = g_build_filename(g_get_user_config_dir(), VIZAUDIO_SETTINGS_FILE, NULL);
+
+    if(g_mkdir_with_parents(settingsDir, 0755) < 0)
+    {
+        goto finish;
+    }
+
+    if((settingsFd = open(settingsFile, O_RDWR|O_CREAT|O_NOCTTY, 0644)) < 0)
+    {
+        goto finish;
+    }
+
+    flock(settingsFd, LOCK_EX);
+
+    /* Readers rely on the file never shrinking, so we only ever grow it */
+    if(fstat(settingsFd, &st) < 0 ||
+       (st.st_size < (off_t) sizeof(*settings) &&
+        ftruncate(settingsFd, sizeof(*settings)) < 0))
+    {
+        flock(settingsFd, LOCK_UN);
+        goto fail;
+    }
+
+    m = mmap(NULL, sizeof(*settings), PROT_READ|PROT_WRITE, MAP_SHARED, settingsFd, 0);
+    if(m == MAP_FAILED)
+    {
+        flock(settingsFd, LOCK_UN);
+        goto fail;
+    }
+
+    settings = m;
+
+    if(settings->magic != VIZAUDIO_SETTINGS_MAGIC ||
+       settings->version != VIZAUDIO_SETTINGS_VERSION ||
+       settings->size < sizeof(*settings))
+    {
+        uint32_t seq = settings->seq;
+
+        /* Keep readers retrying while we reinitialize */
+        settings->seq = seq | 1;
+        __sync_synchronize();
+        setDefaults(settings);
+        __sync_synchronize();
+        settings->seq = (seq | 1) + 1;
+    }
+
+    flock(settingsFd, LOCK_UN);
+    goto finish;
+
+fail:
+    printf("Failed to open %s\n", settingsFile);
+    close(settingsFd);
+    settingsFd = -1;
+
+finish:
+    g_free(settingsFile);
+    g_free(settingsDir);
+    return settings;
+}
+
+void settingsBeginUpdate(struct vizaudio_settings* settings)
+{
+    flock(settingsFd, LOCK_EX);
+
+    /* Odd sequence numbers tell readers to retry */
+    settings->seq++;
+    __sync_synchronize();
+}
+
+void settingsEndUpdate(struct vizaudio_settings* settings)
+{
+    __sync_synchronize();
+    settings->seq++;
+
+    flock(settingsFd, LOCK_UN);
+}
@@ -0,0 +1,79 @@
+/**
+* Project: VizAudio
+* File name: settings.h
+* Description: Layout of the shared settings file and the functions the
+*  configuration tool uses to update it.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#ifndef VIZAUDIO_SETTINGS_H
+#define VIZAUDIO_SETTINGS_H
+
+#include <inttypes.h>
+
+/* The file format is shared between the VizAudio configuration tool
+ * (the writer) and libcanberra (the readers) and hence defined in
+ * both source trees. Keep the two copies identical; anything
+ * incompatible needs a new VIZAUDIO_SETTINGS_VERSION. */
+
+#define VIZAUDIO_SETTINGS_MAGIC 0x535a4956U
+#define VIZAUDIO_SETTINGS_VERSION 1U
+
+/* Event classes with their own visual preferences */
+typedef enum vizaudio_category {
+    VIZAUDIO_CATEGORY_ALERT,
+    VIZAUDIO_CATEGORY_NOTIFICATION,
+    VIZAUDIO_CATEGORY_ACTION,
+    VIZAUDIO_CATEGORY_INPUT_FEEDBACK,
+    VIZAUDIO_CATEGORY_OTHER,
+    VIZAUDIO_CATEGORY_MAX
+} vizaudio_category_t;
+
+typedef enum vizaudio_settings_effect {
+    /* Leave it to the application and the rule file */
+    VIZAUDIO_SETTINGS_EFFECT_DEFAULT,
+    VIZAUDIO_SETTINGS_EFFECT_COLOR_ALERT,
+    VIZAUDIO_SETTINGS_EFFECT_TEXT_ALERT
+} vizaudio_settings_effect_t;
+
+struct vizaudio_category_settings {
+    uint32_t enabled;
+    uint32_t effect;
+    uint32_t color;         /* 0xRRGGBB */
+    uint32_t duration_ms;
+    uint32_t opacity;       /* 0..100 */
+};
+
+/* The file is mapped shared by the writer and all readers. The writer
+ * makes seq odd while it is updating the rest and even again when it
+ * is done. Readers retry if seq was odd or changed while they copied
+ * the data. */
+struct vizaudio_settings {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t seq;
+
+    uint32_t enabled;
+    struct vizaudio_category_settings categories[VIZAUDIO_CATEGORY_MAX];
+};
+
+#define VIZAUDIO_SETTINGS_FILE "vizaudio/settings"
+
+/* Maps $XDG_CONFIG_HOME/vizaudio/settings for writing, creating and
+ * initializing it with defaults if needed. Returns NULL on failure. */
+struct vizaudio_settings* settingsOpen(void);
+
+/* Every change to the mapped settings has to be wrapped in these, so
+ * that readers never see a half written update */
+void settingsBeginUpdate(struct vizaudio_settings* settings);
+void settingsEndUpdate(struct vizaudio_settings* settings);
+
+#endif
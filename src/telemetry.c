@@ -0,0 +1,307 @@
+/**
+* Project: VizAudio
+* File name: telemetry.c
+* Description: Timing histograms for the visual effects. Every sample goes
+*  into a power of two bucket of microseconds, so recording is a handful
+*  of instructions and the memory use is fixed. If $VIZAUDIO_TELEMETRY is
+*  set, all histograms are written to that file ("-" for stderr) when the
+*  process exits.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "telemetry.h"
+#include "probes.h"
+
+typedef struct
+{
+    VizAudioEffect effect;
+    gint64 eventTime;
+    gint64 showTime;
+    gboolean pendingMap;
+    gboolean pendingPixel;
+} WindowTrack;
+
+static const char* const effectNames[VIZAUDIO_EFFECT_MAX] = {
+    "color", "image", "text", "song"
+};
+
+static const char* const metricNames[VIZAUDIO_METRIC_MAX] = {
+    "first_pixel", "map_latency", "frame_paint", "tick_interval"
+};
+
+G_LOCK_DEFINE_STATIC(telemetry);
+
+static VizAudioHistogram histograms[VIZAUDIO_EFFECT_MAX][VIZAUDIO_METRIC_MAX];
+static guint64 missedTicks[VIZAUDIO_EFFECT_MAX];
+static gint64 lastTick[VIZAUDIO_EFFECT_MAX];
+static gboolean dumpRegistered = FALSE;
+
+gint64 telemetryNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64) ts.tv_sec * G_GINT64_CONSTANT(1000000) + ts.tv_nsec / 1000;
+}
+
+void telemetryRecord(VizAudioEffect effect, VizAudioMetric metric, gint64 us)
+{
+    VizAudioHistogram* h;
+    guint64 v = us > 0 ? (guint64) us : 0;
+    guint b = 0;
+
+    VA_PROBE3(metric, effectNames[effect], metricNames[metric], us);
+
+    while(b < VIZAUDIO_HISTOGRAM_BUCKETS - 1 && (v >> (b + 1)) != 0)
+    {
+        b++;
+    }
+
+    G_LOCK(telemetry);
+
+    h = &histograms[effect][metric];
+    h->count++;
+    h->sumUs += v;
+    h->buckets[b]++;
+
+    if(v > h->maxUs)
+    {
+        h->maxUs = v;
+    }
+
+    G_UNLOCK(telemetry);
+}
+
+gint64 telemetryTick(VizAudioEffect effect, guint intervalMs)
+{
+    gint64 now = telemetryNow();
+    gint64 elapsed, missed;
+    gint64 interval = (gint64) intervalMs * 1000;
+
+    G_LOCK(telemetry);
+    elapsed = now - lastTick[effect];
+    lastTick[effect] = now;
+
+    if(interval > 0 && elapsed * 2 > interval * 3)
+    {
+        missed = elapsed / interval - 1;
+        missedTicks[effect] += missed > 0 ? (guint64) missed : 1;
+    }
+    G_UNLOCK(telemetry);
+
+    telemetryRecord(effect, VIZAUDIO_METRIC_TICK_INTERVAL, elapsed);
+
+    return elapsed;
+}
+
+/* Returns the upper bound of the bucket the given fraction of the
+ * samples falls into */
+static guint64 histogramPercentile(const VizAudioHistogram* h, double fraction)
+{
+    guint64 seen = 0;
+    guint64 want;
+    guint b;
+
+    if(h->count == 0)
+    {
+        return 0;
+    }
+
+    want = (guint64) (h->count * fraction);
+
+    for(b = 0; b < VIZAUDIO_HISTOGRAM_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+
+        if(seen > want)
+        {
+            break;
+        }
+    }
+
+    return MIN(h->maxUs, (G_GUINT64_CONSTANT(1) << (b + 1)) - 1);
+}
+
+static void dumpAtExit(void)
+{
+    const char* path = getenv("VIZAUDIO_TELEMETRY");
+    FILE* f;
+
+    if(path == NULL || *path == 0)
+    {
+        return;
+    }
+
+    if(strcmp(path, "-") == 0)
+    {
+        vizaudio_telemetry_dump(stderr);
+        return;
+    }
+
+    if((f = fopen(path, "a")) == NULL)
+    {
+        return;
+    }
+
+    vizaudio_telemetry_dump(f);
+    fclose(f);
+}
+
+static gboolean windowMapped(GtkWidget* window, GdkEvent* event, gpointer data)
+{
+    WindowTrack* t = data;
+
+    if(t->pendingMap)
+    {
+        telemetryRecord(t->effect, VIZAUDIO_METRIC_MAP_LATENCY, telemetryNow() - t->showTime);
+        t->pendingMap = FALSE;
+    }
+
+    return FALSE;
+}
+
+/* Connected after the effect's own expose handler, so the pixels are
+ * out by the time this runs */
+static gboolean windowExposed(GtkWidget* window, GdkEventExpose* event, gpointer data)
+{
+    WindowTrack* t = data;
+
+    if(t->pendingPixel)
+    {
+        telemetryRecord(t->effect, VIZAUDIO_METRIC_FIRST_PIXEL, telemetryNow() - t->eventTime);
+        t->pendingPixel = FALSE;
+    }
+
+    return FALSE;
+}
+
+void telemetryTrackWindow(GtkWidget* window, VizAudioEffect effect, gint64 eventTime)
+{
+    WindowTrack* t;
+    gint64 now = telemetryNow();
+
+    if((t = g_object_get_data(G_OBJECT(window), "vizaudio-telemetry")) == NULL)
+    {
+        t = g_new0(WindowTrack, 1);
+        g_object_set_data_full(G_OBJECT(window), "vizaudio-telemetry", t, g_free);
+        g_signal_connect(G_OBJECT(window), "map-event", G_CALLBACK(windowMapped), t);
+        g_signal_connect_after(G_OBJECT(window), "expose-event", G_CALLBACK(windowExposed), t);
+    }
+
+    VA_PROBE2(effect_start, effectNames[effect], eventTime);
+
+    t->effect = effect;
+    t->eventTime = eventTime;
+    t->showTime = now;
+    t->pendingMap = !GTK_WIDGET_MAPPED(window);
+    t->pendingPixel = TRUE;
+
+    G_LOCK(telemetry);
+    lastTick[effect] = now;
+
+    if(!dumpRegistered)
+    {
+        dumpRegistered = TRUE;
+
+        if(getenv("VIZAUDIO_TELEMETRY") != NULL)
+        {
+            atexit(dumpAtExit);
+        }
+    }
+    G_UNLOCK(telemetry);
+}
+
+gboolean vizaudio_telemetry_get(VizAudioEffect effect, VizAudioMetric metric, VizAudioHistogram* histogram)
+{
+    if(effect >= VIZAUDIO_EFFECT_MAX || metric >= VIZAUDIO_METRIC_MAX || histogram == NULL)
+    {
+        return FALSE;
+    }
+
+    G_LOCK(telemetry);
+    *histogram = histograms[effect][metric];
+    G_UNLOCK(telemetry);
+
+    return TRUE;
+}
+
+guint64 vizaudio_telemetry_missed_ticks(VizAudioEffect effect)
+{
+    guint64 n;
+
+    if(effect >= VIZAUDIO_EFFECT_MAX)
+    {
+        return 0;
+    }
+
+    G_LOCK(telemetry);
+    n = missedTicks[effect];
+    G_UNLOCK(telemetry);
+
+    return n;
+}
+
+void vizaudio_telemetry_dump(FILE* f)
+{
+    VizAudioHistogram h;
+    int e, m;
+    guint b;
+
+    for(e = 0; e < VIZAUDIO_EFFECT_MAX; e++)
+    {
+        for(m = 0; m < VIZAUDIO_METRIC_MAX; m++)
+        {
+            vizaudio_telemetry_get((VizAudioEffect) e, (VizAudioMetric) m, &h);
+
+            if(h.count == 0)
+            {
+                continue;
+            }
+
+            fprintf(f, "vizaudio %s %s count=%" G_GUINT64_FORMAT " mean_us=%" G_GUINT64_FORMAT
+                    " p50_us=%" G_GUINT64_FORMAT " p90_us=%" G_GUINT64_FORMAT
+                    " p99_us=%" G_GUINT64_FORMAT " max_us=%" G_GUINT64_FORMAT " buckets=",
+                    effectNames[e], metricNames[m], h.count, h.sumUs / h.count,
+                    histogramPercentile(&h, 0.5), histogramPercentile(&h, 0.9),
+                    histogramPercentile(&h, 0.99), h.maxUs);
+
+            /* Bucket i counts samples below 2^(i+1) microseconds */
+            for(b = 0; b < VIZAUDIO_HISTOGRAM_BUCKETS; b++)
+            {
+                fprintf(f, "%s%" G_GUINT64_FORMAT, b > 0 ? "," : "", h.buckets[b]);
+            }
+
+            fputc('\n', f);
+        }
+
+        if(vizaudio_telemetry_missed_ticks((VizAudioEffect) e) > 0)
+        {
+            fprintf(f, "vizaudio %s missed_ticks=%" G_GUINT64_FORMAT "\n",
+                    effectNames[e], vizaudio_telemetry_missed_ticks((VizAudioEffect) e));
+        }
+    }
+
+    fflush(f);
+}
+
+void vizaudio_telemetry_reset(void)
+{
+    G_LOCK(telemetry);
+    memset(histograms, 0, sizeof(histograms));
+    memset(missedTicks, 0, sizeof(missedTicks));
+    G_UNLOCK(telemetry);
+}
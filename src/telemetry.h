@@ -0,0 +1,39 @@
+/**
+* Project: VizAudio
+* File name: telemetry.h
+* Description: Internal interface the effects use to report their timings.
+*  The public read out functions are declared in vizaudio.h.
+* 
+*
+* LICENSE: This source file is subject to LGPL license
+* that is available through the world-wide-web at the following URI:
+* http://www.gnu.org/copyleft/lesser.html
+*
+* @copyright    Humanitarian FOSS Project (http://www.hfoss.org), Copyright (C) 2009.
+* @license  http://www.gnu.org/copyleft/lesser.html GNU Lesser General Public License (LGPL)
+*/
+
+#ifndef VIZAUDIO_TELEMETRY_H
+#define VIZAUDIO_TELEMETRY_H
+
+#include <vizaudio.h>
+
+/* Monotonic time in microseconds */
+gint64 telemetryNow(void);
+
+/* Adds one sample to the histogram of a metric */
+void telemetryRecord(VizAudioEffect effect, VizAudioMetric metric, gint64 us);
+
+/* To be called right before an effect window is shown, or updated in
+ * place. eventTime is when the effect was requested. Records the map
+ * latency if the window is not mapped yet, and the time to the first
+ * pixel at the next expose. Also restarts the tick tracking. */
+void telemetryTrackWindow(GtkWidget* window, VizAudioEffect effect, gint64 eventTime);
+
+/* To be called from every animation tick. Records the time since the
+ * last tick and counts the ticks that were missed when more than one
+ * and a half intervals passed. Returns the time since the last tick in
+ * microseconds. */
+gint64 telemetryTick(VizAudioEffect effect, guint intervalMs);
+
+#endif
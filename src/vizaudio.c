@@ -22,12 +22,36 @@
 * @version
 */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+
 #include <vizaudio.h>
+#include "telemetry.h"
+#include "governor.h"
+#include "probes.h"
 
 
 
 /* Global Variables */
 gboolean timer = TRUE;
+
+/* State of the running TEXT_ALERT animation, reset by flash_text() */
+static gdouble textAlpha = 1.0;
+static gdouble textSize = 1;
+
+/* The cadence of the TEXT_ALERT animation */
+#define TEXT_TICK_MS 50
+
+/* textDisplay() grows the text by 0.8 per frame. It starts to fade at
+ * size 20 and is gone 100 frames later. */
+#define TEXT_MAX_SIZE (20 + 100 * 0.8)
+#define TEXT_COLOR "#800000"
+
+/* How long the cheaper replacements for TEXT_ALERT are shown */
+#define TEXT_FALLBACK_MS 1000
+
+static void textBounds(const char* text, gint* width, gint* height);
 gint gconf_enabled_flag = 0;
 
 /**
@@ -65,44 +89,702 @@ int isVAEnabled(){
 
 //Quickly displays an image
 void flash_image(char* filePath) {
+	flash_image_ex(filePath, 250);
+}
+
+/* IMAGE_ALERT keeps the last image it showed in a server side Pixmap,
+ * which is used as the background of a reused window. Repeat alerts
+ * and exposes are then handled by the X server alone, instead of
+ * pushing all the pixels over the socket again every time. */
+typedef struct {
+	gchar* filePath;
+	time_t mtime;
+	off_t size;
+	gint maxWidth;
+	gint maxHeight;
+	GdkPixmap* pixmap;
+	gint width;
+	gint height;
+} ImageCache;
+
+static ImageCache imageCache = { NULL, 0, 0, 0, 0, NULL, 0, 0 };
+static GtkWidget* imageWindow = NULL;
+static guint imageTimeout = 0;
+
+/**
+ * Creates the window IMAGE_ALERT uses the first time it is needed
+ */
+static GtkWidget* getImageWindow(){
+	if(imageWindow != NULL){
+		return imageWindow;
+	}
+	
+	imageWindow = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_decorated(GTK_WINDOW(imageWindow), FALSE);
+	gtk_window_set_accept_focus(GTK_WINDOW(imageWindow), FALSE);
+	gtk_window_set_skip_taskbar_hint(GTK_WINDOW(imageWindow), TRUE);
+	gtk_window_set_skip_pager_hint(GTK_WINDOW(imageWindow), TRUE);
+	gtk_window_set_keep_above(GTK_WINDOW(imageWindow), TRUE);
+	
+	/* The background pixmap is all there is to draw */
+	gtk_widget_set_app_paintable(imageWindow, TRUE);
+	gtk_widget_set_double_buffered(imageWindow, FALSE);
+	gtk_widget_realize(imageWindow);
+	
+	g_signal_connect(G_OBJECT(imageWindow), "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+	
+	return imageWindow;
+}
+
+/**
+ * Converts an RGB triplet into a pixel value for the given visual
+ */
+static guint32 visualPixel(GdkVisual* visual, GdkColormap* colormap, guchar r, guchar g, guchar b){
+	GdkColor color;
+	
+	if(visual->type == GDK_VISUAL_TRUE_COLOR || visual->type == GDK_VISUAL_DIRECT_COLOR){
+		return (((guint32) (r * 257) >> (16 - visual->red_prec)) << visual->red_shift) |
+			(((guint32) (g * 257) >> (16 - visual->green_prec)) << visual->green_shift) |
+			(((guint32) (b * 257) >> (16 - visual->blue_prec)) << visual->blue_shift);
+	}
+	
+	/* Palette visuals are rare enough not to bother with a faster way */
+	color.red = r * 257;
+	color.green = g * 257;
+	color.blue = b * 257;
+	gdk_rgb_find_color(colormap, &color);
+	
+	return color.pixel;
+}
+
+/**
+ * Uploads an opaque pixbuf into a new server side Pixmap that is
+ * compatible with the given drawable.
+ * 
+ * Returns: The new Pixmap, or NULL on failure.
+ */
+static GdkPixmap* uploadPixbuf(GdkPixbuf* pixbuf, GdkDrawable* drawable){
+	GdkVisual* visual = gdk_drawable_get_visual(drawable);
+	GdkColormap* colormap = gdk_drawable_get_colormap(drawable);
+	gint width = gdk_pixbuf_get_width(pixbuf);
+	gint height = gdk_pixbuf_get_height(pixbuf);
+	gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+	gint stride = gdk_pixbuf_get_rowstride(pixbuf);
+	guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+	GdkImage* image;
+	GdkPixmap* pixmap;
+	GdkGC* gc;
+	gint x, y;
+	
+	/* A shared image is transferred through MIT-SHM. If the server
+	 * doesn't have the extension (Xvfb, remote displays) or the
+	 * segment can't be created we get NULL, and fall back to a normal
+	 * image, which is sent with XPutImage. */
+	image = gdk_image_new(GDK_IMAGE_SHARED, visual, width, height);
+	
+	if(image == NULL){
+		image = gdk_image_new(GDK_IMAGE_NORMAL, visual, width, height);
+	}
+	
+	if(image == NULL){
+		return NULL;
+	}
+	
+	for(y = 0; y < height; y++){
+		guchar* p = pixels + y * stride;
+		
+		for(x = 0; x < width; x++, p += channels){
+			gdk_image_put_pixel(image, x, y, visualPixel(visual, colormap, p[0], p[1], p[2]));
+		}
+	}
+	
+	pixmap = gdk_pixmap_new(drawable, width, height, -1);
+	gc = gdk_gc_new(pixmap);
+	gdk_draw_image(pixmap, gc, image, 0, 0, 0, 0, width, height);
+	
+	g_object_unref(gc);
+	g_object_unref(image);
+	
+	return pixmap;
+}
+
+/**
+ * Computes the largest size with the same aspect ratio as
+ * width x height that fits into maxWidth x maxHeight. Images that
+ * already fit are never enlarged.
+ */
+static void fitSize(gint width, gint height, gint maxWidth, gint maxHeight, gint* fitWidth, gint* fitHeight){
+	if(width <= maxWidth && height <= maxHeight){
+		*fitWidth = width;
+		*fitHeight = height;
+	}else if((gint64) width * maxHeight > (gint64) height * maxWidth){
+		*fitWidth = maxWidth;
+		*fitHeight = MAX(1, (gint) ((gint64) height * maxWidth / width));
+	}else{
+		*fitWidth = MAX(1, (gint) ((gint64) width * maxHeight / height));
+		*fitHeight = maxHeight;
+	}
+}
+
+/**
+ * Shrinks a pixbuf by an integer factor, averaging each factor x factor
+ * block. Source pixels that don't fill a whole block at the right and
+ * bottom edges are dropped.
+ * 
+ * The source rows are first summed up column by column, which is a
+ * plain loop over contiguous bytes that the compiler vectorizes.
+ * Only the much smaller horizontal pass has to deal with pixels.
+ */
+static GdkPixbuf* boxDownscale(GdkPixbuf* src, gint factor){
+	gint channels = gdk_pixbuf_get_n_channels(src);
+	gint srcStride = gdk_pixbuf_get_rowstride(src);
+	guchar* srcPixels = gdk_pixbuf_get_pixels(src);
+	gint width = gdk_pixbuf_get_width(src) / factor;
+	gint height = gdk_pixbuf_get_height(src) / factor;
+	gint spanBytes = width * factor * channels;
+	guint32 area = (guint32) factor * (guint32) factor;
+	GdkPixbuf* dst;
+	guchar* dstPixels;
+	gint dstStride;
+	guint32* acc;
+	gint x, y, i, j, k, c;
+	
+	if(width <= 0 || height <= 0){
+		return NULL;
+	}
+	
+	if((dst = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src), 8, width, height)) == NULL){
+		return NULL;
+	}
+	
+	dstPixels = gdk_pixbuf_get_pixels(dst);
+	dstStride = gdk_pixbuf_get_rowstride(dst);
+	acc = g_new(guint32, spanBytes);
+	
+	for(y = 0; y < height; y++){
+		guchar* d = dstPixels + y * dstStride;
+		
+		memset(acc, 0, spanBytes * sizeof(guint32));
+		
+		for(j = 0; j < factor; j++){
+			const guchar* s = srcPixels + (y * factor + j) * srcStride;
+			
+			for(i = 0; i < spanBytes; i++){
+				acc[i] += s[i];
+			}
+		}
+		
+		for(x = 0; x < width; x++){
+			for(c = 0; c < channels; c++){
+				guint32 sum = 0;
+				
+				for(k = 0; k < factor; k++){
+					sum += acc[(x * factor + k) * channels + c];
+				}
+				
+				d[x * channels + c] = (guchar) ((sum + area / 2) / area);
+			}
+		}
+	}
+	
+	g_free(acc);
+	
+	return dst;
+}
+
+/**
+ * Loads an image scaled down to fit into maxWidth x maxHeight.
+ * 
+ * JPEG and SVG can be decoded straight at the target size, using the
+ * DCT scaling of libjpeg respectively by rendering at that size, so
+ * the full sized image is never in memory. Everything else has to be
+ * decoded completely: it is then reduced with boxDownscale() by the
+ * largest integer factor that still fits, and the remaining fraction
+ * is done by gdk_pixbuf_scale_simple() on the much smaller result.
+ * 
+ * Returns: The new pixbuf, or NULL on failure.
+ */
+static GdkPixbuf* loadScaledPixbuf(char* filePath, gint maxWidth, gint maxHeight){
+	GdkPixbufFormat* format;
+	GdkPixbuf* pixbuf;
+	GdkPixbuf* scaled;
+	gint width = 0, height = 0, fitWidth, fitHeight, factor;
+	gchar* name;
+	gboolean scalesOnDecode = FALSE;
+	
+	/* This only reads as much of the file as it takes to find the size */
+	if((format = gdk_pixbuf_get_file_info(filePath, &width, &height)) != NULL){
+		name = gdk_pixbuf_format_get_name(format);
+		scalesOnDecode = strcmp(name, "jpeg") == 0 || strcmp(name, "svg") == 0;
+		g_free(name);
+	}
+	
+	if(width > 0 && height > 0){
+		fitSize(width, height, maxWidth, maxHeight, &fitWidth, &fitHeight);
+		
+		if(fitWidth == width && fitHeight == height){
+			return gdk_pixbuf_new_from_file(filePath, NULL);
+		}
+		
+		if(scalesOnDecode){
+			return gdk_pixbuf_new_from_file_at_scale(filePath, fitWidth, fitHeight, TRUE, NULL);
+		}
+	}
+	
+	if((pixbuf = gdk_pixbuf_new_from_file(filePath, NULL)) == NULL){
+		return NULL;
+	}
+	
+	width = gdk_pixbuf_get_width(pixbuf);
+	height = gdk_pixbuf_get_height(pixbuf);
+	fitSize(width, height, maxWidth, maxHeight, &fitWidth, &fitHeight);
+	
+	factor = MIN(width / fitWidth, height / fitHeight);
+	
+	if(factor >= 2 && (scaled = boxDownscale(pixbuf, factor)) != NULL){
+		g_object_unref(pixbuf);
+		pixbuf = scaled;
+	}
+	
+	if(gdk_pixbuf_get_width(pixbuf) != fitWidth || gdk_pixbuf_get_height(pixbuf) != fitHeight){
+		scaled = gdk_pixbuf_scale_simple(pixbuf, fitWidth, fitHeight, GDK_INTERP_BILINEAR);
+		g_object_unref(pixbuf);
+		pixbuf = scaled;
+	}
+	
+	return pixbuf;
+}
+
+/**
+ * Returns the server side Pixmap for an image file, bounded to
+ * maxWidth x maxHeight. The file is decoded and uploaded only if it
+ * isn't the one we uploaded last.
+ */
+static GdkPixmap* getImagePixmap(char* filePath, GtkWidget* window, gint maxWidth, gint maxHeight){
+	struct stat st;
+	GdkPixbuf* pixbuf;
+	GdkPixbuf* flat;
+	GdkPixmap* pixmap;
+	GdkColor* bg;
+	guint32 bgRGB;
+	
+	if(stat(filePath, &st) < 0){
+		return NULL;
+	}
+	
+	if(imageCache.pixmap != NULL &&
+	   strcmp(imageCache.filePath, filePath) == 0 &&
+	   imageCache.mtime == st.st_mtime &&
+	   imageCache.size == st.st_size &&
+	   imageCache.maxWidth == maxWidth &&
+	   imageCache.maxHeight == maxHeight){
+		return imageCache.pixmap;
+	}
+	
+	if((pixbuf = loadScaledPixbuf(filePath, maxWidth, maxHeight)) == NULL){
+		return NULL;
+	}
+	
+	/* X pixmaps have no alpha, so blend with the window background */
+	bg = &window->style->bg[GTK_STATE_NORMAL];
+	bgRGB = ((guint32) (bg->red >> 8) << 16) | ((guint32) (bg->green >> 8) << 8) | (guint32) (bg->blue >> 8);
+	
+	if(gdk_pixbuf_get_has_alpha(pixbuf)){
+		flat = gdk_pixbuf_composite_color_simple(pixbuf,
+			gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+			GDK_INTERP_NEAREST, 255, 8, bgRGB, bgRGB);
+		g_object_unref(pixbuf);
+		
+		if(flat == NULL){
+			return NULL;
+		}
+		
+		pixbuf = flat;
+	}
+	
+	pixmap = uploadPixbuf(pixbuf, window->window);
+	
+	if(pixmap == NULL){
+		g_object_unref(pixbuf);
+		return NULL;
+	}
+	
+	if(imageCache.pixmap != NULL){
+		g_object_unref(imageCache.pixmap);
+	}
+	g_free(imageCache.filePath);
+	
+	imageCache.filePath = g_strdup(filePath);
+	imageCache.mtime = st.st_mtime;
+	imageCache.size = st.st_size;
+	imageCache.maxWidth = maxWidth;
+	imageCache.maxHeight = maxHeight;
+	imageCache.pixmap = pixmap;
+	imageCache.width = gdk_pixbuf_get_width(pixbuf);
+	imageCache.height = gdk_pixbuf_get_height(pixbuf);
+	
+	g_object_unref(pixbuf);
+	
+	return pixmap;
+}
+
+/**
+ * Callback function for the end of an image flash
+ */
+static gboolean endImageFlash(gpointer data){
+	gtk_widget_hide(imageWindow);
+	imageTimeout = 0;
+	gtk_main_quit();
+	return FALSE;
+}
+
+/* Displays an image for durationMs milliseconds */
+void flash_image_ex(char* filePath, int durationMs) {
+	GtkWidget* window;
+	GdkPixmap* pixmap;
+	GdkScreen* screen;
+	GdkRectangle monitor;
+	gboolean running;
+	gint64 eventTime = telemetryNow();
+	
 	gtk_init(NULL, NULL);
 	
-	GtkWidget *window;
-	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-	gtk_window_set_decorated(GTK_WINDOW(window), FALSE);
-	gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
+	window = getImageWindow();
 	
-	GtkWidget* image;
-	image = gtk_image_new_from_file(filePath);
-	gtk_container_add (GTK_CONTAINER (window), image);
+	/* The image is shown centered on the monitor in the middle of the
+	 * screen, and never gets bigger than that monitor */
+	screen = gtk_widget_get_screen(window);
+	gdk_screen_get_monitor_geometry(screen,
+		gdk_screen_get_monitor_at_point(screen, gdk_screen_get_width(screen) / 2, gdk_screen_get_height(screen) / 2),
+		&monitor);
 	
-	gtk_widget_show(image);    
-	gtk_widget_show(window);        
+	if((pixmap = getImagePixmap(filePath, window, monitor.width, monitor.height)) == NULL){
+		return;
+	}
 	
-	g_timeout_add(250, (GSourceFunc)endFlash, (gpointer)window);
-    gtk_main();
+	gtk_window_resize(GTK_WINDOW(window), imageCache.width, imageCache.height);
+	gtk_window_move(GTK_WINDOW(window),
+		monitor.x + (monitor.width - imageCache.width) / 2,
+		monitor.y + (monitor.height - imageCache.height) / 2);
+	
+	gdk_window_set_back_pixmap(window->window, pixmap, FALSE);
+	gdk_window_clear(window->window);
+	
+	/* A flash requested while another one is still showing (from a
+	 * nested main loop) just replaces it */
+	running = imageTimeout != 0;
+	
+	if(running){
+		g_source_remove(imageTimeout);
+	}
+	
+	telemetryTrackWindow(window, VIZAUDIO_EFFECT_IMAGE, eventTime);
+	gtk_widget_show(window);
+	imageTimeout = g_timeout_add(durationMs > 0 ? durationMs : 250, endImageFlash, NULL);
+	
+	if(!running){
+		gtk_main();
+		VA_PROBE1(effect_end, "image");
+	}
+}
+
+/* The two cheapest rungs of the quality ladder, used in place of the
+ * real effects when the governor says we can't keep up */
+#define BORDER_WIDTH 8
+#define TITLE_BLINK_MIN_MS 2000
+
+/* The border doesn't animate, so instead of frame ticks it reports
+ * how long it took from the request until the X server had it on
+ * screen. Taking longer than a text animation tick for that counts as
+ * falling behind. */
+#define BORDER_BUDGET_MS TEXT_TICK_MS
 
+static GtkWidget* borderWindow = NULL;
+static guint borderTimeout = 0;
+static GList* blinkingWindows = NULL;
+static guint titleTimeout = 0;
+
+/**
+ * Callback function for the end of a border flash
+ */
+static gboolean endBorderFlash(gpointer data){
+	gtk_widget_hide(borderWindow);
+	borderTimeout = 0;
+	gtk_main_quit();
+	return FALSE;
+}
+
+/**
+ * Shows a solid frame around the screen. Only the frame is part of the
+ * window's shape, so nothing behind it needs to be repainted or
+ * blended, and the X server fills it with the background color.
+ * eventTime is when the effect was requested.
+ */
+static void flashBorder(char* colorName, int durationMs, gint64 eventTime){
+	GdkScreen* screen;
+	GdkColor color;
+	GdkRegion* region;
+	GdkRegion* inner;
+	GdkRectangle rect;
+	gboolean running;
+	
+	if(borderWindow == NULL){
+		borderWindow = gtk_window_new(GTK_WINDOW_POPUP);
+		gtk_widget_set_app_paintable(borderWindow, TRUE);
+		gtk_widget_set_double_buffered(borderWindow, FALSE);
+		gtk_widget_realize(borderWindow);
+	}
+	
+	screen = gtk_widget_get_screen(borderWindow);
+	rect.x = 0;
+	rect.y = 0;
+	rect.width = gdk_screen_get_width(screen);
+	rect.height = gdk_screen_get_height(screen);
+	
+	gtk_window_move(GTK_WINDOW(borderWindow), 0, 0);
+	gtk_window_resize(GTK_WINDOW(borderWindow), rect.width, rect.height);
+	
+	region = gdk_region_rectangle(&rect);
+	rect.x = rect.y = BORDER_WIDTH;
+	rect.width -= 2 * BORDER_WIDTH;
+	rect.height -= 2 * BORDER_WIDTH;
+	inner = gdk_region_rectangle(&rect);
+	gdk_region_subtract(region, inner);
+	gdk_window_shape_combine_region(borderWindow->window, region, 0, 0);
+	gdk_region_destroy(inner);
+	gdk_region_destroy(region);
+	
+	if(!gdk_color_parse(colorName, &color)){
+		gdk_color_parse("white", &color);
+	}
+	
+	gdk_rgb_find_color(gtk_widget_get_colormap(borderWindow), &color);
+	gdk_window_set_background(borderWindow->window, &color);
+	gdk_window_clear(borderWindow->window);
+	
+	running = borderTimeout != 0;
+	
+	if(running){
+		g_source_remove(borderTimeout);
+	}
+	
+	gtk_widget_show(borderWindow);
+	
+	/* Wait for the server to catch up, so that this tells us how late
+	 * the border really is */
+	gdk_display_sync(gtk_widget_get_display(borderWindow));
+	governorSample(telemetryNow() - eventTime, (gint64) BORDER_BUDGET_MS * 1000);
+	
+	borderTimeout = g_timeout_add(durationMs > 0 ? durationMs : 250, endBorderFlash, NULL);
+	
+	if(!running){
+		gtk_main();
+	}
+}
+
+/**
+ * Callback function for the end of a title blink
+ */
+static gboolean endTitleBlink(gpointer data){
+	GList* l;
+	
+	for(l = blinkingWindows; l != NULL; l = l->next){
+		gtk_window_set_urgency_hint(GTK_WINDOW(l->data), FALSE);
+		g_object_unref(l->data);
+	}
+	
+	g_list_free(blinkingWindows);
+	blinkingWindows = NULL;
+	titleTimeout = 0;
+	gtk_main_quit();
+	return FALSE;
+}
+
+/**
+ * Asks the window manager to draw attention to the application's own
+ * windows, which usually makes their titles or taskbar entries blink.
+ * We don't draw anything at all for this.
+ */
+static void blinkTitles(int durationMs){
+	GList* toplevels;
+	GList* l;
+	gboolean running = titleTimeout != 0;
+	
+	if(running){
+		g_source_remove(titleTimeout);
+	}else{
+		toplevels = gtk_window_list_toplevels();
+		
+		for(l = toplevels; l != NULL; l = l->next){
+			GtkWindow* w = GTK_WINDOW(l->data);
+			
+			/* Leave alone what the WM doesn't manage, and windows the
+			 * application marked urgent itself */
+			if(!GTK_WIDGET_VISIBLE(w) || w->type == GTK_WINDOW_POPUP || gtk_window_get_urgency_hint(w)){
+				continue;
+			}
+			
+			gtk_window_set_urgency_hint(w, TRUE);
+			blinkingWindows = g_list_prepend(blinkingWindows, g_object_ref(w));
+		}
+		
+		g_list_free(toplevels);
+		
+		if(blinkingWindows == NULL){
+			return;
+		}
+	}
+	
+	titleTimeout = g_timeout_add(MAX(durationMs, TITLE_BLINK_MIN_MS), endTitleBlink, NULL);
+	
+	if(!running){
+		gtk_main();
+	}
 }
 
 //Quickly displays a color fullscreen
 void flash_color(char* colorName) {
-	gtk_init(NULL, NULL);
+	flash_color_ex(colorName, 250, 1.0);
+}
+
+/* The COLOR_ALERT overlay is created once and then reused. Its color
+ * is the X window background, so the server fills it in without any
+ * help from us. While fading, each frame only changes
+ * _NET_WM_WINDOW_OPACITY, and the compositor does the blending. */
+static GtkWidget* colorOverlay = NULL;
+
+typedef struct {
+	gboolean running;
+	GTimer* timer;
+	gdouble durationMs;
+	gdouble opacity;
+	guint tickMs;
+} ColorFade;
+
+static ColorFade colorFade = { FALSE, NULL, 0, 0, 0 };
+
+#define FADE_FRAME_MS 16
+
+/**
+ * Creates the fullscreen color overlay the first time it is needed
+ */
+static GtkWidget* getColorOverlay(){
+	if(colorOverlay != NULL){
+		return colorOverlay;
+	}
 	
+	colorOverlay = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_decorated(GTK_WINDOW(colorOverlay), FALSE);
+	gtk_window_set_accept_focus(GTK_WINDOW(colorOverlay), FALSE);
+	gtk_window_set_skip_taskbar_hint(GTK_WINDOW(colorOverlay), TRUE);
+	gtk_window_set_skip_pager_hint(GTK_WINDOW(colorOverlay), TRUE);
+	gtk_window_set_keep_above(GTK_WINDOW(colorOverlay), TRUE);
+	gtk_window_fullscreen(GTK_WINDOW(colorOverlay));
 	
-	GtkWidget *window;
-	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-	gtk_window_set_decorated(GTK_WINDOW(window), FALSE);
-	gtk_window_fullscreen(GTK_WINDOW(window));
+	/* We never draw into the window ourselves */
+	gtk_widget_set_app_paintable(colorOverlay, TRUE);
+	gtk_widget_set_double_buffered(colorOverlay, FALSE);
+	gtk_widget_realize(colorOverlay);
+	
+	/* Don't let the window manager destroy our only overlay */
+	g_signal_connect(G_OBJECT(colorOverlay), "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+	
+	return colorOverlay;
+}
+
+/**
+ * Advances the color fade by one frame. The opacity is computed from
+ * the elapsed time, so late frames don't stretch the flash: it stays
+ * at full opacity for the first half and then fades out linearly.
+ */
+static gboolean fadeStep(gpointer data){
+	gdouble t;
+	
+	governorSample(telemetryTick(VIZAUDIO_EFFECT_COLOR, colorFade.tickMs), (gint64) colorFade.tickMs * 1000);
+	
+	t = g_timer_elapsed(colorFade.timer, NULL) * 1000.0 / colorFade.durationMs;
+	
+	if(t >= 1.0){
+		gtk_widget_hide(colorOverlay);
+		g_timer_destroy(colorFade.timer);
+		colorFade.timer = NULL;
+		colorFade.running = FALSE;
+		gtk_main_quit();
+		return FALSE;
+	}
+	
+	if(t > 0.5){
+		gtk_window_set_opacity(GTK_WINDOW(colorOverlay), colorFade.opacity * 2.0 * (1.0 - t));
+	}
+	
+	return TRUE;
+}
 
+/* Displays a color fullscreen for durationMs milliseconds and fades
+ * it out, if there's a compositing manager.
+ * 
+ * Parameters:
+ *  colorName - Anything gdk_color_parse() understands
+ *  durationMs - How long the color is shown
+ *  opacity - Window opacity between 0.0 and 1.0
+ */
+void flash_color_ex(char* colorName, int durationMs, double opacity) {
+	GtkWidget* window;
 	GdkColor color;
-	gdk_color_parse(colorName, &color);
-	gtk_widget_modify_bg(window, GTK_STATE_NORMAL, &color);
+	GovernorQuality quality;
+	gint64 eventTime = telemetryNow();
+	
+	gtk_init(NULL, NULL);
+	
+	quality = governorQuality();
+	
+	if(quality == QUALITY_BORDER){
+		flashBorder(colorName, durationMs, eventTime);
+		return;
+	}else if(quality == QUALITY_TITLE){
+		blinkTitles(durationMs);
+		return;
+	}
+	
+	window = getColorOverlay();
+	
+	if(!gdk_color_parse(colorName, &color)){
+		gdk_color_parse("white", &color);
+	}
+	
+	gdk_rgb_find_color(gtk_widget_get_colormap(window), &color);
+	gdk_window_set_background(window->window, &color);
+	gdk_window_clear(window->window);
+	
+	colorFade.durationMs = durationMs > 0 ? durationMs : 250;
+	colorFade.opacity = CLAMP(opacity, 0.0, 1.0);
+	gtk_window_set_opacity(GTK_WINDOW(window), colorFade.opacity);
 	
+	/* A flash requested while another one is still showing (from a
+	 * nested main loop) just restarts the running one */
+	if(colorFade.running){
+		g_timer_start(colorFade.timer);
+		return;
+	}
+	
+	colorFade.running = TRUE;
+	colorFade.timer = g_timer_new();
+	
+	/* Without a compositor the opacity is ignored anyway, so there is
+	 * no point in waking up for every frame. Neither is there when we
+	 * are short on time. */
+	if(quality == QUALITY_FULL && gdk_screen_is_composited(gtk_widget_get_screen(window))){
+		colorFade.tickMs = FADE_FRAME_MS;
+	}else{
+		colorFade.tickMs = (guint) colorFade.durationMs;
+	}
+	
+	telemetryTrackWindow(window, VIZAUDIO_EFFECT_COLOR, eventTime);
 	gtk_widget_show(window);
+	g_timeout_add(colorFade.tickMs, fadeStep, NULL);
 	
-	g_timeout_add(250, (GSourceFunc)endFlash, (gpointer)window);
 	gtk_main();
-
+	VA_PROBE1(effect_end, "color");
 }
 
 /* An effect that causes text to fly toward the screen
@@ -111,17 +793,42 @@ void flash_color(char* colorName) {
  *  text - The text to be displayed
  */
 void flash_text(char* text) {
+	gint64 eventTime = telemetryNow();
+	GovernorQuality quality;
+	gint width, height;
 	gtk_init(NULL, NULL);
+	
+	quality = governorQuality();
+	
+	if(quality == QUALITY_BORDER){
+		flashBorder(TEXT_COLOR, TEXT_FALLBACK_MS, eventTime);
+		return;
+	}else if(quality == QUALITY_TITLE){
+		blinkTitles(TEXT_FALLBACK_MS);
+		return;
+	}
+	
 	GtkWidget *window;
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_title(GTK_WINDOW(window), "Audio Event Alert!");
 	gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
 	gtk_widget_set_app_paintable(window, TRUE);
+	
+	/* Every alert starts its animation from the beginning */
+	timer = TRUE;
+	textAlpha = 1.0;
+	textSize = 1;
     
     GdkScreen* screen = gdk_screen_get_default();
-	gtk_window_set_default_size (GTK_WINDOW (window),
-                                 gdk_screen_get_width(screen),
-                                 gdk_screen_get_height(screen));
+	width = gdk_screen_get_width(screen);
+	height = gdk_screen_get_height(screen);
+	
+	/* Only repaint the area the text will actually cover */
+	if(quality == QUALITY_REGION){
+		textBounds(text, &width, &height);
+	}
+	
+	gtk_window_set_default_size (GTK_WINDOW (window), width, height);
     
     
 	
@@ -136,13 +843,191 @@ void flash_text(char* text) {
 	
 	screen_changed(window, NULL, NULL);
 	
-	g_timeout_add(50, (GSourceFunc) time_handler, (gpointer) window);
+	g_timeout_add(TEXT_TICK_MS, (GSourceFunc) time_handler, (gpointer) window);
+	telemetryTrackWindow(window, VIZAUDIO_EFFECT_TEXT, eventTime);
 	gtk_widget_show(window);
     gtk_main();
+	VA_PROBE1(effect_end, "text");
+
+
+}
+
+
+/* SONG_INFO_POPUP keeps one notification-like window around, with
+ * one PangoLayout each for the title and the artist. A track change
+ * while it is visible only replaces the text of those layouts, so
+ * skipping through a playlist costs one repaint per change and never
+ * stacks up windows. */
+#define POPUP_DURATION_MS 3000
+#define POPUP_PADDING 12
+#define POPUP_SPACING 4
+#define POPUP_MARGIN 24
+#define POPUP_MAX_WIDTH 400
+
+static GtkWidget* songPopup = NULL;
+static PangoLayout* songTitleLayout = NULL;
+static PangoLayout* songArtistLayout = NULL;
+static guint songPopupTimeout = 0;
+
+/**
+ * Paints the song popup from its cached layouts
+ */
+static gboolean songPopupExpose(GtkWidget* widget, GdkEventExpose* event, gpointer data){
+	cairo_t* cr;
+	gint titleHeight;
+	gint64 start = telemetryNow();
+	
+	cr = gdk_cairo_create(widget->window);
+	gdk_cairo_region(cr, event->region);
+	cairo_clip(cr);
+	
+	cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+	cairo_paint(cr);
+	
+	pango_layout_get_pixel_size(songTitleLayout, NULL, &titleHeight);
+	
+	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+	cairo_move_to(cr, POPUP_PADDING, POPUP_PADDING);
+	pango_cairo_show_layout(cr, songTitleLayout);
+	
+	cairo_set_source_rgb(cr, 0.75, 0.75, 0.75);
+	cairo_move_to(cr, POPUP_PADDING, POPUP_PADDING + titleHeight + POPUP_SPACING);
+	pango_cairo_show_layout(cr, songArtistLayout);
+	
+	cairo_destroy(cr);
+	telemetryRecord(VIZAUDIO_EFFECT_SONG, VIZAUDIO_METRIC_FRAME_PAINT, telemetryNow() - start);
+	return TRUE;
+}
+
+/**
+ * Creates a layout for one line of the song popup
+ */
+static PangoLayout* createSongLayout(GtkWidget* widget, const char* font){
+	PangoLayout* layout;
+	PangoFontDescription* desc;
+	
+	layout = gtk_widget_create_pango_layout(widget, "");
+	desc = pango_font_description_from_string(font);
+	pango_layout_set_font_description(layout, desc);
+	pango_font_description_free(desc);
+	
+	pango_layout_set_width(layout, POPUP_MAX_WIDTH * PANGO_SCALE);
+	pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+	
+	return layout;
+}
+
+/**
+ * Creates the song popup the first time it is needed
+ */
+static GtkWidget* getSongPopup(){
+	if(songPopup != NULL){
+		return songPopup;
+	}
+	
+	songPopup = gtk_window_new(GTK_WINDOW_POPUP);
+	gtk_widget_set_app_paintable(songPopup, TRUE);
+	g_signal_connect(G_OBJECT(songPopup), "expose-event", G_CALLBACK(songPopupExpose), NULL);
+	gtk_widget_realize(songPopup);
+	
+	songTitleLayout = createSongLayout(songPopup, "Sans Bold 13");
+	songArtistLayout = createSongLayout(songPopup, "Sans 11");
+	
+	return songPopup;
+}
 
+/**
+ * Sets the text of a cached layout, unless it already shows it.
+ * 
+ * Returns: TRUE if the text changed.
+ */
+static gboolean setLayoutText(PangoLayout* layout, const char* text){
+	if(strcmp(pango_layout_get_text(layout), text) == 0){
+		return FALSE;
+	}
+	
+	pango_layout_set_text(layout, text, -1);
+	return TRUE;
+}
 
+/**
+ * Sizes the song popup to its text and moves it into the bottom right
+ * corner of the first monitor
+ */
+static void placeSongPopup(GtkWidget* window){
+	GdkScreen* screen;
+	GdkRectangle monitor;
+	gint titleWidth, titleHeight, artistWidth, artistHeight, width, height;
+	
+	pango_layout_get_pixel_size(songTitleLayout, &titleWidth, &titleHeight);
+	pango_layout_get_pixel_size(songArtistLayout, &artistWidth, &artistHeight);
+	
+	width = MAX(titleWidth, artistWidth) + 2 * POPUP_PADDING;
+	height = titleHeight + POPUP_SPACING + artistHeight + 2 * POPUP_PADDING;
+	
+	screen = gtk_widget_get_screen(window);
+	gdk_screen_get_monitor_geometry(screen, 0, &monitor);
+	
+	gtk_window_resize(GTK_WINDOW(window), width, height);
+	gtk_window_move(GTK_WINDOW(window),
+		monitor.x + monitor.width - width - POPUP_MARGIN,
+		monitor.y + monitor.height - height - POPUP_MARGIN);
+}
+
+/**
+ * Callback function for the end of the song popup
+ */
+static gboolean endSongPopup(gpointer data){
+	gtk_widget_hide(songPopup);
+	songPopupTimeout = 0;
+	gtk_main_quit();
+	return FALSE;
 }
 
+/* Shows the artist and title of a new song in a popup. If the popup
+ * is already showing (from a nested main loop) its text is replaced
+ * and it stays up a while longer.
+ * 
+ * Parameters:
+ *  artist - The artist of the song
+ *  title - The title of the song
+ */
+void song_popup(char* artist, char* title) {
+	GtkWidget* window;
+	gboolean changed;
+	gboolean running;
+	gint64 eventTime = telemetryNow();
+	
+	gtk_init(NULL, NULL);
+	
+	window = getSongPopup();
+	
+	changed = setLayoutText(songTitleLayout, title ? title : "");
+	changed = setLayoutText(songArtistLayout, artist ? artist : "") || changed;
+	
+	if(changed || songPopupTimeout == 0){
+		telemetryTrackWindow(window, VIZAUDIO_EFFECT_SONG, eventTime);
+	}
+	
+	if(changed){
+		placeSongPopup(window);
+		gtk_widget_queue_draw(window);
+	}
+	
+	running = songPopupTimeout != 0;
+	
+	if(running){
+		g_source_remove(songPopupTimeout);
+	}
+	
+	songPopupTimeout = g_timeout_add(POPUP_DURATION_MS, endSongPopup, NULL);
+	
+	if(!running){
+		gtk_widget_show(window);
+		gtk_main();
+		VA_PROBE1(effect_end, "song");
+	}
+}
 
 /**
  * Callback function for the screen flash window destruction
@@ -169,59 +1054,180 @@ void screen_changed(GtkWidget *widget, GdkScreen *old_screen, gpointer user_data
 gboolean time_handler (GtkWidget *widget){
   if (widget->window == NULL) return FALSE;
 
-  if (!timer)    gtk_main_quit();
+  governorSample(telemetryTick(VIZAUDIO_EFFECT_TEXT, TEXT_TICK_MS), (gint64) TEXT_TICK_MS * 1000);
+
+  /* Destroying the window quits the main loop */
+  if (!timer) {
+    gtk_widget_destroy(widget);
+    return FALSE;
+  }
 
     // Send expose events
   gtk_widget_queue_draw(widget);
   return TRUE;
 }
 
+/* TEXT_ALERT shapes every description once with Pango, which also
+ * gets non-Latin scripts right, and rasterizes it into an A8 mask.
+ * Shapes are cached per text, font and power of two size bucket, and
+ * each frame only paints the mask of the current bucket scaled down
+ * to the current size. What a frame costs thus depends on the size of
+ * the text on the screen, not on how long the string is. */
+#define TEXT_FONT "Monospace Bold"
+#define TEXT_CACHE_MAX 8
+#define TEXT_BUCKET_MIN 16
+
+typedef struct {
+	gchar* text;
+	gchar* font;
+	gint bucket;
+	PangoLayout* layout;
+	cairo_surface_t* mask;
+	gint width;
+	gint height;
+} TextShape;
+
+/* Most recently used first */
+static GList* textCache = NULL;
+
+/**
+ * Returns the smallest size bucket that is at least size
+ */
+static gint textBucket(gdouble size){
+	gint bucket = TEXT_BUCKET_MIN;
+	
+	while(bucket < size){
+		bucket *= 2;
+	}
+	
+	return bucket;
+}
+
+static void freeTextShape(TextShape* shape){
+	g_free(shape->text);
+	g_free(shape->font);
+	g_object_unref(shape->layout);
+	cairo_surface_destroy(shape->mask);
+	g_free(shape);
+}
+
+/**
+ * Returns the cached shape of text in font at the given size bucket,
+ * shaping and rasterizing it first if it isn't cached yet.
+ */
+static TextShape* getTextShape(cairo_t* cr, const char* text, const char* font, gint bucket){
+	TextShape* shape;
+	PangoFontDescription* desc;
+	PangoRectangle ink;
+	cairo_t* maskCr;
+	GList* l;
+	
+	for(l = textCache; l != NULL; l = l->next){
+		shape = l->data;
+		
+		if(shape->bucket == bucket && strcmp(shape->text, text) == 0 && strcmp(shape->font, font) == 0){
+			textCache = g_list_remove_link(textCache, l);
+			textCache = g_list_concat(l, textCache);
+			return shape;
+		}
+	}
+	
+	shape = g_new0(TextShape, 1);
+	shape->text = g_strdup(text);
+	shape->font = g_strdup(font);
+	shape->bucket = bucket;
+	
+	desc = pango_font_description_from_string(font);
+	pango_font_description_set_absolute_size(desc, bucket * PANGO_SCALE);
+	
+	shape->layout = pango_cairo_create_layout(cr);
+	pango_layout_set_font_description(shape->layout, desc);
+	pango_layout_set_text(shape->layout, text, -1);
+	pango_font_description_free(desc);
+	
+	pango_layout_get_pixel_extents(shape->layout, &ink, NULL);
+	shape->width = MAX(ink.width, 1) + 2;
+	shape->height = MAX(ink.height, 1) + 2;
+	
+	/* Fill the glyph outlines once, with a pixel of padding so the
+	 * edges stay antialiased when the mask is scaled */
+	shape->mask = cairo_image_surface_create(CAIRO_FORMAT_A8, shape->width, shape->height);
+	maskCr = cairo_create(shape->mask);
+	cairo_translate(maskCr, 1 - ink.x, 1 - ink.y);
+	pango_cairo_layout_path(maskCr, shape->layout);
+	cairo_fill(maskCr);
+	cairo_destroy(maskCr);
+	
+	textCache = g_list_prepend(textCache, shape);
+	
+	if(g_list_length(textCache) > TEXT_CACHE_MAX){
+		l = g_list_last(textCache);
+		freeTextShape(l->data);
+		textCache = g_list_delete_link(textCache, l);
+	}
+	
+	return shape;
+}
+
+/**
+ * Shrinks width x height to the area the text covers at its largest
+ */
+static void textBounds(const char* text, gint* width, gint* height){
+	cairo_surface_t* surface;
+	cairo_t* cr;
+	TextShape* shape;
+	gdouble scale;
+	
+	surface = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+	cr = cairo_create(surface);
+	
+	shape = getTextShape(cr, text, TEXT_FONT, textBucket(TEXT_MAX_SIZE));
+	scale = TEXT_MAX_SIZE / shape->bucket;
+	
+	*width = MIN(*width, (gint) (shape->width * scale) + 2);
+	*height = MIN(*height, (gint) (shape->height * scale) + 2);
+	
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+}
+
 /** 
  * This function displays text flying toward the screen, growing as it moves.
  */
 gboolean textDisplay(GtkWidget *widget, GdkEventExpose *event, gpointer user_data) {
     cairo_t *cr;
-    cairo_text_extents_t extents;   
-
-    static gdouble alpha = 1.0;
-    static gdouble size = 1;
+    TextShape *shape;
+    gdouble scale;
+    gint64 start = telemetryNow();
     char* text = (char*) (gpointer) user_data;
+
     cr = gdk_cairo_create(widget->window);
 
     cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 0.0); 
-
-    gint x = widget->allocation.width / 2;
-    gint y = widget->allocation.height / 2;
     cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-
     cairo_paint(cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
 
-    cairo_select_font_face(cr, "Courier",
-      CAIRO_FONT_SLANT_NORMAL,
-      CAIRO_FONT_WEIGHT_BOLD);
+    textSize += 0.8;
 
-    size += 0.8;
-
-    if (size > 20) {
-      alpha -= 0.01;
+    if (textSize > 20) {
+      textAlpha -= 0.01;
     }
 
-    cairo_set_font_size(cr, size);
-
-    cairo_set_source_rgb(cr, 0.5, 0, 0); 
+    shape = getTextShape(cr, text, TEXT_FONT, textBucket(textSize));
+    scale = textSize / shape->bucket;
 
-    cairo_text_extents(cr, text, &extents);
-    cairo_move_to(cr, x - extents.width/2, y);
-    cairo_text_path(cr, text);
-    cairo_clip(cr);
-    cairo_stroke(cr);
-    cairo_paint_with_alpha(cr, alpha);
+    cairo_translate(cr, widget->allocation.width / 2, widget->allocation.height / 2);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_rgba(cr, 0.5, 0, 0, MAX(textAlpha, 0.0));
+    cairo_mask_surface(cr, shape->mask, -shape->width / 2.0, -shape->height / 2.0);
 
-    if (alpha <= 0) {
+    if (textAlpha <= 0) {
       timer = FALSE;
     }
 
     cairo_destroy(cr);
+    telemetryRecord(VIZAUDIO_EFFECT_TEXT, VIZAUDIO_METRIC_FRAME_PAINT, telemetryNow() - start);
     return FALSE;
 }
 
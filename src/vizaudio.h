@@ -20,15 +20,59 @@
 */
 
 
+#include <stdio.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkscreen.h>
 #include <cairo.h>
+#include <pango/pangocairo.h>
 #include <gconf/gconf-client.h>
 
+/* Telemetry
+ * 
+ * Every effect records how long it took from being requested to its
+ * first pixel, how long it took its window to get mapped, how long
+ * each animation frame took to paint, and how far apart its animation
+ * ticks were. If $VIZAUDIO_TELEMETRY is set to a file name (or "-" for
+ * stderr), vizaudio_telemetry_dump() is written there at exit. */
+typedef enum {
+	VIZAUDIO_EFFECT_COLOR,
+	VIZAUDIO_EFFECT_IMAGE,
+	VIZAUDIO_EFFECT_TEXT,
+	VIZAUDIO_EFFECT_SONG,
+	VIZAUDIO_EFFECT_MAX
+} VizAudioEffect;
+
+typedef enum {
+	VIZAUDIO_METRIC_FIRST_PIXEL,
+	VIZAUDIO_METRIC_MAP_LATENCY,
+	VIZAUDIO_METRIC_FRAME_PAINT,
+	VIZAUDIO_METRIC_TICK_INTERVAL,
+	VIZAUDIO_METRIC_MAX
+} VizAudioMetric;
+
+/* Bucket i counts the samples from 2^i up to 2^(i+1) microseconds,
+ * bucket 0 also those below 1us, the last one everything above */
+#define VIZAUDIO_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+	guint64 count;
+	guint64 sumUs;
+	guint64 maxUs;
+	guint64 buckets[VIZAUDIO_HISTOGRAM_BUCKETS];
+} VizAudioHistogram;
+
+gboolean vizaudio_telemetry_get(VizAudioEffect effect, VizAudioMetric metric, VizAudioHistogram* histogram);
+guint64 vizaudio_telemetry_missed_ticks(VizAudioEffect effect);
+void vizaudio_telemetry_dump(FILE* f);
+void vizaudio_telemetry_reset(void);
+
 /* Visual Effects */
-void flash_color();
+void flash_color(char* colorName);
+void flash_color_ex(char* colorName, int durationMs, double opacity);
 void flash_image(char* filename);
+void flash_image_ex(char* filename, int durationMs);
 void flash_text(char* text);
+void song_popup(char* artist, char* title);
 
 /* Visual Effect Helpers */
 gboolean endFlash(GtkWidget *window);